@@ -0,0 +1,183 @@
+#include "D3D9RenderDevice.h"
+#include "Effect.h"
+
+static const D3DRENDERSTATETYPE RenderStates[IRenderDevice::NUM_STATES] = {
+	D3DRS_ZENABLE,				// STATE_DEPTH_TEST
+	D3DRS_ZWRITEENABLE,			// STATE_DEPTH_WRITE
+	D3DRS_ALPHABLENDENABLE,		// STATE_BLEND
+	D3DRS_SRCBLEND,				// STATE_SRC_BLEND
+	D3DRS_DESTBLEND,			// STATE_DEST_BLEND
+};
+
+static const D3DBLEND BlendFactors[] = {
+	D3DBLEND_ZERO,				// BLEND_ZERO
+	D3DBLEND_ONE,				// BLEND_ONE
+	D3DBLEND_SRCALPHA,			// BLEND_SRC_ALPHA
+	D3DBLEND_INVSRCALPHA,		// BLEND_INV_SRC_ALPHA
+	D3DBLEND_DESTCOLOR,			// BLEND_DEST_COLOR
+};
+
+static const D3DTRANSFORMSTATETYPE Transforms[IRenderDevice::NUM_TRANSFORMS] = {
+	D3DTS_VIEW,					// TRANSFORM_VIEW
+	D3DTS_PROJECTION,			// TRANSFORM_PROJECTION
+	D3DTS_TEXTURE0,				// TRANSFORM_TEXTURE0
+};
+
+static D3DPRIMITIVETYPE ToD3D(IRenderDevice::PrimitiveType type)
+{
+	return (type == IRenderDevice::TRIANGLE_STRIP) ? D3DPT_TRIANGLESTRIP : D3DPT_TRIANGLELIST;
+}
+
+void D3D9RenderDevice::ResetState(IDirect3DVertexDeclaration9* pDeclaration)
+{
+	m_pDevice->SetRenderState(D3DRS_CULLMODE, D3DCULL_NONE);
+	m_pDevice->SetRenderState(D3DRS_LIGHTING, FALSE);
+	m_pDevice->SetVertexDeclaration(pDeclaration);
+
+	// Set color texture properties
+	m_pDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+	m_pDevice->SetTextureStageState(0, D3DTSS_TEXCOORDINDEX, 0);
+	m_pDevice->SetTextureStageState(0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE);
+	m_pDevice->SetTextureStageState(0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE);
+	m_pDevice->SetTextureStageState(0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE);
+	m_pDevice->SetSamplerState(0, D3DSAMP_MAGFILTER, D3DTEXF_LINEAR);
+	m_pDevice->SetSamplerState(0, D3DSAMP_MINFILTER, D3DTEXF_LINEAR);
+	m_pDevice->SetSamplerState(0, D3DSAMP_MIPFILTER, D3DTEXF_LINEAR);
+
+	// Set normal texture properties
+	m_pDevice->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
+	m_pDevice->SetTextureStageState(1, D3DTSS_TEXCOORDINDEX, 1);
+	m_pDevice->SetTextureStageState(1, D3DTSS_ALPHAOP,   D3DTOP_MODULATE);
+	m_pDevice->SetTextureStageState(1, D3DTSS_ALPHAARG1, D3DTA_TEXTURE);
+	m_pDevice->SetTextureStageState(1, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE);
+	m_pDevice->SetSamplerState(1, D3DSAMP_MAGFILTER, D3DTEXF_LINEAR);
+	m_pDevice->SetSamplerState(1, D3DSAMP_MINFILTER, D3DTEXF_LINEAR);
+	m_pDevice->SetSamplerState(1, D3DSAMP_MIPFILTER, D3DTEXF_LINEAR);
+
+	// Set world matrix
+	D3DXMATRIX identity;
+	D3DXMatrixIdentity(&identity);
+	m_pDevice->SetTransform(D3DTS_WORLD, &identity);
+}
+
+void D3D9RenderDevice::BeginScene()
+{
+	m_pDevice->BeginScene();
+
+	// The ground modulates its texture with the vertex color
+	m_pDevice->SetTextureStageState(0, D3DTSS_COLOROP, D3DTOP_MODULATE);
+}
+
+void D3D9RenderDevice::EndScene()
+{
+	// Effects may be reloaded between frames
+	ReleaseEffect();
+	m_pDevice->EndScene();
+}
+
+void D3D9RenderDevice::Present(RenderSwapChain* swapChain)
+{
+	if (swapChain != NULL)
+	{
+		ToD3D(swapChain)->Present(NULL, NULL, NULL, NULL, 0);
+	}
+	else
+	{
+		m_pDevice->Present(NULL, NULL, NULL, NULL);
+	}
+}
+
+void D3D9RenderDevice::SetState(State state, uint32_t value)
+{
+	if (state == STATE_SRC_BLEND || state == STATE_DEST_BLEND)
+	{
+		value = BlendFactors[value];
+	}
+	m_pDevice->SetRenderState(RenderStates[state], value);
+}
+
+void D3D9RenderDevice::SetTransform(Transform transform, const float* matrix) { m_pDevice->SetTransform(Transforms[transform], (const D3DMATRIX*)matrix); }
+void D3D9RenderDevice::SetTexture(unsigned int stage, RenderTexture* texture) { m_pDevice->SetTexture(stage, ToD3D(texture)); }
+void D3D9RenderDevice::SetRenderTarget(unsigned int index, RenderSurface* surface) { m_pDevice->SetRenderTarget(index, ToD3D(surface)); }
+void D3D9RenderDevice::SetDepthStencilSurface(RenderSurface* surface)       { m_pDevice->SetDepthStencilSurface(ToD3D(surface)); }
+
+void D3D9RenderDevice::Clear(unsigned int flags, uint32_t color, float z)
+{
+	DWORD d3dFlags = ((flags & CLEAR_TARGET) ? D3DCLEAR_TARGET : 0) | ((flags & CLEAR_DEPTH) ? D3DCLEAR_ZBUFFER : 0);
+	m_pDevice->Clear(0, NULL, d3dFlags, color, z, 0);
+}
+
+ID3DXEffect* D3D9RenderDevice::GetEffect(Effect* effect)
+{
+	if (effect != m_effect)
+	{
+		ReleaseEffect();
+		m_effect  = effect;
+		m_pEffect = effect->getD3DEffect();
+	}
+	return m_pEffect;
+}
+
+void D3D9RenderDevice::ReleaseEffect()
+{
+	SAFE_RELEASE(m_pEffect);
+	m_effect = NULL;
+}
+
+void D3D9RenderDevice::SetMatrix(Effect* effect, EffectHandle handle, const float* matrix)
+{
+	GetEffect(effect)->SetMatrix(handle, (const D3DXMATRIX*)matrix);
+}
+
+void D3D9RenderDevice::SetMatrixArray(Effect* effect, EffectHandle handle, const float* matrices, unsigned int count)
+{
+	GetEffect(effect)->SetMatrixArray(handle, (const D3DXMATRIX*)matrices, count);
+}
+
+void D3D9RenderDevice::SetVector(Effect* effect, EffectHandle handle, const float* vector)
+{
+	GetEffect(effect)->SetVector(handle, (const D3DXVECTOR4*)vector);
+}
+
+void D3D9RenderDevice::SetFloat(Effect* effect, EffectHandle handle, float value)
+{
+	GetEffect(effect)->SetFloat(handle, value);
+}
+
+void D3D9RenderDevice::SetEffectTexture(Effect* effect, EffectHandle handle, RenderTexture* texture)
+{
+	GetEffect(effect)->SetTexture(handle, ToD3D(texture));
+}
+
+unsigned int D3D9RenderDevice::BeginEffect(Effect* effect)
+{
+	UINT nPasses = 0;
+	GetEffect(effect)->Begin(&nPasses, 0);
+	return nPasses;
+}
+
+void D3D9RenderDevice::BeginPass(Effect* effect, unsigned int pass) { GetEffect(effect)->BeginPass(pass); }
+void D3D9RenderDevice::EndPass(Effect* effect)                      { GetEffect(effect)->EndPass(); }
+void D3D9RenderDevice::EndEffect(Effect* effect)                    { GetEffect(effect)->End(); }
+
+void D3D9RenderDevice::DrawPrimitiveUP(PrimitiveType type, unsigned int count, const void* vertices, unsigned int stride)
+{
+	m_pDevice->DrawPrimitiveUP(ToD3D(type), count, vertices, stride);
+}
+
+void D3D9RenderDevice::DrawIndexedPrimitiveUP(PrimitiveType type, unsigned int numVertices, unsigned int count, const uint16_t* indices, const void* vertices, unsigned int stride)
+{
+	m_pDevice->DrawIndexedPrimitiveUP(ToD3D(type), 0, numVertices, count, indices, D3DFMT_INDEX16, vertices, stride);
+}
+
+D3D9RenderDevice::D3D9RenderDevice(IDirect3DDevice9* pDevice)
+	: m_pDevice(pDevice), m_effect(NULL), m_pEffect(NULL)
+{
+	m_pDevice->AddRef();
+}
+
+D3D9RenderDevice::~D3D9RenderDevice()
+{
+	ReleaseEffect();
+	m_pDevice->Release();
+}
@@ -0,0 +1,71 @@
+#ifndef D3D9RENDERDEVICE_H
+#define D3D9RENDERDEVICE_H
+
+#include "types.h"
+#include "RenderDevice.h"
+
+// The render device's resources are the Direct3D ones
+inline RenderTexture*   ToRenderTexture(IDirect3DBaseTexture9* texture)     { return reinterpret_cast<RenderTexture*>(texture); }
+inline RenderSurface*   ToRenderSurface(IDirect3DSurface9* surface)         { return reinterpret_cast<RenderSurface*>(surface); }
+inline RenderSwapChain* ToRenderSwapChain(IDirect3DSwapChain9* swapChain)   { return reinterpret_cast<RenderSwapChain*>(swapChain); }
+inline IDirect3DBaseTexture9* ToD3D(RenderTexture* texture)                 { return reinterpret_cast<IDirect3DBaseTexture9*>(texture); }
+inline IDirect3DSurface9*     ToD3D(RenderSurface* surface)                 { return reinterpret_cast<IDirect3DSurface9*>(surface); }
+inline IDirect3DSwapChain9*   ToD3D(RenderSwapChain* swapChain)             { return reinterpret_cast<IDirect3DSwapChain9*>(swapChain); }
+
+//
+// Submits to Direct3D. The particles are drawn with effects; only the ground
+// uses the fixed function pipeline, whose state ResetState sets up.
+//
+class D3D9RenderDevice : public IRenderDevice
+{
+	IDirect3DDevice9* m_pDevice;
+
+	// The ID3DXEffect of the last effect used. Effect hands out references,
+	// so one is held from BeginEffect or the first parameter set until another
+	// effect is used or the scene ends.
+	Effect*           m_effect;
+	ID3DXEffect*      m_pEffect;
+
+	ID3DXEffect* GetEffect(Effect* effect);
+	void         ReleaseEffect();
+
+public:
+	// Sets the state that isn't set per frame, after the device was created
+	// or reset
+	void ResetState(IDirect3DVertexDeclaration9* pDeclaration);
+
+	void BeginScene();
+	void EndScene();
+	void Present(RenderSwapChain* swapChain);
+
+	void SetState(State state, uint32_t value);
+	void SetTransform(Transform transform, const float* matrix);
+	void SetTexture(unsigned int stage, RenderTexture* texture);
+	void SetRenderTarget(unsigned int index, RenderSurface* surface);
+	void SetDepthStencilSurface(RenderSurface* surface);
+	void Clear(unsigned int flags, uint32_t color, float z);
+
+	void SetMatrix(Effect* effect, EffectHandle handle, const float* matrix);
+	void SetMatrixArray(Effect* effect, EffectHandle handle, const float* matrices, unsigned int count);
+	void SetVector(Effect* effect, EffectHandle handle, const float* vector);
+	void SetFloat(Effect* effect, EffectHandle handle, float value);
+	void SetEffectTexture(Effect* effect, EffectHandle handle, RenderTexture* texture);
+
+	unsigned int BeginEffect(Effect* effect);
+	void BeginPass(Effect* effect, unsigned int pass);
+	void EndPass(Effect* effect);
+	void EndEffect(Effect* effect);
+
+	void DrawPrimitiveUP(PrimitiveType type, unsigned int count, const void* vertices, unsigned int stride);
+	void DrawIndexedPrimitiveUP(PrimitiveType type, unsigned int numVertices, unsigned int count, const uint16_t* indices, const void* vertices, unsigned int stride);
+
+	D3D9RenderDevice(IDirect3DDevice9* pDevice);
+	~D3D9RenderDevice();
+
+private:
+	// No copying
+	D3D9RenderDevice(const D3D9RenderDevice&);
+	D3D9RenderDevice& operator=(const D3D9RenderDevice&);
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include "EmissionMesh.h"
+#include "exceptions.h"
+#include <sstream>
+using namespace std;
+
+// rand() may only have 15 bits, too few to reach every triangle of a large
+// mesh, so two calls are combined. It stays seeded by srand().
+static const double RAND_RANGE = (double)RAND_MAX + 1;
+
+// Returns a random number in [0, 1)
+static double GetWideRandom()
+{
+	return (rand() * RAND_RANGE + rand()) / (RAND_RANGE * RAND_RANGE);
+}
+
+// Returns a random index in [0, count)
+static size_t GetRandomIndex(size_t count)
+{
+	return min((size_t)(GetWideRandom() * count), count - 1);
+}
+
+// Parses an OBJ face index ("v", "v/vt", "v//vn" or "v/vt/vn"); negative indices are relative
+static size_t ParseFaceIndex(const string& token, size_t numVertices)
+{
+	long index = strtol(token.c_str(), NULL, 10);
+	if (index < 0)
+	{
+		index += (long)numVertices + 1;
+	}
+	if (index < 1 || index > (long)numVertices)
+	{
+		throw BadFileException();
+	}
+	return (size_t)index - 1;
+}
+
+void EmissionMesh::Read(IFile* file)
+{
+	string text(file->size(), '\0');
+	if (!text.empty() && file->read(&text[0], (unsigned long)text.size()) != text.size())
+	{
+		throw ReadException();
+	}
+
+	istringstream lines(text);
+	string line;
+	while (getline(lines, line))
+	{
+		istringstream tokens(line);
+		string type;
+		tokens >> type;
+		if (type == "v")
+		{
+			D3DXVECTOR3 v;
+			if (!(tokens >> v.x >> v.y >> v.z))
+			{
+				throw BadFileException();
+			}
+			m_positions.push_back(v);
+		}
+		else if (type == "f")
+		{
+			// Triangulate polygons as a fan
+			vector<size_t> face;
+			string token;
+			while (tokens >> token)
+			{
+				face.push_back(ParseFaceIndex(token, m_positions.size()));
+			}
+			for (size_t i = 2; i < face.size(); i++)
+			{
+				Triangle triangle = {{face[0], face[i - 1], face[i]}};
+				m_triangles.push_back(triangle);
+			}
+		}
+		// Everything else (normals, texture coordinates, groups, materials) is ignored
+	}
+
+	if (m_triangles.empty())
+	{
+		throw BadFileException();
+	}
+}
+
+// Builds the alias table, so that a triangle can be picked by area with one
+// random number and one comparison, regardless of the number of triangles.
+void EmissionMesh::BuildAliasTable(const vector<float>& areas)
+{
+	size_t n = areas.size();
+	m_probability.resize(n);
+	m_alias.resize(n);
+
+	float total = 0.0f;
+	for (size_t i = 0; i < n; i++)
+	{
+		total += areas[i];
+	}
+
+	// Scale so the average is 1, and split into under- and overfull columns
+	vector<float>  scaled(n);
+	vector<size_t> small, large;
+	for (size_t i = 0; i < n; i++)
+	{
+		scaled[i] = (total > 0.0f) ? areas[i] * n / total : 1.0f;
+		(scaled[i] < 1.0f ? small : large).push_back(i);
+	}
+
+	// Fill each underfull column with the remainder of an overfull one
+	while (!small.empty() && !large.empty())
+	{
+		size_t s = small.back(); small.pop_back();
+		size_t l = large.back(); large.pop_back();
+		m_probability[s] = scaled[s];
+		m_alias[s]       = l;
+		scaled[l] = (scaled[l] + scaled[s]) - 1.0f;
+		(scaled[l] < 1.0f ? small : large).push_back(l);
+	}
+
+	// What's left is full, save for rounding errors
+	for (size_t i = 0; i < small.size(); i++) { m_probability[small[i]] = 1.0f; m_alias[small[i]] = small[i]; }
+	for (size_t i = 0; i < large.size(); i++) { m_probability[large[i]] = 1.0f; m_alias[large[i]] = large[i]; }
+}
+
+void EmissionMesh::GetVertex(size_t index, D3DXVECTOR3& position, D3DXVECTOR3& normal) const
+{
+	position = m_positions[index];
+	normal   = m_normals[index];
+}
+
+void EmissionMesh::SampleVertex(D3DXVECTOR3& position, D3DXVECTOR3& normal) const
+{
+	GetVertex(GetRandomIndex(m_positions.size()), position, normal);
+}
+
+void EmissionMesh::SampleSurface(D3DXVECTOR3& position, D3DXVECTOR3& normal) const
+{
+	// Pick a column, then the column's triangle or its alias
+	size_t column = GetRandomIndex(m_triangles.size());
+	const Triangle& triangle = m_triangles[(GetWideRandom() < m_probability[column]) ? column : m_alias[column]];
+
+	// Uniform barycentric coordinates
+	float r1 = sqrtf((float)GetWideRandom());
+	float r2 = (float)GetWideRandom();
+	const D3DXVECTOR3& a = m_positions[triangle.vertices[0]];
+	const D3DXVECTOR3& b = m_positions[triangle.vertices[1]];
+	const D3DXVECTOR3& c = m_positions[triangle.vertices[2]];
+	position = a * (1 - r1) + b * (r1 * (1 - r2)) + c * (r1 * r2);
+	normal   = triangle.normal;
+}
+
+EmissionMesh::EmissionMesh(IFile* file)
+{
+	Read(file);
+
+	// Calculate the triangles' areas and normals, and accumulate the vertex normals
+	vector<float> areas(m_triangles.size());
+	m_normals.resize(m_positions.size(), D3DXVECTOR3(0,0,0));
+	for (size_t i = 0; i < m_triangles.size(); i++)
+	{
+		Triangle& triangle = m_triangles[i];
+		D3DXVECTOR3 e1 = m_positions[triangle.vertices[1]] - m_positions[triangle.vertices[0]];
+		D3DXVECTOR3 e2 = m_positions[triangle.vertices[2]] - m_positions[triangle.vertices[0]];
+		D3DXVECTOR3 cross;
+		D3DXVec3Cross(&cross, &e1, &e2);
+
+		// The cross product's length is twice the area; weighting by it favors large faces
+		areas[i] = D3DXVec3Length(&cross) / 2;
+		D3DXVec3Normalize(&triangle.normal, &cross);
+		for (int j = 0; j < 3; j++)
+		{
+			m_normals[triangle.vertices[j]] += cross;
+		}
+	}
+
+	for (size_t i = 0; i < m_normals.size(); i++)
+	{
+		D3DXVec3Normalize(&m_normals[i], &m_normals[i]);
+	}
+
+	BuildAliasTable(areas);
+}
@@ -0,0 +1,43 @@
+#ifndef EMISSIONMESH_H
+#define EMISSIONMESH_H
+
+#include "types.h"
+#include "files.h"
+#include <vector>
+
+//
+// A triangle mesh that particles can be emitted from.
+// Loaded from a Wavefront OBJ file; only vertex positions and faces are used.
+//
+class EmissionMesh : public RefCounted
+{
+	struct Triangle
+	{
+		size_t      vertices[3];
+		D3DXVECTOR3 normal;
+	};
+
+	std::vector<D3DXVECTOR3> m_positions;
+	std::vector<D3DXVECTOR3> m_normals;		// Per vertex, area-weighted
+	std::vector<Triangle>    m_triangles;
+
+	// Alias table for picking a triangle by area (Vose's method)
+	std::vector<float>       m_probability;
+	std::vector<size_t>      m_alias;
+
+	void Read(IFile* file);
+	void BuildAliasTable(const std::vector<float>& areas);
+
+	~EmissionMesh() {}
+public:
+	size_t GetNumVertices() const { return m_positions.size(); }
+	void   GetVertex(size_t index, D3DXVECTOR3& position, D3DXVECTOR3& normal) const;
+
+	// Picks a random vertex, or a random point on the surface with uniform density
+	void   SampleVertex (D3DXVECTOR3& position, D3DXVECTOR3& normal) const;
+	void   SampleSurface(D3DXVECTOR3& position, D3DXVECTOR3& normal) const;
+
+	EmissionMesh(IFile* file);
+};
+
+#endif
@@ -1,8 +1,15 @@
+#include <algorithm>
 #include <cassert>
 #include "EmitterInstance.h"
 #include "ParticleSystemInstance.h"
+#include "EmissionMesh.h"
+#include "TextureAtlas.h"
+#include "../tools/common/DepthSort.h"
 using namespace std;
 
+static const float PI    = 3.1415926535897932384626433832795f;
+static const float SQRT2 = 1.4142135623730950488016887242097f;
+
 struct EmitterInstance::Particle : public Object3D
 {
 	struct TrackCursor
@@ -24,13 +31,19 @@ struct EmitterInstance::Particle : public Object3D
 	D3DXVECTOR3	m_acceleration;
 	D3DXVECTOR4	m_baseColor;
 	float		m_baseScale;
+	float		m_offset;		// Half the quad's size, as of the last update
+	float		m_fade;			// Weather fade-out, as of the last update
 	float       m_rotationDirection;
 	float       m_baseRotation;
-    TimeF       m_positionTime;
-    TimeF       m_bounceTime;
+    TimeF       m_bounceTime;	// Time of the first impact on the ground
+    TimeF       m_restTime;		// Time the bounces become negligible
+    float       m_bounceSpeed;	// Vertical speed after the first impact
 	TimeF		m_spawnTime;
 	TimeF		m_deathTime;
     EmitterInstance* m_childEmitter;
+    size_t      m_spawnCommand;	// Index of the pending CMD_SPAWN_ATTACHED, or NO_COMMAND
+
+	static const size_t NO_COMMAND = (size_t)-1;
 	
 	TrackCursor m_cursors[ParticleSystem::NUM_TRACKS];
 
@@ -41,7 +54,7 @@ struct EmitterInstance::Particle : public Object3D
 	void setPosition(const D3DXVECTOR3& position) { m_position = position; }
 	void setVelocity(const D3DXVECTOR3& velocity) { m_velocity = velocity; }
 
-    Particle() : Object3D(NULL), m_childEmitter(NULL)
+    Particle() : Object3D(NULL), m_childEmitter(NULL), m_spawnCommand(NO_COMMAND)
     {
     }
 
@@ -149,6 +162,7 @@ EmitterInstance::Particle& EmitterInstance::AllocateParticle()
         m_blocks.push_back(block);
 
         m_vertices     .resize (m_vertices     .size()     * 2);
+        m_billboards   .resize (m_billboards   .size()     * 2);
 	    m_primitives   .reserve(m_primitives   .capacity() * 2);
 	    m_particleIndex.reserve(m_particleIndex.capacity() * 2);
 
@@ -224,7 +238,6 @@ static void GenerateRandomProperty(const ParticleSystem::Emitter::Group& group,
 // Resets a particle's appearance and lifetime
 void EmitterInstance::ResetParticle(Particle& particle, TimeF currentTime)
 {
-    particle.m_positionTime = 0;
 	particle.m_spawnTime    = currentTime;
 	particle.m_deathTime    = particle.m_spawnTime + m_emitter.lifetime * GetRandom(1.0f - m_emitter.randomLifetimePerc, 1.0f);
 
@@ -254,8 +267,9 @@ void EmitterInstance::ResetParticle(Particle& particle, TimeF currentTime)
 	}
 }
 
-// Spawn a single particle
-void EmitterInstance::SpawnParticle(TimeF currentTime)
+// Spawn a single particle. For emitters that emit from every vertex
+// of the emission mesh, meshVertex is the vertex to emit from.
+void EmitterInstance::SpawnParticle(TimeF currentTime, size_t meshVertex)
 {
 	Particle& particle = AllocateParticle();
 	particle.m_verticesIndex = particle.m_index * NUM_VERTICES_PER_PARTICLE;
@@ -278,15 +292,28 @@ void EmitterInstance::SpawnParticle(TimeF currentTime)
         particle.m_initialPosition.z = GetRandom(-m_emitter.weatherCubeSize / 2, m_emitter.weatherCubeSize / 2);
 
         // Move to weather cube center
-        const Engine::Camera& camera = m_engine.GetCamera();
-        D3DXVECTOR3 looking = camera.Target - camera.Position;
-        D3DXVec3Normalize(&looking, &looking);
-        particle.m_initialPosition += camera.Position + looking * m_emitter.weatherCubeDistance;
+        particle.m_initialPosition += m_weatherCenter;
     }
     else
     {
         D3DXVECTOR3 normpos;
-	    GenerateRandomProperty(m_emitter.groups[ParticleSystem::GROUP_POSITION], particle.m_initialPosition);
+        const EmissionMesh* mesh = m_system.GetEmissionMesh();
+        if (mesh != NULL && m_emitter.emitFromMesh != ParticleSystem::EMIT_DISABLE)
+        {
+            // Emit from the mesh, offset along its normal
+            D3DXVECTOR3 normal;
+            switch (m_emitter.emitFromMesh)
+            {
+                case ParticleSystem::EMIT_RANDOM_MESH:  mesh->SampleSurface(particle.m_initialPosition, normal); break;
+                case ParticleSystem::EMIT_EVERY_VERTEX: mesh->GetVertex(meshVertex, particle.m_initialPosition, normal); break;
+                default:                                mesh->SampleVertex(particle.m_initialPosition, normal); break;
+            }
+            particle.m_initialPosition += normal * m_emitter.emitFromMeshOffset;
+        }
+        else
+        {
+	        GenerateRandomProperty(m_emitter.groups[ParticleSystem::GROUP_POSITION], particle.m_initialPosition);
+        }
 	    D3DXVec3Normalize(&normpos, &particle.m_initialPosition);
 
 	    particle.m_initialSpeed    -= normpos * m_emitter.inwardSpeed;
@@ -323,16 +350,24 @@ void EmitterInstance::SpawnParticle(TimeF currentTime)
             // Never bounces
             particle.m_bounceTime = FLT_MAX;
         }
+        InitializeBounces(particle);
     }
 
     particle.setPosition(particle.m_initialPosition);
+    particle.m_fade = 1.0f;
     ResetParticle(particle, currentTime);
 
-    // Spawn the child emitter
+    // Spawn the child emitter (after this update)
     particle.m_childEmitter = NULL;
     if (m_emitter.spawnDuringLife != -1)
     {
-        particle.m_childEmitter = m_system.SpawnEmitter(currentTime, m_emitter.spawnDuringLife, &particle);
+        Command cmd;
+        cmd.type     = Command::CMD_SPAWN_ATTACHED;
+        cmd.time     = currentTime;
+        cmd.emitter  = m_emitter.spawnDuringLife;
+        cmd.particle = &particle;
+        particle.m_spawnCommand = m_commands.size();
+        m_commands.push_back(cmd);
     }
 
 	// Create index
@@ -437,62 +472,135 @@ float EmitterInstance::SampleTrack(const Particle& particle, int track, float re
 	return 0.0f;
 }
 
-void EmitterInstance::UpdateParticle(Particle& particle, float t)
+// Sets up the bounces of a particle whose first impact on the ground is known.
+// Every flight after an impact is 'bounciness' times as long as the one before,
+// so the state at any time follows from a geometric series (see GetBounceState).
+void EmitterInstance::InitializeBounces(Particle& particle) const
+{
+	// Bounces below this vertical speed are too small to see
+	static const float MIN_BOUNCE_SPEED = 1.0f;
+
+	float a = particle.m_acceleration.z;
+	float b = m_emitter.bounciness;
+
+	particle.m_bounceSpeed = 0.0f;
+	particle.m_restTime    = FLT_MAX;
+	if (!(particle.m_bounceTime < FLT_MAX))
+	{
+		// Never bounces (or the impact time is undefined)
+		particle.m_bounceTime = FLT_MAX;
+		return;
+	}
+
+	particle.m_bounceSpeed = -(particle.m_initialSpeed.z + a * particle.m_bounceTime) * b;
+	if (particle.m_bounceSpeed <= 0.0f)
+	{
+		// Doesn't leave the ground again
+		particle.m_restTime = particle.m_bounceTime;
+	}
+	else if (a < 0.0f && b < 1.0f)
+	{
+		// Comes to rest after n more impacts, when the speed gets negligible
+		float flight = 2 * particle.m_bounceSpeed / -a;
+		float n      = (particle.m_bounceSpeed > MIN_BOUNCE_SPEED) ? ceilf(logf(MIN_BOUNCE_SPEED / particle.m_bounceSpeed) / logf(b)) : 0.0f;
+		particle.m_restTime = particle.m_bounceTime + flight * (1 - powf(b, n)) / (1 - b);
+	}
+}
+
+// Returns the height and vertical speed at time t of a particle that has hit the
+// ground. The first k flights after the first impact take f * (1 - b^k) / (1 - b)
+// seconds, where f is the first flight's duration and b the bounciness, so the
+// current flight is found directly rather than by stepping through the bounces.
+void EmitterInstance::GetBounceState(const Particle& particle, float t, float& z, float& vz) const
 {
-	static const float PI = 3.1415926535897932384626433832795f;
+	if (t >= particle.m_restTime)
+	{
+		z  = 0.0f;
+		vz = 0.0f;
+		return;
+	}
+
+	float a = particle.m_acceleration.z;
+	float b = m_emitter.bounciness;
+	float u = particle.m_bounceSpeed;
+	float s = t - particle.m_bounceTime;
+	if (a < 0.0f)
+	{
+		// It comes down again; find the flight we're in
+		float flight = 2 * u / -a;
+		if (b == 1.0f)
+		{
+			s -= flight * floorf(s / flight);
+		}
+		else
+		{
+			float k = floorf(logf(1 - s * (1 - b) / flight) / logf(b));
+			s -= flight * (1 - powf(b, k)) / (1 - b);
+			u *= powf(b, k);
+		}
 
+		// Guard against rounding at the flights' ends
+		s = min(max(s, 0.0f), 2 * u / -a);
+	}
+
+	z  = (u + 0.5f * a * s) * s;
+	vz = u + a * s;
+}
+
+// Advances a particle's simulation state to time t (relative to its spawn time)
+void EmitterInstance::UpdateParticle(Particle& particle, float t)
+{
 	// Convert to percentage time
 	float relTime = t * 100 / (particle.m_deathTime - particle.m_spawnTime);
 
 	UpdateTrackCursors(particle, relTime);
 
-    if (m_emitter.groundBehavior == ParticleSystem::GROUND_BOUNCE)
-    {
-        while (t > particle.m_bounceTime)
-        {
-            // The particle has bounced
-            float bt = particle.m_bounceTime - particle.m_positionTime;
-            particle.m_initialPosition =  particle.m_initialPosition + (particle.m_initialSpeed + 0.5 * particle.m_acceleration * bt) * bt;
-            particle.m_initialSpeed    =  particle.m_initialSpeed + particle.m_acceleration * bt;
-            particle.m_initialSpeed.z  = -particle.m_initialSpeed.z * m_emitter.bounciness;
-            particle.m_positionTime    =  particle.m_bounceTime;
-
-            // Calculate new bounce time
-            if (particle.m_acceleration.z == 0 || particle.m_initialSpeed.z == 0)
-            {
-                // No more bounces
-                particle.m_bounceTime = FLT_MAX;
-            }
-            else
-            {
-                // Calculate the new parabola
-                // We know x(0) is 0, so the problem becomes a lot simpler
-                particle.m_bounceTime += 2 * -particle.m_initialSpeed.z / particle.m_acceleration.z;
-            }
-        }
-    }
-
-	float offset = particle.m_baseScale * SampleTrack(particle, ParticleSystem::TRACK_SCALE, relTime) / 2;
+	float offset = particle.m_baseScale * m_lodSizeScale * SampleTrack(particle, ParticleSystem::TRACK_SCALE, relTime) / 2;
 
-    // Calculate position with constant acceleration:
+    // Calculate position and velocity with constant acceleration:
 	// x(t) = x(0) + v(0) * t + 0.5 * a * t * t
-    float pt = t - particle.m_positionTime;
-	D3DXVECTOR3 position = particle.m_initialPosition + (particle.m_initialSpeed + 0.5 * particle.m_acceleration * pt) * pt;
+	// v(t) = v(0) + a * t
+	D3DXVECTOR3 position = particle.m_initialPosition + (particle.m_initialSpeed + 0.5 * particle.m_acceleration * t) * t;
+    D3DXVECTOR3 velocity = particle.m_initialSpeed + particle.m_acceleration * t;
+    if (m_emitter.groundBehavior == ParticleSystem::GROUND_BOUNCE && t > particle.m_bounceTime)
+    {
+        // Bouncing only affects the vertical motion
+        GetBounceState(particle, t, position.z, velocity.z);
+    }
     position += (m_system.GetPosition() - particle.m_systemSpawnPosition) * (m_emitter.linkToSystem ? 1.0f : 0.0f);
 	position += (GetPosition()          - particle.m_parentSpawnPosition) * m_emitter.parentLinkStrength;
 
     if (m_emitter.isWeatherParticle)
     {
         // Move to weather cube center, modulo box size.
-        const Engine::Camera& camera = m_engine.GetCamera();
-        D3DXVECTOR3 looking = camera.Target - camera.Position;
-        D3DXVec3Normalize(&looking, &looking);
-        D3DXVECTOR3 center = camera.Position + looking * m_emitter.weatherCubeDistance;
-        
-        float w = m_emitter.weatherCubeSize;
-        position.x = fmodf(fmodf(position.x - center.x + w/2, w) + w, w) - w/2 + center.x;
-        position.y = fmodf(fmodf(position.y - center.y + w/2, w) + w, w) - w/2 + center.y;
-        position.z = fmodf(fmodf(position.z - center.z + w/2, w) + w, w) - w/2 + center.z;
+        // x - w * floor(x / w) wraps into [0, w) for negative x as well.
+        const D3DXVECTOR3& corner = m_weatherCorner;
+        float w    = m_emitter.weatherCubeSize;
+        float invW = 1.0f / w;
+        position -= corner;
+        position.x -= w * floorf(position.x * invW);
+        position.y -= w * floorf(position.y * invW);
+        position.z -= w * floorf(position.z * invW);
+        position += corner;
+
+        // Fade out beyond the fade-out distance, so that particles are gone
+        // before they reach the cube's far faces and wrap around
+        D3DXVECTOR3 delta = position - m_engine.GetCamera().Position;
+        float fadeStart = m_emitter.weatherFadeoutDistance;
+        float fadeEnd   = m_emitter.weatherCubeDistance + w/2;
+        float distSq    = D3DXVec3LengthSq(&delta);
+        if (distSq <= fadeStart * fadeStart)
+        {
+            particle.m_fade = 1.0f;
+        }
+        else if (fadeEnd <= fadeStart)
+        {
+            particle.m_fade = 0.0f;
+        }
+        else
+        {
+            particle.m_fade = max(0.0f, (fadeEnd - sqrtf(distSq)) / (fadeEnd - fadeStart));
+        }
     }
     else switch (m_emitter.groundBehavior)
     {
@@ -507,31 +615,50 @@ void EmitterInstance::UpdateParticle(Particle& particle, float t)
         default: break;
     }
 	particle.setPosition(position);
+	particle.m_offset = offset;
 
-	float rotation = particle.m_baseRotation;
-	if (!m_emitter.randomRotation)
+    if (m_emitter.parentLinkStrength != 0.0f)
+    {
+        velocity += GetVelocity() * m_emitter.parentLinkStrength;
+    }
+    particle.setVelocity(velocity);
+
+	// The quad's corners are at most this far from its center. The tail
+	// stretches one corner by at most the world-space tail length.
+	float extent = fabsf(offset) * SQRT2;
+	if (m_emitter.hasTail)
 	{
-		rotation += IntegrateTrack(particle, ParticleSystem::TRACK_ROTATION_SPEED, relTime);
+		float length = D3DXVec3Length(&velocity);
+		float mult   = (m_emitter.parentLinkStrength != 0.0f) ? length / 1000.0f : 1.0f;
+		extent *= max(1.0f, m_emitter.tailSize * mult / SQRT2);
 	}
-	float angle = 2 * PI * rotation * particle.m_rotationDirection;
+	D3DXVECTOR3 minCorner = position - D3DXVECTOR3(extent, extent, extent);
+	D3DXVECTOR3 maxCorner = position + D3DXVECTOR3(extent, extent, extent);
+	D3DXVec3Minimize(&m_boundsMin, &m_boundsMin, &minCorner);
+	D3DXVec3Maximize(&m_boundsMax, &m_boundsMax, &maxCorner);
+
+	if (!m_culled)
+	{
+		OutputParticle(particle, relTime);
+	}
+}
+
+// Builds a particle's quad from its simulation state
+// Turns a particle's quad towards a camera and moves it into place. Returns the
+// quad's rotation, which includes the direction of its tail.
+float EmitterInstance::ExpandBillboard(const Billboard& billboard, const D3DXMATRIX& viewRotation, const D3DXMATRIX& billboardMatrix, Vertex* verts) const
+{
+	const float offset = billboard.offset;
+	float       angle  = billboard.angle;
 
-	Vertex* verts = &m_vertices[particle.m_verticesIndex];
 	verts[0].Position = D3DXVECTOR3(-offset,-offset,0);
 	verts[1].Position = D3DXVECTOR3( offset,-offset,0);
 	verts[2].Position = D3DXVECTOR3( offset, offset,0);
 	verts[3].Position = D3DXVECTOR3(-offset, offset,0);
-    
-	// Calculate velocity with constant acceleration:
-	// v(t) = v(0) + a * t
-    D3DXVECTOR3 velocity = particle.m_initialSpeed + particle.m_acceleration * t;
-    if (m_emitter.parentLinkStrength != 0.0f)
-    {
-        velocity += GetVelocity() * m_emitter.parentLinkStrength;
-    }
-    particle.setVelocity(velocity);
 
 	if (m_emitter.hasTail)
 	{
+		D3DXVECTOR3 velocity = billboard.velocity;
 		float length = D3DXVec3Length(&velocity);
 
         if (length > 0)
@@ -541,7 +668,7 @@ void EmitterInstance::UpdateParticle(Particle& particle, float t)
             if (!m_emitter.isWorldOriented)
             {
     		    // Transform world-velocity into screen-velocity
-		        D3DXVec3TransformCoord(&velocity, &velocity, &m_engine.GetViewRotationMatrix());
+		        D3DXVec3TransformCoord(&velocity, &velocity, &viewRotation);
             }
 		    angle += atan2f(velocity.y, velocity.x) + PI / 4;
 		    velocity.z = 0.0f;
@@ -555,7 +682,7 @@ void EmitterInstance::UpdateParticle(Particle& particle, float t)
     if (!m_emitter.isWorldOriented)
 	{
 	    // Rotate towards camera
-		D3DXVec3TransformCoord(&verts[0].Normal, &verts[0].Normal, &m_engine.GetBillboardMatrix());
+		D3DXVec3TransformCoord(&verts[0].Normal, &verts[0].Normal, &billboardMatrix);
     }
     verts[3].Normal = verts[2].Normal = verts[1].Normal = verts[0].Normal;
 
@@ -569,23 +696,48 @@ void EmitterInstance::UpdateParticle(Particle& particle, float t)
 		if (!m_emitter.isWorldOriented)
 		{
 			// Rotate towards camera
-			D3DXVec3TransformCoord(&verts[i].Position, &verts[i].Position, &m_engine.GetBillboardMatrix());
-            D3DXVec3TransformCoord(&verts[i].Normal,   &verts[i].Normal,   &m_engine.GetBillboardMatrix());
+			D3DXVec3TransformCoord(&verts[i].Position, &verts[i].Position, &billboardMatrix);
+            D3DXVec3TransformCoord(&verts[i].Normal,   &verts[i].Normal,   &billboardMatrix);
 		}
 
     	    // Move into position
-        verts[i].Position += position;
+        verts[i].Position += billboard.position;
     }
+	return angle;
+}
+
+void EmitterInstance::OutputParticle(const Particle& particle, float relTime)
+{
+	float rotation = particle.m_baseRotation;
+	if (!m_emitter.randomRotation)
+	{
+		rotation += IntegrateTrack(particle, ParticleSystem::TRACK_ROTATION_SPEED, relTime);
+	}
+
+	Billboard& billboard = m_billboards[particle.m_verticesIndex / NUM_VERTICES_PER_PARTICLE];
+	billboard.position = particle.GetRelativePosition();
+	billboard.velocity = particle.GetRelativeVelocity();
+	billboard.offset   = particle.m_offset;
+	billboard.angle    = 2 * PI * rotation * particle.m_rotationDirection;
+
+	Vertex* verts = &m_vertices[particle.m_verticesIndex];
+	float   angle = ExpandBillboard(billboard, m_engine.GetViewRotationMatrix(), m_engine.GetBillboardMatrix(), verts);
 
 	// Texture coordinates
 	unsigned int texIndex = (unsigned int)floor(SampleTrack(particle, ParticleSystem::TRACK_INDEX, relTime));
     float d = 1.0f / m_textureSizeSqrt;
 	float u = (float)(texIndex % m_textureSizeSqrt) / m_textureSizeSqrt;
 	float v = (float)(texIndex / m_textureSizeSqrt) / m_textureSizeSqrt;
-	verts[3].TexCoord1 = verts[3].TexCoord0 = D3DXVECTOR2(u    , v    );
-	verts[2].TexCoord1 = verts[2].TexCoord0 = D3DXVECTOR2(u + d, v    );
-	verts[1].TexCoord1 = verts[1].TexCoord0 = D3DXVECTOR2(u + d, v + d);
-	verts[0].TexCoord1 = verts[0].TexCoord0 = D3DXVECTOR2(u,     v + d);
+	verts[3].TexCoord1 = D3DXVECTOR2(u    , v    );
+	verts[2].TexCoord1 = D3DXVECTOR2(u + d, v    );
+	verts[1].TexCoord1 = D3DXVECTOR2(u + d, v + d);
+	verts[0].TexCoord1 = D3DXVECTOR2(u,     v + d);
+	for (int i = 0; i < 4; i++)
+	{
+		// The color texture may be part of an atlas; the normal texture isn't
+		verts[i].TexCoord0.x = m_textureRect.x + verts[i].TexCoord1.x * m_textureRect.z;
+		verts[i].TexCoord0.y = m_textureRect.y + verts[i].TexCoord1.y * m_textureRect.w;
+	}
 
 	// Color
     D3DXVECTOR4 color = particle.m_baseColor;
@@ -604,27 +756,92 @@ void EmitterInstance::UpdateParticle(Particle& particle, float t)
     	color.z += SampleTrack(particle, ParticleSystem::TRACK_BLUE_CHANNEL,  relTime);
     }
 	color.w += SampleTrack(particle, ParticleSystem::TRACK_ALPHA_CHANNEL, relTime);
+	if (particle.m_fade < 1.0f)
+	{
+		color.w *= particle.m_fade;
+		if (m_emitter.blendMode == ParticleSystem::BLEND_INVERSE || m_emitter.blendMode == ParticleSystem::BLEND_DEPTH_INVERSE)
+		{
+			// Modulating; the color multiplies the frame, so fade towards white
+			color.x = 1.0f + (color.x - 1.0f) * particle.m_fade;
+			color.y = 1.0f + (color.y - 1.0f) * particle.m_fade;
+			color.z = 1.0f + (color.z - 1.0f) * particle.m_fade;
+		}
+		else if (m_alphaSrcBlend == D3DBLEND_ONE && m_alphaDestBlend == D3DBLEND_ONE)
+		{
+			// Additive; alpha doesn't weigh the color
+			color.x *= particle.m_fade;
+			color.y *= particle.m_fade;
+			color.z *= particle.m_fade;
+		}
+	}
 	verts[3].Color = verts[2].Color = verts[1].Color = verts[0].Color = D3DCOLOR_COLORVALUE(color.x, color.y, color.z, color.w);
 }
 
+// Orders the primitives back to front by the particles' view depth, for
+// transparent emitters. The particles and primitives stay where they are;
+// the order is written to m_sortOrder and applied when the output is
+// published. Primitives use 16-bit vertex indices, so there are few enough
+// for SortBackToFront.
+void EmitterInstance::SortParticles()
+{
+	const Engine::Camera& camera = m_engine.GetCamera();
+	D3DXVECTOR3 forward = camera.Target - camera.Position;
+	D3DXVec3Normalize(&forward, &forward);
+
+	size_t n = m_primitives.size();
+	m_sortDepths.resize(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		m_sortDepths[i] = D3DXVec3Dot(&m_particleIndex[i]->GetRelativePosition(), &forward);
+	}
+	SortBackToFront(m_sortDepths, m_sortOrder, m_sortKeys, m_sortScratch);
+}
+
+// Builds the quads of all particles, for an emitter that skipped
+// them in its last update because it was culled
+void EmitterInstance::OutputParticles()
+{
+	for (Particle* particle = m_particleList; particle != NULL; particle = particle->m_next)
+	{
+		float t = (float)(m_updateTime - particle->m_spawnTime);
+		OutputParticle(*particle, t * 100 / (particle->m_deathTime - particle->m_spawnTime));
+	}
+}
+
 // Kill a particle
 int EmitterInstance::KillParticle(TimeF currentTime, Particle& particle)
 {
     if (particle.m_childEmitter != NULL)
     {
         // Detach and stop child emitter
-        particle.m_childEmitter->Detach();
-        particle.m_childEmitter->StopSpawning();
+        Command cmd;
+        cmd.type  = Command::CMD_DETACH;
+        cmd.time  = currentTime;
+        cmd.child = particle.m_childEmitter;
+        m_commands.push_back(cmd);
         particle.m_childEmitter = NULL;
     }
+    else if (particle.m_spawnCommand != Particle::NO_COMMAND)
+    {
+        // The child emitter hasn't been created yet; create it detached instead
+        Command& cmd = m_commands[particle.m_spawnCommand];
+        cmd.type     = Command::CMD_SPAWN_DETACHED;
+        cmd.position = particle.GetPosition();
+        cmd.particle = NULL;
+        particle.m_spawnCommand = Particle::NO_COMMAND;
+    }
 
     int numParticles = 0;
     if (m_emitter.spawnOnDeath != -1)
     {
         // Spawn child emitter
-        EmitterInstance* emitter = m_system.SpawnEmitter(currentTime, m_emitter.spawnOnDeath, &particle);
-        emitter->Detach();
-        emitter->StopSpawning();
+        Command cmd;
+        cmd.type     = Command::CMD_SPAWN_DETACHED;
+        cmd.time     = currentTime;
+        cmd.emitter  = m_emitter.spawnOnDeath;
+        cmd.particle = NULL;
+        cmd.position = particle.GetPosition();
+        m_commands.push_back(cmd);
     }
 
 	FreeParticle(particle);
@@ -638,15 +855,28 @@ void EmitterInstance::onParticleSystemChanged(const Engine& engine, int track)
 		// Recalculate composite values
         m_nParticlesPerBurst = (!m_emitter.useBursts) ? 1 : m_emitter.nParticlesPerBurst;
 		m_spawnDelay         = (!m_emitter.useBursts) ? 1.0f / m_emitter.nParticlesPerSecond : max(0.01f, m_emitter.burstDelay);   // Ensure burst delay isn't 0
-		m_acceleration       = D3DXVECTOR3(m_emitter.acceleration) + m_emitter.gravity * engine.GetGravity();
+		m_gravity            = m_emitter.gravity * engine.GetGravity();
+		m_acceleration       = D3DXVECTOR3(m_emitter.acceleration) + m_gravity;
 		m_textureSizeSqrt    = (int)floor(sqrtf((float)max(1, m_emitter.textureSize)));
 
 		// Reload resources
 		SAFE_RELEASE(m_pColorTexture);
 		SAFE_RELEASE(m_pNormalTexture);
-		m_pColorTexture  = engine.GetTexture(m_emitter.colorTexture);
 		m_pNormalTexture = engine.GetTexture(m_emitter.normalTexture);
 
+		// Use the color texture's atlas, if it was packed in one
+		string atlas;
+		const TextureAtlas* atlases = engine.GetTextureAtlas();
+		if (atlases != NULL && atlases->Find(m_emitter.colorTexture, atlas, m_textureRect))
+		{
+			m_pColorTexture = engine.GetTexture(atlas);
+		}
+		else
+		{
+			m_pColorTexture = engine.GetTexture(m_emitter.colorTexture);
+			m_textureRect   = D3DXVECTOR4(0, 0, 1, 1);
+		}
+
         // Default texture stage settings:
         // ColorOp[0]   = Modulate;
         // ColorArg1[0] = Texture;
@@ -745,6 +975,11 @@ int EmitterInstance::Update(TimeF currentTime)
 		currentTime = m_freezeTime;
 	}
 
+    if (m_emitter.objectSpaceAcceleration)
+    {
+        UpdateAcceleration();
+    }
+
     if (!m_emitter.isWeatherParticle)
     {
         // Spawn new particles
@@ -754,8 +989,15 @@ int EmitterInstance::Update(TimeF currentTime)
         }
     }
 
-	// We make this static so we don't reallocate every single frame
-	static set<size_t> kills;
+	m_updateTime = currentTime;
+	if (m_emitter.isWeatherParticle)
+	{
+		UpdateWeatherCube();
+	}
+
+	// The particles' updates grow the bounds again
+	m_boundsMin = D3DXVECTOR3( FLT_MAX,  FLT_MAX,  FLT_MAX);
+	m_boundsMax = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 
 	for (Particle* particle = m_particleList; particle != NULL; particle = particle->m_next)
 	{
@@ -766,7 +1008,7 @@ int EmitterInstance::Update(TimeF currentTime)
             {
                 // Remove it (m_next remains intact)
 			    numParticles += KillParticle(currentTime, *particle);
-			    kills.insert(particle->m_indicesIndex);
+			    m_kills.push_back(particle->m_indicesIndex);
 			    continue;
             }
 
@@ -778,16 +1020,17 @@ int EmitterInstance::Update(TimeF currentTime)
 		UpdateParticle(*particle, t);
 	}
 
-	if (!kills.empty())
+	if (!m_kills.empty())
 	{
-        size_t firstKilled = *kills.begin();
-		for (set<size_t>::reverse_iterator i = kills.rbegin(); i != kills.rend(); i++)
+		sort(m_kills.begin(), m_kills.end());
+        size_t firstKilled = m_kills.front();
+		for (vector<size_t>::reverse_iterator i = m_kills.rbegin(); i != m_kills.rend(); i++)
 		{
 			m_primitives   .erase(m_primitives   .begin() + *i);
 			m_particleIndex.erase(m_particleIndex.begin() + *i);
             numParticles--;
 		}
-		kills.clear();
+		m_kills.clear();
 
 		if (!m_primitives.empty())
 		{
@@ -798,54 +1041,339 @@ int EmitterInstance::Update(TimeF currentTime)
 			}
 		}
 	}
+
+	if (m_emitter.sortParticles && !m_culled)
+	{
+		SortParticles();
+	}
     return numParticles;
 }
 
+// Executes the commands recorded during the last update, in recording order
+void EmitterInstance::ExecuteCommands()
+{
+	for (size_t i = 0; i < m_commands.size(); i++)
+	{
+		const Command& cmd = m_commands[i];
+		switch (cmd.type)
+		{
+			case Command::CMD_SPAWN_ATTACHED:
+				cmd.particle->m_spawnCommand = Particle::NO_COMMAND;
+				cmd.particle->m_childEmitter = m_system.SpawnEmitter(cmd.time, cmd.emitter, cmd.particle);
+				break;
+
+			case Command::CMD_SPAWN_DETACHED:
+			{
+				// The emitter only uses its parent while it's being created
+				Object3D origin(NULL, cmd.position);
+				EmitterInstance* emitter = m_system.SpawnEmitter(cmd.time, cmd.emitter, &origin);
+				emitter->Detach();
+				emitter->StopSpawning();
+				break;
+			}
+
+			case Command::CMD_DETACH:
+				cmd.child->Detach();
+				cmd.child->StopSpawning();
+				break;
+		}
+	}
+	m_commands.clear();
+}
+
+// Hands the output of the last update to Render. The vertex buffers are swapped
+// rather than copied; the next update rewrites the vertices of all live particles.
+void EmitterInstance::PublishOutput()
+{
+	m_renderPosition = GetPosition();
+	if (m_culled)
+	{
+		// Nothing to render
+		m_renderPrimitives.clear();
+		return;
+	}
+
+	if (!m_hasOutput)
+	{
+		// Just became visible
+		OutputParticles();
+		if (m_emitter.sortParticles)
+		{
+			SortParticles();
+		}
+	}
+	m_hasOutput = true;
+
+	m_renderVertices.swap(m_vertices);
+	m_renderBillboards.swap(m_billboards);
+	if (m_vertices.size() < m_renderVertices.size())
+	{
+		m_vertices.resize(m_renderVertices.size());
+		m_billboards.resize(m_renderBillboards.size());
+	}
+	bool sorted = m_emitter.sortParticles && m_sortOrder.size() == m_primitives.size();
+	if (!sorted && !m_emitter.isWeatherParticle)
+	{
+		m_renderPrimitives = m_primitives;
+	}
+	else
+	{
+		// Reorder, and leave out faded-out weather particles
+		m_renderPrimitives.clear();
+		for (size_t j = 0; j < m_primitives.size(); j++)
+		{
+			size_t i = (sorted) ? m_sortOrder[j] : j;
+			if (!m_emitter.isWeatherParticle || m_particleIndex[i]->m_fade > 0.0f)
+			{
+				m_renderPrimitives.push_back(m_primitives[i]);
+			}
+		}
+	}
+}
+
+// Culled emitters (off-screen or hidden) only simulate their particles in the next
+// update, and don't render; the quads are built again when they're no longer culled.
+void EmitterInstance::SetCulled(bool culled)
+{
+	m_culled = culled;
+	if (culled)
+	{
+		m_hasOutput = false;
+	}
+}
+
+// Rotates the object-space acceleration with the system. Done once per update;
+// particles keep the acceleration they were spawned with.
+void EmitterInstance::UpdateAcceleration()
+{
+    D3DXVECTOR3 acceleration(m_emitter.acceleration);
+    D3DXVec3TransformNormal(&m_acceleration, &acceleration, &m_system.GetOrientation());
+    m_acceleration += m_gravity;
+}
+
+// Places the weather cube in front of the camera; done once per update rather than per particle
+void EmitterInstance::UpdateWeatherCube()
+{
+    const Engine::Camera& camera = m_engine.GetCamera();
+    D3DXVECTOR3 looking = camera.Target - camera.Position;
+    D3DXVec3Normalize(&looking, &looking);
+    m_weatherCenter = camera.Position + looking * m_emitter.weatherCubeDistance;
+
+    float w = m_emitter.weatherCubeSize;
+    m_weatherCorner = m_weatherCenter - D3DXVECTOR3(w/2, w/2, w/2);
+}
+
+// Returns the bounding box of the particles, or false if there are none
+bool EmitterInstance::GetBounds(D3DXVECTOR3& min, D3DXVECTOR3& max) const
+{
+	if (m_boundsMin.x > m_boundsMax.x)
+	{
+		return false;
+	}
+	min = m_boundsMin;
+	max = m_boundsMax;
+	return true;
+}
+
+// Returns a sphere around the bounding box, or false if there are no particles
+bool EmitterInstance::GetBoundingSphere(D3DXVECTOR3& center, float& radius) const
+{
+	if (m_boundsMin.x > m_boundsMax.x)
+	{
+		return false;
+	}
+	D3DXVECTOR3 diagonal = m_boundsMax - m_boundsMin;
+	center = (m_boundsMin + m_boundsMax) / 2;
+	radius = D3DXVec3Length(&diagonal) / 2;
+	return true;
+}
+
 void EmitterInstance::StopSpawning()
 {
     m_doneSpawning = true;
 }
 
-void EmitterInstance::Render(IDirect3DDevice9* pDevice)
+void EmitterInstance::Submit(RenderQueue& queue, float depth)
 {
-    if (!m_primitives.empty() && m_emitter.visible)
+    if (!m_renderPrimitives.empty() && m_emitter.visible)
 	{
-		pDevice->SetTexture(0, m_pColorTexture);
-		pDevice->SetTexture(1, m_pNormalTexture);
-		pDevice->SetRenderState(D3DRS_ZENABLE,     !m_emitter.noDepthTest);
-		if (IsHeatEmitter())
+		RenderQueue::Pass pass = IsHeatEmitter() ? RenderQueue::PASS_HEAT : RenderQueue::PASS_NORMAL;
+		queue.Submit(queue.MakeKey(pass, m_emitter.blendMode, !m_emitter.noDepthTest, m_pColorTexture, m_pNormalTexture, depth), this);
+	}
+}
+
+vector<EmitterInstance::Vertex>    EmitterInstance::m_batchVertices;
+vector<EmitterInstance::Primitive> EmitterInstance::m_batchPrimitives;
+vector<EmitterInstance::Vertex>    EmitterInstance::m_viewVertices;
+vector<EmitterInstance::Primitive> EmitterInstance::m_viewPrimitives;
+
+// Can this emitter be drawn in the same call as 'other'?
+bool EmitterInstance::CanBatchWith(const EmitterInstance& other) const
+{
+	if (m_emitter.blendMode   != other.m_emitter.blendMode   ||
+		m_emitter.noDepthTest != other.m_emitter.noDepthTest ||
+		m_pColorTexture       != other.m_pColorTexture       ||
+		m_pNormalTexture      != other.m_pNormalTexture      ||
+		IsHeatEmitter()       != other.IsHeatEmitter())
+	{
+		return false;
+	}
+
+	// The shader gets the eye position relative to the emitter; if it uses it,
+	// only emitters at the same position can share it
+	return IsHeatEmitter() || m_engine.GetShader(m_emitter.blendMode)->getHandles().hEyeObjPosition == NULL
+		|| m_renderPosition == other.m_renderPosition;
+}
+
+// Draws quads with this emitter's textures, blending and shader
+void EmitterInstance::Draw(IRenderDevice* device, const vector<Vertex>& vertices, const vector<Primitive>& primitives) const
+{
+	device->SetTexture(0, ToRenderTexture(m_pColorTexture));
+	device->SetTexture(1, ToRenderTexture(m_pNormalTexture));
+	device->SetState(IRenderDevice::STATE_DEPTH_TEST, !m_emitter.noDepthTest);
+	if (IsHeatEmitter())
+	{
+		device->SetState(IRenderDevice::STATE_BLEND,      TRUE);
+		device->SetState(IRenderDevice::STATE_SRC_BLEND,  IRenderDevice::BLEND_SRC_ALPHA);
+		device->SetState(IRenderDevice::STATE_DEST_BLEND, IRenderDevice::BLEND_INV_SRC_ALPHA);
+		device->DrawIndexedPrimitiveUP(IRenderDevice::TRIANGLE_LIST, (UINT)vertices.size(), 2 * (UINT)primitives.size(), primitives[0].index, &vertices[0], sizeof(Vertex));
+	}
+	else
+	{
+        const D3DXVECTOR3& position = m_renderPosition;
+        const D3DXVECTOR3& eye      = m_engine.GetRenderView().camera.Position;
+        D3DXVECTOR4 eyeObjPosition(
+            eye.x - position.x,
+            eye.y - position.y,
+            eye.z - position.z, 
+            0);
+        
+        Effect* pShader = m_engine.GetShader(m_emitter.blendMode);
+        const Effect::Handles& handles = pShader->getHandles();
+        device->SetVector(pShader, handles.hEyeObjPosition, eyeObjPosition);
+
+        UINT nPasses = device->BeginEffect(pShader);
+        for (UINT i = 0; i < nPasses; i++)
+        {
+            device->BeginPass(pShader, i);
+		    device->DrawIndexedPrimitiveUP(IRenderDevice::TRIANGLE_LIST, (UINT)vertices.size(), 2 * (UINT)primitives.size(), primitives[0].index, &vertices[0], sizeof(Vertex));
+            device->EndPass(pShader);
+        }
+        device->EndEffect(pShader);
+	}
+}
+
+// The published quads, as the view being rendered sees them. The main view
+// draws them as they are. For another view they're turned towards its camera,
+// and sorted again, into m_viewVertices and m_viewPrimitives; only the quads
+// of live particles are kept.
+void EmitterInstance::GetRenderOutput(const vector<Vertex>*& vertices, const vector<Primitive>*& primitives) const
+{
+	vertices   = &m_renderVertices;
+	primitives = &m_renderPrimitives;
+	if (m_engine.IsMainView() || (m_emitter.isWorldOriented && !m_emitter.sortParticles))
+	{
+		return;
+	}
+
+	// Work space for sorting, only used while rendering
+	static vector<float>    depths;
+	static vector<uint32_t> order, keys, scratch;
+
+	const Engine::View& view = m_engine.GetRenderView();
+	const size_t n = m_renderPrimitives.size();
+	if (m_emitter.sortParticles)
+	{
+		D3DXVECTOR3 forward = view.camera.Target - view.camera.Position;
+		D3DXVec3Normalize(&forward, &forward);
+		depths.resize(n);
+		for (size_t i = 0; i < n; i++)
 		{
-			pDevice->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
-			pDevice->SetRenderState(D3DRS_SRCBLEND,  D3DBLEND_SRCALPHA);
-			pDevice->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
-    		pDevice->DrawIndexedPrimitiveUP(D3DPT_TRIANGLELIST, 0, (UINT)m_vertices.size(), 2 * (UINT)m_primitives.size(), &m_primitives[0], D3DFMT_INDEX16, &m_vertices[0], sizeof(Vertex));
+			const Billboard& billboard = m_renderBillboards[m_renderPrimitives[i].index[0] / NUM_VERTICES_PER_PARTICLE];
+			depths[i] = D3DXVec3Dot(&billboard.position, &forward);
 		}
-		else
+		SortBackToFront(depths, order, keys, scratch);
+	}
+
+	m_viewVertices.resize(n * NUM_VERTICES_PER_PARTICLE);
+	m_viewPrimitives.resize(n);
+	const bool bump = (m_emitter.blendMode == ParticleSystem::BLEND_BUMP || m_emitter.blendMode == ParticleSystem::BLEND_DECAL_BUMP);
+	for (size_t j = 0; j < n; j++)
+	{
+		// The first index is the particle's first vertex
+		const Primitive& src   = m_renderPrimitives[(m_emitter.sortParticles) ? order[j] : j];
+		const uint16_t   first = src.index[0];
+		const uint16_t   base  = (uint16_t)(j * NUM_VERTICES_PER_PARTICLE);
+		Vertex*          verts = &m_viewVertices[base];
+		copy(&m_renderVertices[first], &m_renderVertices[first] + NUM_VERTICES_PER_PARTICLE, verts);
+
+		// Colors and texture coordinates stay; bump tangents follow the tail
+		float angle = ExpandBillboard(m_renderBillboards[first / NUM_VERTICES_PER_PARTICLE], view.viewRotation, view.billboard, verts);
+		if (bump && m_emitter.hasTail)
 		{
-            D3DXVECTOR3 position = GetPosition();
-            D3DXVECTOR4 eyeObjPosition(
-                m_engine.GetCamera().Position.x - position.x,
-                m_engine.GetCamera().Position.y - position.y,
-                m_engine.GetCamera().Position.z - position.z, 
-                0);
-            
-            Effect* pShader = m_engine.GetShader(m_emitter.blendMode);
-            const Effect::Handles& handles = pShader->getHandles();
-            ID3DXEffect* pEffect = pShader->getD3DEffect();
-            pEffect->SetVector(handles.hEyeObjPosition, &eyeObjPosition);
-
-            UINT nPasses;
-            pEffect->Begin(&nPasses, 0);
-            for (UINT i = 0; i < nPasses; i++)
-            {
-                pEffect->BeginPass(i);
-    		    pDevice->DrawIndexedPrimitiveUP(D3DPT_TRIANGLELIST, 0, (UINT)m_vertices.size(), 2 * (UINT)m_primitives.size(), &m_primitives[0], D3DFMT_INDEX16, &m_vertices[0], sizeof(Vertex));
-                pEffect->EndPass();
-            }
-            pEffect->End();
-            SAFE_RELEASE(pEffect);
+			D3DCOLOR tangent = D3DCOLOR_COLORVALUE(0.5f * cosf(angle) + 0.5f, 0.5f * sinf(angle) + 0.5f, 0, 0);
+			for (int k = 0; k < NUM_VERTICES_PER_PARTICLE; k++)
+			{
+				verts[k].Color = (verts[k].Color & 0xFF000000) | (tangent & 0x00FFFFFF);
+			}
+		}
+
+		for (int k = 0; k < 3 * NUM_TRIANGLES_PER_PARTICLE; k++)
+		{
+			m_viewPrimitives[j].index[k] = src.index[k] - first + base;
+		}
+	}
+	vertices   = &m_viewVertices;
+	primitives = &m_viewPrimitives;
+}
+
+void EmitterInstance::Render(IRenderDevice* device)
+{
+    if (!m_renderPrimitives.empty() && m_emitter.visible)
+	{
+		const vector<Vertex>*    vertices;
+		const vector<Primitive>* primitives;
+		GetRenderOutput(vertices, primitives);
+		Draw(device, *vertices, *primitives);
+	}
+}
+
+// Draws emitters that can be batched with each other in one call. Their quads
+// are copied into one stream, leaving out the vertices of unused particle slots.
+void EmitterInstance::RenderBatch(IRenderDevice* device, const vector<EmitterInstance*>& batch)
+{
+	if (batch.size() == 1)
+	{
+		batch[0]->Render(device);
+		return;
+	}
+
+	m_batchVertices.clear();
+	m_batchPrimitives.clear();
+	for (size_t i = 0; i < batch.size(); i++)
+	{
+		const vector<Vertex>*    vertices;
+		const vector<Primitive>* primitives;
+		batch[i]->GetRenderOutput(vertices, primitives);
+		for (size_t j = 0; j < primitives->size(); j++)
+		{
+			// The first index is the particle's first vertex
+			Primitive prim  = (*primitives)[j];
+			uint16_t  first = prim.index[0];
+			uint16_t  base  = (uint16_t)m_batchVertices.size();
+			m_batchVertices.insert(m_batchVertices.end(), &(*vertices)[first], &(*vertices)[first] + NUM_VERTICES_PER_PARTICLE);
+			for (int k = 0; k < 3 * NUM_TRIANGLES_PER_PARTICLE; k++)
+			{
+				prim.index[k] = prim.index[k] - first + base;
+			}
+			m_batchPrimitives.push_back(prim);
 		}
 	}
+
+	if (!m_batchPrimitives.empty())
+	{
+		batch[0]->Draw(device, m_batchVertices, m_batchPrimitives);
+	}
 }
 
 // Spawns another round of particles
@@ -859,12 +1387,39 @@ int EmitterInstance::SpawnParticles(TimeF spawnTime)
 		}
 	}
 
+    // Scale the round by the particle budget and level of detail;
+    // fractions carry over to the next round
+    m_spawnRemainder += m_nParticlesPerBurst * m_spawnScale * m_lodSpawnScale;
+    unsigned long nParticles = (unsigned long)m_spawnRemainder;
+    m_spawnRemainder -= nParticles;
+
     int numParticles = 0;
-	for (unsigned long i = 0; i < m_nParticlesPerBurst; i++)
-	{
-        SpawnParticle(spawnTime);
-        numParticles++;
-	}
+    const EmissionMesh* mesh = m_system.GetEmissionMesh();
+    if (mesh != NULL && m_emitter.emitFromMesh == ParticleSystem::EMIT_EVERY_VERTEX && !m_emitter.isWeatherParticle)
+    {
+        // Each particle of the round becomes one at every vertex. Larger meshes
+        // would overflow the vertex indices, so they're emitted from evenly
+        // spaced vertices, as many as the round can hold.
+        size_t nVertices = mesh->GetNumVertices();
+        size_t nRounds   = min((size_t)nParticles, (size_t)MAX_PARTICLES_PER_ROUND);
+        size_t nEmitted  = min(nVertices, MAX_PARTICLES_PER_ROUND / max(nRounds, (size_t)1));
+        for (size_t i = 0; i < nRounds; i++)
+        {
+            for (size_t v = 0; v < nEmitted; v++)
+            {
+                SpawnParticle(spawnTime, v * nVertices / nEmitted);
+            }
+        }
+        numParticles = (int)(nRounds * nEmitted);
+    }
+    else
+    {
+	    for (unsigned long i = 0; i < nParticles; i++)
+	    {
+            SpawnParticle(spawnTime);
+            numParticles++;
+	    }
+    }
 
     m_nextSpawnTime = spawnTime + GetSpawnDelay();
 
@@ -885,6 +1440,43 @@ bool EmitterInstance::IsFrozen(TimeF currentTime) const
 	return m_freezeTime > 0.0f && currentTime >= m_freezeTime;
 }
 
+// Returns the largest size the particles can reach, according to the scale track.
+// Negative scales mirror the billboard, so they count by their magnitude.
+float EmitterInstance::GetMaxParticleSize() const
+{
+	float size = 0.0f;
+	const ParticleSystem::Emitter::Track::KeyMap& keys = m_emitter.tracks[ParticleSystem::TRACK_SCALE]->keys;
+	for (ParticleSystem::Emitter::Track::KeyMap::const_iterator i = keys.begin(); i != keys.end(); ++i)
+	{
+		size = max(size, fabsf(i->value));
+	}
+	return size;
+}
+
+// Hidden emitters, and emitters whose particles have no size, have nothing to show
+bool EmitterInstance::IsHidden() const
+{
+	return !m_emitter.visible || GetMaxParticleSize() == 0.0f;
+}
+
+// Applies a level of detail; NULL means full detail.
+// Disabled emitters stop spawning, but their live particles play out.
+void EmitterInstance::SetLod(const Engine::LodLevel* level)
+{
+	m_lodSpawnScale = 1.0f;
+	m_lodSizeScale  = 1.0f;
+	if (level != NULL && !m_emitter.isWeatherParticle)
+	{
+		bool enabled = (level->heat || !m_emitter.isHeatParticle) && GetMaxParticleSize() >= level->minSize;
+		m_lodSpawnScale = enabled ? level->spawnScale : 0.0f;
+		if (level->spawnScale > 0.0f)
+		{
+			// Fewer, larger particles; the covered area stays the same
+			m_lodSizeScale = 1.0f / sqrtf(level->spawnScale);
+		}
+	}
+}
+
 int EmitterInstance::Kill()
 {
 	// Stop spawning
@@ -896,6 +1488,8 @@ int EmitterInstance::Kill()
 	m_particleIndex.clear();
 
 	m_particleList = nullptr;
+	m_boundsMin    = D3DXVECTOR3( FLT_MAX,  FLT_MAX,  FLT_MAX);
+	m_boundsMax    = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 	return numParticles;
 }
 
@@ -905,22 +1499,39 @@ EmitterInstance::EmitterInstance(TimeF currentTime, ParticleSystemInstance& syst
 	m_doneSpawning        = false;
 	m_particleList        = NULL;
 	m_currentBurst        = 0;
+	m_spawnScale          = 1.0f;
+	m_spawnRemainder      = 0.0f;
+	m_lodSpawnScale       = 1.0f;
+	m_lodSizeScale        = 1.0f;
+	m_boundsMin           = D3DXVECTOR3( FLT_MAX,  FLT_MAX,  FLT_MAX);
+	m_boundsMax           = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	m_culled              = false;
+	m_hasOutput           = true;
+	m_updateTime          = currentTime;
 	m_pColorTexture       = NULL;
 	m_pNormalTexture      = NULL;
+	m_textureRect         = D3DXVECTOR4(0, 0, 1, 1);
 	m_parentSpawnPosition = parent->GetPosition();
+	m_renderPosition      = m_parentSpawnPosition;
 	m_freezeTime          = (m_emitter.freezeTime > 0.0f && m_emitter.freezeTime >= m_emitter.skipTime) ? currentTime + m_emitter.freezeTime - m_emitter.skipTime : 0.0f;
 	
     // Initial array size (32 particles)
     m_blocks.push_back(new ParticleBlock(0,32));
 	m_vertices     .resize(32 * NUM_VERTICES_PER_PARTICLE);
+	m_billboards   .resize(32);
 	m_primitives   .reserve(32);
 	m_particleIndex.reserve(32);
 
 	onParticleSystemChanged(engine, -1);
+	if (m_emitter.objectSpaceAcceleration)
+	{
+		UpdateAcceleration();
+	}
 
 	// Spawn initial particles
     if (m_emitter.isWeatherParticle)
     {
+        UpdateWeatherCube();
         // Spawn all particles immediately for weather particles
         for (unsigned long i = 0; i < m_emitter.nParticlesPerSecond; i++)
 	    {
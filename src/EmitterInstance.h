@@ -7,6 +7,9 @@ using namespace std;
 static const int NUM_VERTICES_PER_PARTICLE  = 4;
 static const int NUM_TRIANGLES_PER_PARTICLE = 2;
 
+// The primitives index the vertices with 16 bits
+static const int MAX_PARTICLES_PER_ROUND    = 65536 / NUM_VERTICES_PER_PARTICLE;
+
 class EmitterInstance : public Object3D
 {
 public:
@@ -26,10 +29,39 @@ public:
 	};
 	#pragma pack()
 
+	// What a particle's quad is made of, before it's turned towards a camera.
+	// Kept with the vertices, so other views can turn the quads their way.
+	struct Billboard
+	{
+		D3DXVECTOR3 position;
+		D3DXVECTOR3 velocity;		// Points the tail, if there is one
+		float       offset;			// Half the quad's size
+		float       angle;			// Rotation, in radians
+	};
+
 private:
 	struct Particle;
     class  ParticleBlock;
 
+	// Side effects on other emitters are recorded during Update and
+	// executed afterwards, so updating never creates or changes other emitters.
+	struct Command
+	{
+		enum Type
+		{
+			CMD_SPAWN_ATTACHED,		// Spawn a child emitter attached to a particle
+			CMD_SPAWN_DETACHED,		// Spawn a detached, non-spawning child emitter at a position
+			CMD_DETACH,				// Detach a child emitter and stop its spawning
+		};
+
+		Type			 type;
+		TimeF			 time;
+		size_t			 emitter;
+		Particle*		 particle;
+		EmitterInstance* child;
+		D3DXVECTOR3		 position;
+	};
+
 	IDirect3DTexture9*		 m_pColorTexture;
 	IDirect3DTexture9*		 m_pNormalTexture;
 	bool					 m_doneSpawning;
@@ -40,38 +72,93 @@ private:
     unsigned long            m_nParticlesPerBurst;
 	unsigned long			 m_currentBurst;
 	D3DXVECTOR3				 m_acceleration;
+	D3DXVECTOR3				 m_gravity;			// The world-space part of m_acceleration
 	unsigned int			 m_textureSizeSqrt;
     D3DXVECTOR3				 m_parentSpawnPosition;
 	TimeF				     m_spawnDelay;
 	TimeF				     m_freezeTime;
+	float					 m_spawnScale;		// Set by the engine's particle budget
+	float					 m_spawnRemainder;
+	float					 m_lodSpawnScale;	// Set by the level of detail
+	float					 m_lodSizeScale;
 
     // Particle storage
 	vector<ParticleBlock*> m_blocks;
 	vector<Vertex>		   m_vertices;
+	vector<Billboard>	   m_billboards;	// One per quad of m_vertices
 	vector<Primitive>	   m_primitives;
 	vector<Particle*>      m_particleIndex;
 	Particle*			   m_particleList;
+	vector<size_t>		   m_kills;
+
+	// World-space bounds of the live particles' quads, as of the last update
+	D3DXVECTOR3			   m_boundsMin;
+	D3DXVECTOR3			   m_boundsMax;
+
+	// Culling
+	bool				   m_culled;		// Skip building quads in the next update?
+	bool				   m_hasOutput;		// Were the quads built in the last update?
+	TimeF				   m_updateTime;
+
+	// Weather cube, placed in front of the camera at each update
+	D3DXVECTOR3			   m_weatherCenter;
+	D3DXVECTOR3			   m_weatherCorner;
+
+	// Back-to-front order of the primitives, if the emitter sorts its particles
+	vector<uint32_t>	   m_sortOrder;
+	vector<uint32_t>	   m_sortKeys;
+	vector<uint32_t>	   m_sortScratch;
+	vector<float>		   m_sortDepths;
+
+	// Commands recorded during the last update
+	vector<Command>		   m_commands;
+
+	// Output of the last published update, read by Render.
+	// Kept apart so the next update can run while this one's rendered.
+	vector<Vertex>		m_renderVertices;
+	vector<Primitive>	m_renderPrimitives;
+	vector<Billboard>	m_renderBillboards;
+	D3DXVECTOR3			m_renderPosition;
 
 	// Rendering
 	D3DXMATRIX			m_textureTransform;
+	D3DXVECTOR4			m_textureRect;		// Where the color texture is in its atlas
 	const D3DXMATRIX*	m_billboard;
     DWORD               m_colorOp;
 	DWORD				m_alphaSrcBlend;
 	DWORD				m_alphaDestBlend;
 
+	// Concatenated output of batched emitters, and the output of an emitter
+	// built for another view; only used while rendering
+	static vector<Vertex>	 m_batchVertices;
+	static vector<Primitive> m_batchPrimitives;
+	static vector<Vertex>	 m_viewVertices;
+	static vector<Primitive> m_viewPrimitives;
+
 	Particle& AllocateParticle();
 	void      FreeParticle(Particle& particle);
 
-	void  SpawnParticle(TimeF currentTime);
+	void  SpawnParticle(TimeF currentTime, size_t meshVertex = -1);
 	int   SpawnParticles(TimeF currentTime);
     void  ResetParticle(Particle& particle, TimeF currentTime);
 	void  UpdateTrackCursors(Particle& particle, float relTime) const;
 	float SampleTrack(const Particle& particle, int track, float relTime) const;
 	float IntegrateTrack(const Particle& particle, int track, float relTime) const;
-	void  UpdateParticle(Particle& particle, float relTime);
+	void  InitializeBounces(Particle& particle) const;
+	void  GetBounceState(const Particle& particle, float t, float& z, float& vz) const;
+	void  UpdateParticle(Particle& particle, float t);
+	float ExpandBillboard(const Billboard& billboard, const D3DXMATRIX& viewRotation, const D3DXMATRIX& billboardMatrix, Vertex* verts) const;
+	void  OutputParticle(const Particle& particle, float relTime);
+	void  OutputParticles();
+	void  SortParticles();
+	void  GetRenderOutput(const vector<Vertex>*& vertices, const vector<Primitive>*& primitives) const;
+	void  Draw(IRenderDevice* device, const vector<Vertex>& vertices, const vector<Primitive>& primitives) const;
 	int   KillParticle(TimeF currenTime, Particle& particle);
 
 	bool  IsFrozen(TimeF currentTime) const;
+	void  UpdateWeatherCube();
+	void  UpdateAcceleration();
+	float GetMaxParticleSize() const;
 	bool  DoneSpawning()  const   { return m_doneSpawning; }	// Are we done spawning?
 	TimeF GetSpawnDelay() const   { return m_spawnDelay;   }	// The delta time when the next spawn round should occur
 
@@ -82,10 +169,29 @@ public:
 	int   Kill();
 	void  onParticleSystemChanged(const Engine& engine, int track);
 	int   Update(TimeF currentTime);
-	void  Render(IDirect3DDevice9* pDevice);
+	void  ExecuteCommands();
+	void  PublishOutput();
+	void  Submit(RenderQueue& queue, float depth);
+	void  Render(IRenderDevice* device);
+	bool  CanBatchWith(const EmitterInstance& other) const;
+	static void RenderBatch(IRenderDevice* device, const vector<EmitterInstance*>& batch);
 	void  StopSpawning();
+	void  SetSpawnScale(float scale) { m_spawnScale = scale; }
+	void  SetLod(const Engine::LodLevel* level);
+	void  SetCulled(bool culled);
+	int   GetNumParticles() const    { return (int)m_primitives.size(); }
+	int   GetNumRenderParticles() const { return (int)m_renderPrimitives.size(); }
+	bool  GetBounds(D3DXVECTOR3& min, D3DXVECTOR3& max) const;
+	bool  GetBoundingSphere(D3DXVECTOR3& center, float& radius) const;
+	int   GetBlendMode()    const    { return m_emitter.blendMode; }
+	const ParticleSystem::Emitter& GetEmitter() const { return m_emitter; }
+
+	// The quads of the last published update, as Render draws them
+	const vector<Vertex>&    GetRenderVertices()   const { return m_renderVertices; }
+	const vector<Primitive>& GetRenderPrimitives() const { return m_renderPrimitives; }
 	bool  IsHeatEmitter() const   { return !m_engine.GetHeatDebug() && m_emitter.isHeatParticle; }
 	bool  IsRoot()        const   { return m_emitter.parent == NULL; }
+	bool  IsHidden()      const;
 
 	EmitterInstance(TimeF currentTime, ParticleSystemInstance& system, Engine& engine, ParticleSystem::Emitter& emitter, Object3D* parent, int* numParticles);
 	~EmitterInstance();
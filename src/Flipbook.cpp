@@ -0,0 +1,179 @@
+#include "Flipbook.h"
+#include "Simulation.h"
+#include "SoftwareRenderDevice.h"
+#include <stdexcept>
+using namespace std;
+
+unsigned int GetFlipbookColumns(unsigned int numFrames)
+{
+	unsigned int columns = 1;
+	while (columns * columns < numFrames)
+	{
+		columns++;
+	}
+	return columns;
+}
+
+int GetFlipbookBlendMode(const ParticleSystem& system)
+{
+	bool additive = false;
+	const vector<ParticleSystem::Emitter*>& emitters = system.getEmitters();
+	for (size_t i = 0; i < emitters.size(); i++)
+	{
+		const ParticleSystem::Emitter& emitter = *emitters[i];
+		if (!emitter.visible || emitter.isHeatParticle)
+		{
+			// Not in the frames
+			continue;
+		}
+
+		if (emitter.blendMode != ParticleSystem::BLEND_ADDITIVE && emitter.blendMode != ParticleSystem::BLEND_DEPTH_ADDITIVE)
+		{
+			return ParticleSystem::BLEND_TRANSPARENT;
+		}
+		additive = true;
+	}
+	return additive ? ParticleSystem::BLEND_ADDITIVE : ParticleSystem::BLEND_TRANSPARENT;
+}
+
+// Copies a frame rendered on black, for additive playback; alpha isn't used
+static void CopyFrame(const Image& black, Image& atlas, unsigned int x0, unsigned int y0)
+{
+	for (unsigned int y = 0; y < black.height; y++)
+	for (unsigned int x = 0; x < black.width; x++)
+	{
+		Image::Pixel& p = atlas(x0 + x, y0 + y);
+		p   = black(x, y);
+		p.a = 255;
+	}
+}
+
+// Recovers a frame from its renders on black and white. With straight alpha,
+// black = color * alpha and white = color * alpha + 1 - alpha.
+static void ResolveFrame(const Image& black, const Image& white, Image& atlas, unsigned int x0, unsigned int y0)
+{
+	for (unsigned int y = 0; y < black.height; y++)
+	for (unsigned int x = 0; x < black.width; x++)
+	{
+		const Image::Pixel& b = black(x, y);
+		const Image::Pixel& w = white(x, y);
+		int transmitted = (max(w.r - b.r, 0) + max(w.g - b.g, 0) + max(w.b - b.b, 0)) / 3;
+		int alpha       = 255 - transmitted;
+
+		Image::Pixel& p = atlas(x0 + x, y0 + y);
+		p.a = (uint8_t)alpha;
+		p.r = (uint8_t)((alpha > 0) ? min(b.r * 255 / alpha, 255) : 0);
+		p.g = (uint8_t)((alpha > 0) ? min(b.g * 255 / alpha, 255) : 0);
+		p.b = (uint8_t)((alpha > 0) ? min(b.b * 255 / alpha, 255) : 0);
+	}
+}
+
+float BakeFlipbook(Engine& engine, const ParticleSystem& system, const FlipbookSettings& settings, Image& atlas)
+{
+	const unsigned int columns  = GetFlipbookColumns(settings.numFrames);
+	const bool         additive = (settings.blendMode == ParticleSystem::BLEND_ADDITIVE);
+	atlas.Resize(columns * settings.frameSize, columns * settings.frameSize);
+	fill(atlas.pixels.begin(), atlas.pixels.end(), Image::Pixel());
+
+	FixedStepSimulation simulation(engine, system, settings.camera, settings.seed);
+
+	IRenderDevice*       previous   = engine.GetRenderDevice();
+	COLORREF             background = engine.GetBackground();
+	bool                 ground     = engine.GetGround();
+	SoftwareRenderDevice device(engine);
+	engine.SetRenderDevice(&device);
+	engine.SetGround(false);
+
+	auto restore = [&]()
+	{
+		engine.SetRenderDevice(previous);
+		engine.SetBackground(background);
+		engine.SetGround(ground);
+		engine.Clear();
+	};
+
+	try
+	{
+		Image black, white;
+		for (unsigned int frame = 0; frame < settings.numFrames; frame++)
+		{
+			// A frame shows the start of its share of the duration, as the
+			// emitter's index track does
+			simulation.StepTo(settings.duration * frame / settings.numFrames);
+
+			engine.SetBackground(RGB(0, 0, 0));
+			bool rendered = engine.Render(false);
+			device.Resolve(black);
+			if (!additive)
+			{
+				engine.SetBackground(RGB(255, 255, 255));
+				rendered = rendered && engine.Render(false);
+				device.Resolve(white);
+			}
+			if (!rendered || black.width != settings.frameSize || black.height != settings.frameSize)
+			{
+				throw runtime_error("Unable to render the flipbook frames");
+			}
+
+			const unsigned int x = (frame % columns) * settings.frameSize;
+			const unsigned int y = (frame / columns) * settings.frameSize;
+			if (additive)
+			{
+				CopyFrame(black, atlas, x, y);
+			}
+			else
+			{
+				ResolveFrame(black, white, atlas, x, y);
+			}
+		}
+	}
+	catch (...)
+	{
+		restore();
+		throw;
+	}
+	restore();
+
+	// The projection's _22 is the cotangent of half the field of view
+	D3DXVECTOR3 eye = settings.camera.Position - settings.camera.Target;
+	return 2 * D3DXVec3Length(&eye) / engine.GetProjectionMatrix()._22;
+}
+
+void CreateFlipbookSystem(ParticleSystem& system, const FlipbookSettings& settings, const string& texture, float size)
+{
+	typedef ParticleSystem::Emitter::Track::Key Key;
+
+	const unsigned int columns = GetFlipbookColumns(settings.numFrames);
+	ParticleSystem::Emitter emitter;
+	emitter.name               = "flipbook";
+	emitter.colorTexture       = texture;
+	emitter.blendMode          = settings.blendMode;
+	emitter.textureSize        = columns * columns;
+	emitter.lifetime           = settings.duration;
+	emitter.useBursts          = true;
+	emitter.nBursts            = 1;
+	emitter.nParticlesPerBurst = 1;
+
+	// The frames are centered on the camera's target
+	ParticleSystem::Emitter::Group& position = emitter.groups[ParticleSystem::GROUP_POSITION];
+	position.type = ParticleSystem::GT_EXACT;
+	position.valX = settings.camera.Target.x;
+	position.valY = settings.camera.Target.y;
+	position.valZ = settings.camera.Target.z;
+
+	// Step through the frames over the particle's life, in percent
+	ParticleSystem::Emitter::Track& index = *emitter.tracks[ParticleSystem::TRACK_INDEX];
+	index.keys.clear();
+	for (unsigned int i = 0; i < settings.numFrames; i++)
+	{
+		index.keys.insert(Key(100.0f * i / settings.numFrames, (float)i));
+	}
+	index.keys.insert(Key(100.0f, (float)(settings.numFrames - 1)));
+
+	ParticleSystem::Emitter::Track& scale = *emitter.tracks[ParticleSystem::TRACK_SCALE];
+	scale.keys.clear();
+	scale.keys.insert(Key(  0.0f, size));
+	scale.keys.insert(Key(100.0f, size));
+
+	system.addRootEmitter(emitter);
+}
@@ -0,0 +1,42 @@
+#ifndef FLIPBOOK_H
+#define FLIPBOOK_H
+
+#include "engine.h"
+#include "../tools/common/Image.h"
+
+//
+// Pre-renders a particle system into a flipbook: an atlas of frames, played
+// by a single emitter on one billboard.
+//
+struct FlipbookSettings
+{
+	unsigned int   numFrames;
+	unsigned int   frameSize;		// Pixels per side of a frame
+	float          duration;		// Seconds of simulation the frames span
+	Engine::Camera camera;
+	unsigned int   seed;			// For the random numbers of the simulation
+	int            blendMode;		// How the frames are baked and played; see GetFlipbookBlendMode
+};
+
+// Systems that only add light are baked on black, as the light they add, and
+// played additively. Anything else is baked with alpha, from renders on black
+// and white, and played as transparent.
+int GetFlipbookBlendMode(const ParticleSystem& system);
+
+// The frames are laid out in a square grid, as the emitter's texture size
+// expects (see EmitterInstance::OutputParticle)
+unsigned int GetFlipbookColumns(unsigned int numFrames);
+
+// Simulates the system from the start at a fixed rate, and renders the frames
+// into the atlas with the software rasterizer, with the settings' blend mode.
+// The engine's render window must be
+// frameSize pixels square. This stops the clock (see SetTimeF), and clears
+// the engine. Returns the width, in world units, that a frame shows at the
+// camera's target. Throws runtime_error if the engine can't render.
+float BakeFlipbook(Engine& engine, const ParticleSystem& system, const FlipbookSettings& settings, Image& atlas);
+
+// Sets up a system with one emitter that plays the atlas once, on a billboard
+// 'size' units wide at the camera's target
+void CreateFlipbookSystem(ParticleSystem& system, const FlipbookSettings& settings, const std::string& texture, float size);
+
+#endif
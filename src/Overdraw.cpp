@@ -0,0 +1,183 @@
+#include "Overdraw.h"
+#include "EmitterInstance.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <map>
+using namespace std;
+
+// Clipping a quad by the five planes adds at most one vertex per plane
+static const int MAX_CLIPPED_VERTICES = NUM_VERTICES_PER_PARTICLE + 5;
+
+// Keeps the part of a convex polygon on the positive side of a clip-space plane
+static int ClipPolygon(const D3DXVECTOR4* in, int count, const D3DXVECTOR4& plane, D3DXVECTOR4* out)
+{
+	int n = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const D3DXVECTOR4& a = in[i];
+		const D3DXVECTOR4& b = in[(i + 1) % count];
+		const float da = D3DXVec4Dot(&a, &plane);
+		const float db = D3DXVec4Dot(&b, &plane);
+		if (da >= 0)
+		{
+			out[n++] = a;
+		}
+		if ((da >= 0) != (db >= 0))
+		{
+			out[n++] = a + (b - a) * (da / (da - db));
+		}
+	}
+	return n;
+}
+
+// Adds a layer to the cells whose centers the clip-space quad covers, and
+// returns the number of pixels it covers
+float OverdrawEstimator::AddQuad(const D3DXVECTOR4* quad, float width, float height)
+{
+	// The near plane, then the sides of the screen
+	static const D3DXVECTOR4 Planes[5] = {
+		D3DXVECTOR4( 0, 0, 1, 0),
+		D3DXVECTOR4( 1, 0, 0, 1),
+		D3DXVECTOR4(-1, 0, 0, 1),
+		D3DXVECTOR4( 0, 1, 0, 1),
+		D3DXVECTOR4( 0,-1, 0, 1)
+	};
+
+	D3DXVECTOR4 buffers[2][MAX_CLIPPED_VERTICES];
+	copy(quad, quad + NUM_VERTICES_PER_PARTICLE, buffers[0]);
+	int count = NUM_VERTICES_PER_PARTICLE;
+	for (int i = 0; i < 5; i++)
+	{
+		count = ClipPolygon(buffers[i % 2], count, Planes[i], buffers[(i + 1) % 2]);
+		if (count < 3)
+		{
+			return 0;
+		}
+	}
+	const D3DXVECTOR4* clipped = buffers[1];
+
+	// Into grid cells, from the top left of the screen
+	D3DXVECTOR2 points[MAX_CLIPPED_VERTICES];
+	float top = FLT_MAX, bottom = -FLT_MAX;
+	for (int i = 0; i < count; i++)
+	{
+		points[i].x = (1 + clipped[i].x / clipped[i].w) * 0.5f * m_gridWidth;
+		points[i].y = (1 - clipped[i].y / clipped[i].w) * 0.5f * m_gridHeight;
+		top    = min(top,    points[i].y);
+		bottom = max(bottom, points[i].y);
+	}
+
+	float area = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const D3DXVECTOR2& a = points[i];
+		const D3DXVECTOR2& b = points[(i + 1) % count];
+		area += a.x * b.y - b.x * a.y;
+	}
+
+	// Cells are covered when their center is, left and top edges inclusive
+	const int firstRow = max((int)ceil(top - 0.5f), 0);
+	const int lastRow  = min((int)ceil(bottom - 0.5f), (int)m_gridHeight) - 1;
+	for (int row = firstRow; row <= lastRow; row++)
+	{
+		const float y = row + 0.5f;
+		float left = FLT_MAX, right = -FLT_MAX;
+		for (int i = 0; i < count; i++)
+		{
+			const D3DXVECTOR2& a = points[i];
+			const D3DXVECTOR2& b = points[(i + 1) % count];
+			if ((a.y <= y) != (b.y <= y))
+			{
+				const float x = a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y);
+				left  = min(left,  x);
+				right = max(right, x);
+			}
+		}
+
+		if (left > right)
+		{
+			continue;
+		}
+
+		const int firstColumn = max((int)ceil(left - 0.5f), 0);
+		const int lastColumn  = min((int)ceil(right - 0.5f), (int)m_gridWidth) - 1;
+		unsigned int* cell = &m_grid[row * m_gridWidth];
+		for (int column = firstColumn; column <= lastColumn; column++)
+		{
+			const unsigned int layers = ++cell[column];
+			m_stats.peakOverdraw = max(m_stats.peakOverdraw, layers);
+		}
+	}
+
+	return fabs(area) / 2 * (width / m_gridWidth) * (height / m_gridHeight);
+}
+
+void OverdrawEstimator::Estimate(const RenderQueue& queue, const D3DXMATRIX& viewProjection, unsigned int width, unsigned int height)
+{
+	m_stats.Reset();
+	m_gridWidth  = max((width  + CELL_SIZE - 1) / CELL_SIZE, 1u);
+	m_gridHeight = max((height + CELL_SIZE - 1) / CELL_SIZE, 1u);
+	m_grid.assign(m_gridWidth * m_gridHeight, 0);
+
+	// The emitters' pixels are summed unrounded
+	map<const ParticleSystem::Emitter*, size_t> indices;
+	vector<double> emitterPixels;
+	double         pixels = 0;
+
+	const vector<RenderQueue::Item>& items = queue.GetItems();
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		const EmitterInstance& emitter = *items[i].emitter;
+		const vector<EmitterInstance::Vertex>&    vertices   = emitter.GetRenderVertices();
+		const vector<EmitterInstance::Primitive>& primitives = emitter.GetRenderPrimitives();
+
+		// A particle's quad is the four vertices from its primitive's first index
+		double        instancePixels = 0;
+		unsigned long particles      = 0;
+		for (size_t j = 0; j < primitives.size(); j++)
+		{
+			const EmitterInstance::Vertex* v = &vertices[primitives[j].index[0]];
+			D3DXVECTOR4 quad[NUM_VERTICES_PER_PARTICLE];
+			for (int k = 0; k < NUM_VERTICES_PER_PARTICLE; k++)
+			{
+				D3DXVec3Transform(&quad[k], &v[k].Position, &viewProjection);
+			}
+
+			const float area = AddQuad(quad, (float)width, (float)height);
+			if (area > 0)
+			{
+				instancePixels += area;
+				particles++;
+			}
+		}
+
+		if (particles > 0)
+		{
+			map<const ParticleSystem::Emitter*, size_t>::iterator p = indices.find(&emitter.GetEmitter());
+			if (p == indices.end())
+			{
+				OverdrawStats::Emitter entry = {&emitter.GetEmitter(), 0, 0};
+				p = indices.insert(make_pair(entry.emitter, m_stats.emitters.size())).first;
+				m_stats.emitters.push_back(entry);
+				emitterPixels.push_back(0);
+			}
+			m_stats.emitters[p->second].particles += particles;
+			emitterPixels[p->second] += instancePixels;
+			pixels += instancePixels;
+		}
+	}
+
+	for (size_t i = 0; i < m_stats.emitters.size(); i++)
+	{
+		m_stats.emitters[i].pixels = (unsigned long)(emitterPixels[i] + 0.5);
+	}
+	sort(m_stats.emitters.begin(), m_stats.emitters.end(), [](const OverdrawStats::Emitter& a, const OverdrawStats::Emitter& b)
+	{
+		return a.pixels > b.pixels;
+	});
+
+	const size_t coveredCells = m_grid.size() - count(m_grid.begin(), m_grid.end(), 0u);
+	m_stats.pixels        = (unsigned long)(pixels + 0.5);
+	m_stats.coveredPixels = (unsigned long)((double)coveredCells * width * height / m_grid.size() + 0.5);
+}
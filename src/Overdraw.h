@@ -0,0 +1,61 @@
+#ifndef OVERDRAW_H
+#define OVERDRAW_H
+
+#include "RenderQueue.h"
+#include "ParticleSystem.h"
+#include <vector>
+
+// The fill of a frame, as estimated by an OverdrawEstimator
+struct OverdrawStats
+{
+	struct Emitter
+	{
+		const ParticleSystem::Emitter* emitter;		// Summed over all its instances
+		unsigned long                  particles;
+		unsigned long                  pixels;
+	};
+
+	unsigned long        pixels;			// Pixels shaded, summed over all quads
+	unsigned long        coveredPixels;		// Pixels under at least one quad
+	unsigned int         peakOverdraw;		// Most quads over one grid cell
+	std::vector<Emitter> emitters;			// Those with quads on screen, most pixels first
+
+	float GetAverageOverdraw() const { return (coveredPixels > 0) ? (float)pixels / coveredPixels : 0.0f; }
+
+	void Reset() { pixels = coveredPixels = 0; peakOverdraw = 0; emitters.clear(); }
+	OverdrawStats() { Reset(); }
+};
+
+//
+// Estimates the fill of a frame on the CPU, without drawing it.
+// Every queued quad is projected and clipped to the screen. Its area adds to
+// the shaded pixels, and it adds a layer to the cells of a low-resolution
+// grid whose centers it covers. Depth testing and texture alpha are ignored,
+// so this is what the particles could cost at most.
+//
+class OverdrawEstimator
+{
+public:
+	static const unsigned int CELL_SIZE = 8;	// Pixels per side of a grid cell, about
+
+	void Estimate(const RenderQueue& queue, const D3DXMATRIX& viewProjection, unsigned int width, unsigned int height);
+
+	const OverdrawStats& GetStats() const { return m_stats; }
+
+	// Layers per cell, row by row from the top of the screen
+	const std::vector<unsigned int>& GetGrid() const { return m_grid; }
+	unsigned int GetGridWidth()  const { return m_gridWidth; }
+	unsigned int GetGridHeight() const { return m_gridHeight; }
+
+	OverdrawEstimator() : m_gridWidth(0), m_gridHeight(0) {}
+
+private:
+	float AddQuad(const D3DXVECTOR4* quad, float width, float height);
+
+	OverdrawStats             m_stats;
+	std::vector<unsigned int> m_grid;
+	unsigned int              m_gridWidth;
+	unsigned int              m_gridHeight;
+};
+
+#endif
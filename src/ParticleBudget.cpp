@@ -0,0 +1,137 @@
+#include "ParticleBudget.h"
+#include <algorithm>
+using namespace std;
+
+// The share of a claim's particles that fits in what's left of a budget
+static float FitBudget(float remaining, int count)
+{
+	if (remaining <= 0)
+	{
+		return 0.0f;
+	}
+	return (count <= remaining) ? 1.0f : remaining / count;
+}
+
+bool ParticleBudget::IsLimited() const
+{
+	if (m_budget > 0)
+	{
+		return true;
+	}
+	for (int j = 0; j < m_numBlendModes; j++)
+	{
+		if (m_blendBudgets[j] > 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void ParticleBudget::Clear()
+{
+	m_priorities.clear();
+	m_counts.clear();
+	m_scales.clear();
+	m_pressure     = 0.0f;
+	m_numThrottled = 0;
+	m_numCulled    = 0;
+	fill(m_blendPressures.begin(), m_blendPressures.end(), 0.0f);
+}
+
+size_t ParticleBudget::AddClaim(float priority, const int* counts)
+{
+	m_priorities.push_back(priority);
+	m_counts.insert(m_counts.end(), counts, counts + m_numBlendModes);
+	m_scales.resize(m_scales.size() + m_numBlendModes, 1.0f);
+	return m_priorities.size() - 1;
+}
+
+void ParticleBudget::Fit()
+{
+	const int    N         = m_numBlendModes;
+	const size_t numClaims = m_priorities.size();
+
+	vector<int> totals(numClaims, 0);
+	vector<int> blendTotals(N, 0);
+	int total = 0;
+	for (size_t i = 0; i < numClaims; i++)
+	{
+		for (int j = 0; j < N; j++)
+		{
+			totals[i]      += m_counts[i * N + j];
+			blendTotals[j] += m_counts[i * N + j];
+		}
+		total += totals[i];
+	}
+
+	m_pressure = (m_budget > 0) ? (float)total / m_budget : 0.0f;
+	for (int j = 0; j < N; j++)
+	{
+		m_blendPressures[j] = (m_blendBudgets[j] > 0) ? (float)blendTotals[j] / m_blendBudgets[j] : 0.0f;
+	}
+
+	// Serve the claims by decreasing priority; equal ones in the order they came
+	vector<size_t> order(numClaims);
+	for (size_t i = 0; i < numClaims; i++)
+	{
+		order[i] = i;
+	}
+	stable_sort(order.begin(), order.end(), [this](size_t i1, size_t i2) {
+		return m_priorities[i1] > m_priorities[i2];
+	});
+
+	float remaining = (float)m_budget;
+	vector<float> remainingBlend(N);
+	for (int j = 0; j < N; j++)
+	{
+		remainingBlend[j] = (float)m_blendBudgets[j];
+	}
+
+	m_numThrottled = 0;
+	m_numCulled    = 0;
+	for (size_t k = 0; k < numClaims; k++)
+	{
+		const size_t i      = order[k];
+		const int*   counts = &m_counts[i * N];
+		float*       scales = &m_scales[i * N];
+
+		float scale = (m_budget > 0) ? FitBudget(remaining, totals[i]) : 1.0f;
+		remaining -= totals[i];
+
+		// A claim is culled when none of the blend modes it has particles in
+		// (or any, if it has none) can spawn
+		bool culled    = true;
+		bool throttled = false;
+		for (int j = 0; j < N; j++)
+		{
+			scales[j] = scale;
+			if (m_blendBudgets[j] > 0)
+			{
+				scales[j] = min(scale, FitBudget(remainingBlend[j], counts[j]));
+				remainingBlend[j] -= counts[j];
+			}
+
+			if (counts[j] > 0 || totals[i] == 0)
+			{
+				culled    = culled    && (scales[j] == 0.0f);
+				throttled = throttled || (scales[j] < 1.0f);
+			}
+		}
+
+		if (culled)
+		{
+			m_numCulled++;
+		}
+		else if (throttled)
+		{
+			m_numThrottled++;
+		}
+	}
+}
+
+ParticleBudget::ParticleBudget(int numBlendModes)
+	: m_numBlendModes(numBlendModes), m_budget(0), m_blendBudgets(numBlendModes, 0), m_blendPressures(numBlendModes, 0.0f)
+{
+	Clear();
+}
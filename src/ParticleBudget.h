@@ -0,0 +1,69 @@
+#ifndef PARTICLEBUDGET_H
+#define PARTICLEBUDGET_H
+
+#include <stddef.h>
+#include <vector>
+
+//
+// Fits particle system instances into particle budgets: one for all particles
+// and, optionally, one per blend mode. A budget of 0 is unlimited.
+//
+// Every update, each instance claims its live particles with a priority.
+// Claims are served in order of priority, and each gets the share of its
+// particles that fits in what the ones before it left: the scale of its spawn
+// rate. Over budget, the least important instances are throttled first, and
+// culled (scale 0) once nothing is left for them. Live particles are never
+// killed.
+//
+// Nothing here depends on Direct3D; tools/ParticleBudgetTest checks it.
+//
+class ParticleBudget
+{
+public:
+	// Budgets
+	int  GetBudget() const                     { return m_budget; }
+	int  GetBudget(int blendMode) const        { return m_blendBudgets[blendMode]; }
+	void SetBudget(int budget)                 { m_budget = budget; }
+	void SetBudget(int blendMode, int budget)  { m_blendBudgets[blendMode] = budget; }
+	bool IsLimited() const;
+
+	// Starts a new fit; forgets the claims and the results
+	void Clear();
+
+	// Claims an instance's particles, with one count per blend mode.
+	// Returns the claim's index.
+	size_t AddClaim(float priority, const int* counts);
+
+	// Computes the scales and the statistics below
+	void Fit();
+
+	// The spawn scales of a claim, one per blend mode
+	const float* GetScales(size_t claim) const { return &m_scales[claim * m_numBlendModes]; }
+
+	// The number of particles relative to the budget, 0 if unlimited
+	float GetPressure() const                  { return m_pressure; }
+	float GetPressure(int blendMode) const     { return m_blendPressures[blendMode]; }
+
+	// Claims spawning at a reduced rate, and claims not spawning at all
+	int   GetNumThrottled() const              { return m_numThrottled; }
+	int   GetNumCulled() const                 { return m_numCulled; }
+
+	ParticleBudget(int numBlendModes);
+
+private:
+	int                m_numBlendModes;
+	int                m_budget;
+	std::vector<int>   m_blendBudgets;
+
+	// The claims; counts and scales have an entry per blend mode
+	std::vector<float> m_priorities;
+	std::vector<int>   m_counts;
+	std::vector<float> m_scales;
+
+	float              m_pressure;
+	std::vector<float> m_blendPressures;
+	int                m_numThrottled;
+	int                m_numCulled;
+};
+
+#endif
@@ -4,8 +4,6 @@
 #include "exceptions.h"
 using namespace std;
 
-static const int NUM_BLEND_MODES = 14;
-
 static void Verify(int expr)
 {
 	if (!expr)
@@ -530,6 +528,7 @@ void ParticleSystem::Emitter::setDefaults()
 	spawnDuringLife = -1;
 	parent          = NULL;
     visible         = true;
+    sortParticles   = false;
 
 	name          = "default";
 	colorTexture  = "p_particle_master.tga";
@@ -662,10 +661,12 @@ void ParticleSystem::write(IFile* file)
 ParticleSystem::ParticleSystem()
 {
 	m_leaveParticles = true;
+	m_importance     = 1.0f;
 }
 
 ParticleSystem::ParticleSystem(IFile* file)
 {
+	m_importance = 1.0f;
     try
     {
 	    ChunkType   type;
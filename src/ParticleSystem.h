@@ -52,6 +52,7 @@ public:
     static const int BLEND_BUMP                = 11;
     static const int BLEND_DECAL_BUMP          = 12;
     static const int BLEND_SCANLINES           = 13;
+    static const int NUM_BLEND_MODES           = 14;
 
     // Ground behavior
     static const int GROUND_NONE      = 0;
@@ -121,6 +122,7 @@ public:
 		size_t   spawnDuringLife;
 		Emitter* parent;
         bool     visible;   // Not stored, for use in editor only
+        bool     sortParticles; // Not stored; draw the particles back to front
 
 		std::string name;
 		std::string colorTexture;
@@ -239,13 +241,16 @@ public:
 	      std::vector<Emitter*>& getEmitters()             { return m_emitters; }
 	const std::string&           getName()           const { return m_name; }
 	bool					 	 getLeaveParticles() const { return m_leaveParticles;  }
+	float                        getImportance()     const { return m_importance; }
 	
 	// Setters
 	void setName(const std::string& name) { m_name = name; }
 	void setLeaveParticles(bool leave)    { m_leaveParticles = leave; }
+	void setImportance(float importance)  { m_importance = importance; }
 
 private:
 	bool			 	  m_leaveParticles;
+	float                 m_importance;     // Not stored, used by the engine's particle budget
 	std::string           m_name;
 	std::vector<Emitter*> m_emitters;
 };
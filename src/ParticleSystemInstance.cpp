@@ -1,5 +1,6 @@
 #include "ParticleSystemInstance.h"
 #include "EmitterInstance.h"
+#include "EmissionMesh.h"
 using namespace std;
 
 void ParticleSystemInstance::onParticleSystemChanged(const Engine& engine, int track)
@@ -11,20 +12,48 @@ void ParticleSystemInstance::onParticleSystemChanged(const Engine& engine, int t
 }
 
 int ParticleSystemInstance::Update(TimeF currentTime)
+{
+    int nParticles = Simulate(currentTime);
+    return nParticles + Resolve(currentTime);
+}
+
+// Updates the particles of all emitters. This only touches the emitters' own
+// simulation state, so it can run while the previous frame is being rendered.
+int ParticleSystemInstance::Simulate(TimeF currentTime)
+{
+    return UpdateEmitters(m_emitters.begin(), currentTime);
+}
+
+// The view-space Z of a point
+static float GetViewDepth(const D3DXVECTOR3& pos, const D3DXMATRIX& view)
+{
+    return (pos.x * view._13 + pos.y * view._23 + pos.z * view._33 + view._43) /     // Z
+           (pos.x * view._14 + pos.y * view._24 + pos.z * view._34 + view._44);      // W
+}
+
+// Finishes an update started with Simulate
+int ParticleSystemInstance::Resolve(TimeF currentTime)
 {
     // Calculate Z-Distance
-    const D3DXMATRIX& view = m_engine.GetViewMatrix();
     D3DXVECTOR3 pos = GetPosition();
-    m_zDistance = (pos.x * view._13 + pos.y * view._23 + pos.z * view._33 + view._43) /     // Z
-                  (pos.x * view._14 + pos.y * view._24 + pos.z * view._34 + view._44);      // W
+    m_zDistance = GetViewDepth(pos, m_engine.GetViewMatrix());
 
-    // Update emitters
+    // While updating, emitters only record the child emitters they create or
+    // detach; execute that now. Emitters created that way are updated in turn,
+    // so they have their particles in place before they're rendered.
     int nParticles = 0;
-    for (auto it = m_emitters.begin(); it != m_emitters.end();)
+    EmitterList::iterator first = m_emitters.begin();
+    while (first != m_emitters.end())
 	{
-		nParticles += (*it)->Update(currentTime);
+        EmitterList::iterator last = prev(m_emitters.end());
+        ExecuteCommands(first);
+        first = next(last);
+        nParticles += UpdateEmitters(first, currentTime);
+	}
 
-		// If it's dead and no longer needed (either detached, or we're its parent), then remove it
+    // Remove dead emitters that are no longer needed (either detached, or we're its parent)
+    for (auto it = m_emitters.begin(); it != m_emitters.end();)
+	{
 		if ((*it)->IsDead() && ((*it)->Detached() || (*it)->GetParent() == this))
 		{
 			it = m_emitters.erase(it);
@@ -35,28 +64,49 @@ int ParticleSystemInstance::Update(TimeF currentTime)
 			++it;
 		}
 	}
-    return nParticles;
-}
 
-void ParticleSystemInstance::RenderNormal(IDirect3DDevice9* pDevice)
-{
+    // Pick the level of detail for the next update
+    D3DXVECTOR3 delta = pos - m_engine.GetCamera().Position;
+    const Engine::LodLevel* lod = m_engine.GetLodLevel(D3DXVec3Length(&delta));
+
     for (auto& emitter : m_emitters)
 	{
-        if (!emitter->IsHeatEmitter())
-        {
-            emitter->Render(pDevice);
-        }
+        D3DXVECTOR3 min, max;
+        emitter->SetLod(lod);
+        emitter->SetCulled(emitter->IsHidden() || (emitter->GetBounds(min, max) && !m_engine.IsVisible(min, max)));
+        emitter->PublishOutput();
 	}
+    return nParticles;
+}
+
+int ParticleSystemInstance::UpdateEmitters(EmitterList::iterator first, TimeF currentTime)
+{
+    int nParticles = 0;
+    for (auto it = first; it != m_emitters.end(); ++it)
+    {
+        nParticles += (*it)->Update(currentTime);
+    }
+    return nParticles;
+}
+
+void ParticleSystemInstance::ExecuteCommands(EmitterList::iterator first)
+{
+    // Spawned emitters are appended, so their own commands are executed in this pass as well
+    for (auto it = first; it != m_emitters.end(); ++it)
+    {
+        (*it)->ExecuteCommands();
+    }
 }
 
-void ParticleSystemInstance::RenderHeat(IDirect3DDevice9* pDevice)
+// Queues the emitters that have something to draw
+void ParticleSystemInstance::Submit(RenderQueue& queue)
 {
+    // The view-space Z is negative in front of the camera. Extra views are
+    // drawn from the main view's simulation, so they measure their own.
+    const float zDistance = m_engine.IsMainView() ? m_zDistance : GetViewDepth(GetPosition(), m_engine.GetRenderView().view);
     for (auto& emitter : m_emitters)
 	{
-        if (emitter->IsHeatEmitter())
-        {
-            emitter->Render(pDevice);
-        }
+        emitter->Submit(queue, -zDistance);
 	}
 }
 
@@ -76,6 +126,49 @@ void ParticleSystemInstance::StopSpawning()
 	}
 }
 
+// Returns the bounding box of all emitters' particles, or false if there are none
+bool ParticleSystemInstance::GetBounds(D3DXVECTOR3& min, D3DXVECTOR3& max) const
+{
+	bool found = false;
+	for (auto& emitter : m_emitters)
+	{
+		D3DXVECTOR3 emin, emax;
+		if (emitter->GetBounds(emin, emax))
+		{
+			if (!found)
+			{
+				min = emin;
+				max = emax;
+				found = true;
+			}
+			else
+			{
+				D3DXVec3Minimize(&min, &min, &emin);
+				D3DXVec3Maximize(&max, &max, &emax);
+			}
+		}
+	}
+	return found;
+}
+
+// Adds the number of live particles per blend mode to counts
+void ParticleSystemInstance::GetParticleCounts(int counts[ParticleSystem::NUM_BLEND_MODES]) const
+{
+	for (auto& emitter : m_emitters)
+	{
+		counts[emitter->GetBlendMode()] += emitter->GetNumParticles();
+	}
+}
+
+// Scales the spawn rate of the emitters, per blend mode
+void ParticleSystemInstance::SetSpawnScales(const float scales[ParticleSystem::NUM_BLEND_MODES])
+{
+	for (auto& emitter : m_emitters)
+	{
+		emitter->SetSpawnScale(scales[emitter->GetBlendMode()]);
+	}
+}
+
 int ParticleSystemInstance::Kill()
 {
 	int numParticles = 0;
@@ -96,22 +189,56 @@ EmitterInstance* ParticleSystemInstance::SpawnEmitter(TimeF currentTime, size_t
 	return m_emitters.back().get();
 }
 
-ParticleSystemInstance::ParticleSystemInstance(Engine& engine, const ParticleSystem& system, Object3D* parent)
-	: Object3D(parent), m_engine(engine), m_system(system)
-{		
-	TimeF now  = GetTimeF();
-
-	// Spawn all root emitters
-	const vector<ParticleSystem::Emitter*>& emitters = m_system.getEmitters();
+// The indices of the emitters without a parent, which every instance starts with
+void ParticleSystemInstance::GetRootEmitters(const ParticleSystem& system, vector<size_t>& roots)
+{
+	const vector<ParticleSystem::Emitter*>& emitters = system.getEmitters();
 	for (size_t i = 0; i < emitters.size(); i++)
 	{
 		if (emitters[i]->parent == NULL)
 		{
-            SpawnEmitter(now, i, this);
+            roots.push_back(i);
 		}
 	}
 }
 
+void ParticleSystemInstance::SpawnRootEmitters(TimeF currentTime, const vector<size_t>& roots)
+{
+	for (size_t i = 0; i < roots.size(); i++)
+	{
+        SpawnEmitter(currentTime, roots[i], this);
+	}
+    ExecuteCommands(m_emitters.begin());
+}
+
+ParticleSystemInstance::ParticleSystemInstance(Engine& engine, const ParticleSystem& system, Object3D* parent, EmissionMesh* mesh)
+	: Object3D(parent), m_engine(engine), m_system(system), m_mesh(mesh)
+{
+	if (m_mesh != NULL)
+	{
+		m_mesh->AddRef();
+	}
+	D3DXMatrixIdentity(&m_orientation);
+
+	vector<size_t> roots;
+	GetRootEmitters(m_system, roots);
+	SpawnRootEmitters(GetTimeF(), roots);
+}
+
+ParticleSystemInstance::ParticleSystemInstance(Engine& engine, const ParticleSystem& system, const D3DXVECTOR3& position, TimeF currentTime, const vector<size_t>& roots, EmissionMesh* mesh)
+	: Object3D(NULL, position), m_engine(engine), m_system(system), m_mesh(mesh)
+{
+	if (m_mesh != NULL)
+	{
+		m_mesh->AddRef();
+	}
+	D3DXMatrixIdentity(&m_orientation);
+	SpawnRootEmitters(currentTime, roots);
+}
+
 ParticleSystemInstance::~ParticleSystemInstance()
 {
+	// Emitters go first, they may refer to the mesh
+	m_emitters.clear();
+	SAFE_RELEASE(m_mesh);
 }
\ No newline at end of file
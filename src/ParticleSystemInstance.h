@@ -7,18 +7,33 @@
 
 class ParticleSystemInstance : public Object3D
 {
+    typedef std::list<std::unique_ptr<EmitterInstance>> EmitterList;
+
 	Engine&				     m_engine;
 	const ParticleSystem&    m_system;
-	std::list<std::unique_ptr<EmitterInstance>> m_emitters;
+	EmitterList              m_emitters;
     float                    m_zDistance;
+    EmissionMesh*            m_mesh;
+    D3DXMATRIX               m_orientation;     // Rotation only
+
+    int  UpdateEmitters(EmitterList::iterator first, TimeF currentTime);
+    void ExecuteCommands(EmitterList::iterator first);
+    void SpawnRootEmitters(TimeF currentTime, const std::vector<size_t>& roots);
 
 public:
     const ParticleSystem& GetParticleSystem() { return m_system; }
 
     void SetPosition(const D3DXVECTOR3& position);
 
+    // The orientation of the instance; used by emitters with object-space acceleration
+    const D3DXMATRIX& GetOrientation() const { return m_orientation; }
+    void SetOrientation(const D3DXMATRIX& orientation) { m_orientation = orientation; }
+
     float GetZDistance() const { return m_zDistance; }
 
+    // The mesh that emitters with emitFromMesh set emit from, if any
+    const EmissionMesh* GetEmissionMesh() const { return m_mesh; }
+
 	bool IsDead() const
 	{
 		return m_emitters.empty();
@@ -27,12 +42,22 @@ public:
     int Kill();
     void onParticleSystemChanged(const Engine& engine, int track);
 	int  Update(TimeF currentTime);
-	void RenderNormal(IDirect3DDevice9* pDevice);
-	void RenderHeat(IDirect3DDevice9* pDevice);
+	int  Simulate(TimeF currentTime);
+	int  Resolve(TimeF currentTime);
+	void Submit(RenderQueue& queue);
 	void StopSpawning();
+	bool GetBounds(D3DXVECTOR3& min, D3DXVECTOR3& max) const;
+	void GetParticleCounts(int counts[ParticleSystem::NUM_BLEND_MODES]) const;
+	void SetSpawnScales(const float scales[ParticleSystem::NUM_BLEND_MODES]);
 	EmitterInstance* SpawnEmitter(TimeF currentTime, size_t idxEmitter, Object3D* parent);
 
-	ParticleSystemInstance(Engine& engine, const ParticleSystem& system, Object3D* parent);
+	static void GetRootEmitters(const ParticleSystem& system, std::vector<size_t>& roots);
+
+	ParticleSystemInstance(Engine& engine, const ParticleSystem& system, Object3D* parent, EmissionMesh* mesh = NULL);
+
+	// An instance without a parent, with the root emitters and spawn time
+	// already looked up, as when spawning many at once
+	ParticleSystemInstance(Engine& engine, const ParticleSystem& system, const D3DXVECTOR3& position, TimeF currentTime, const std::vector<size_t>& roots, EmissionMesh* mesh = NULL);
 	~ParticleSystemInstance();
 };
 
@@ -0,0 +1,193 @@
+#include "RenderDevice.h"
+
+//
+// RecordingRenderDevice
+//
+
+static const unsigned int MATRIX_SIZE = 16 * sizeof(float);
+static const unsigned int VECTOR_SIZE =  4 * sizeof(float);
+
+// Returns the number of vertices that 'count' primitives of a type use
+static unsigned int GetNumVertices(IRenderDevice::PrimitiveType type, unsigned int count)
+{
+	switch (type)
+	{
+		case IRenderDevice::TRIANGLE_LIST:  return count * 3;
+		case IRenderDevice::TRIANGLE_STRIP: return count + 2;
+	}
+	return 0;
+}
+
+void RecordingRenderDevice::BeginScene()
+{
+	m_stats.scenes++;
+	if (m_next != NULL) m_next->BeginScene();
+}
+
+void RecordingRenderDevice::EndScene()
+{
+	if (m_next != NULL) m_next->EndScene();
+}
+
+void RecordingRenderDevice::Present(RenderSwapChain* swapChain)
+{
+	if (m_next != NULL) m_next->Present(swapChain);
+}
+
+void RecordingRenderDevice::SetState(State state, uint32_t value)
+{
+	m_stats.stateChanges++;
+	if (m_next != NULL) m_next->SetState(state, value);
+}
+
+void RecordingRenderDevice::SetTransform(Transform transform, const float* matrix)
+{
+	m_stats.stateChanges++;
+	m_stats.bytes += MATRIX_SIZE;
+	if (m_next != NULL) m_next->SetTransform(transform, matrix);
+}
+
+void RecordingRenderDevice::SetTexture(unsigned int stage, RenderTexture* texture)
+{
+	m_stats.textureChanges++;
+	if (m_next != NULL) m_next->SetTexture(stage, texture);
+}
+
+void RecordingRenderDevice::SetRenderTarget(unsigned int index, RenderSurface* surface)
+{
+	m_stats.targetChanges++;
+	if (m_next != NULL) m_next->SetRenderTarget(index, surface);
+}
+
+void RecordingRenderDevice::SetDepthStencilSurface(RenderSurface* surface)
+{
+	m_stats.targetChanges++;
+	if (m_next != NULL) m_next->SetDepthStencilSurface(surface);
+}
+
+void RecordingRenderDevice::Clear(unsigned int flags, uint32_t color, float z)
+{
+	m_stats.clears++;
+	if (m_next != NULL) m_next->Clear(flags, color, z);
+}
+
+void RecordingRenderDevice::SetMatrix(Effect* effect, EffectHandle handle, const float* matrix)
+{
+	m_stats.effectParameters++;
+	m_stats.bytes += MATRIX_SIZE;
+	if (m_next != NULL) m_next->SetMatrix(effect, handle, matrix);
+}
+
+void RecordingRenderDevice::SetMatrixArray(Effect* effect, EffectHandle handle, const float* matrices, unsigned int count)
+{
+	m_stats.effectParameters++;
+	m_stats.bytes += count * MATRIX_SIZE;
+	if (m_next != NULL) m_next->SetMatrixArray(effect, handle, matrices, count);
+}
+
+void RecordingRenderDevice::SetVector(Effect* effect, EffectHandle handle, const float* vector)
+{
+	m_stats.effectParameters++;
+	m_stats.bytes += VECTOR_SIZE;
+	if (m_next != NULL) m_next->SetVector(effect, handle, vector);
+}
+
+void RecordingRenderDevice::SetFloat(Effect* effect, EffectHandle handle, float value)
+{
+	m_stats.effectParameters++;
+	m_stats.bytes += sizeof(float);
+	if (m_next != NULL) m_next->SetFloat(effect, handle, value);
+}
+
+void RecordingRenderDevice::SetEffectTexture(Effect* effect, EffectHandle handle, RenderTexture* texture)
+{
+	m_stats.effectParameters++;
+	if (m_next != NULL) m_next->SetEffectTexture(effect, handle, texture);
+}
+
+unsigned int RecordingRenderDevice::BeginEffect(Effect* effect)
+{
+	return (m_next != NULL) ? m_next->BeginEffect(effect) : 1;
+}
+
+void RecordingRenderDevice::BeginPass(Effect* effect, unsigned int pass)
+{
+	m_stats.effectPasses++;
+	if (m_next != NULL) m_next->BeginPass(effect, pass);
+}
+
+void RecordingRenderDevice::EndPass(Effect* effect)
+{
+	if (m_next != NULL) m_next->EndPass(effect);
+}
+
+void RecordingRenderDevice::EndEffect(Effect* effect)
+{
+	if (m_next != NULL) m_next->EndEffect(effect);
+}
+
+void RecordingRenderDevice::DrawPrimitiveUP(PrimitiveType type, unsigned int count, const void* vertices, unsigned int stride)
+{
+	unsigned int numVertices = GetNumVertices(type, count);
+	m_stats.draws++;
+	m_stats.primitives += count;
+	m_stats.vertices   += numVertices;
+	m_stats.bytes      += numVertices * stride;
+	if (m_next != NULL) m_next->DrawPrimitiveUP(type, count, vertices, stride);
+}
+
+void RecordingRenderDevice::DrawIndexedPrimitiveUP(PrimitiveType type, unsigned int numVertices, unsigned int count, const uint16_t* indices, const void* vertices, unsigned int stride)
+{
+	m_stats.draws++;
+	m_stats.primitives += count;
+	m_stats.vertices   += numVertices;
+	m_stats.bytes      += numVertices * stride + GetNumVertices(type, count) * sizeof(uint16_t);
+	if (m_next != NULL) m_next->DrawIndexedPrimitiveUP(type, numVertices, count, indices, vertices, stride);
+}
+
+//
+// StateCacheRenderDevice
+//
+bool StateCacheRenderDevice::Filter(CachedState& state, uint32_t value)
+{
+	if (state.valid && state.value == value)
+	{
+		m_numFiltered++;
+		return true;
+	}
+	state.value = value;
+	state.valid = true;
+	return false;
+}
+
+void StateCacheRenderDevice::Invalidate()
+{
+	memset(m_states,        0, sizeof m_states);
+	memset(m_textures,      0, sizeof m_textures);
+	memset(m_texturesValid, 0, sizeof m_texturesValid);
+}
+
+void StateCacheRenderDevice::SetState(State state, uint32_t value)
+{
+	if (!Filter(m_states[state], value))
+	{
+		m_next->SetState(state, value);
+	}
+}
+
+// The device holds a reference to the bound texture, so its address can't be
+// reused for another texture while the cache remembers it
+void StateCacheRenderDevice::SetTexture(unsigned int stage, RenderTexture* texture)
+{
+	if (stage < MAX_STAGES)
+	{
+		if (m_texturesValid[stage] && m_textures[stage] == texture)
+		{
+			m_numFiltered++;
+			return;
+		}
+		m_textures[stage]      = texture;
+		m_texturesValid[stage] = true;
+	}
+	m_next->SetTexture(stage, texture);
+}
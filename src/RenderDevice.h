@@ -0,0 +1,259 @@
+#ifndef RENDERDEVICE_H
+#define RENDERDEVICE_H
+
+#include <stdint.h>
+#include <string.h>
+
+class Effect;
+
+// Resources, as the device that draws with them knows them. They're made by
+// the Direct3D device; D3D9RenderDevice.h converts them.
+struct RenderTexture;
+struct RenderSurface;
+struct RenderSwapChain;
+
+//
+// What the engine draws a frame with. Submitting a frame only goes through
+// here, so it can be sent to Direct3D, rasterized in software, recorded or
+// discarded. Creating resources and handling lost devices still go to the
+// Direct3D device directly.
+//
+// Nothing here depends on Direct3D, so the devices that don't draw build
+// without it. Matrices are 16 floats by rows and vectors are 4 floats, as in
+// D3DXMATRIX and D3DXVECTOR4; colors are 32-bit ARGB.
+//
+class IRenderDevice
+{
+public:
+	enum State
+	{
+		STATE_DEPTH_TEST,
+		STATE_DEPTH_WRITE,
+		STATE_BLEND,
+		STATE_SRC_BLEND,		// A BlendFactor
+		STATE_DEST_BLEND,		// A BlendFactor
+		NUM_STATES
+	};
+
+	enum BlendFactor
+	{
+		BLEND_ZERO,
+		BLEND_ONE,
+		BLEND_SRC_ALPHA,
+		BLEND_INV_SRC_ALPHA,
+		BLEND_DEST_COLOR,
+	};
+
+	enum Transform
+	{
+		TRANSFORM_VIEW,
+		TRANSFORM_PROJECTION,
+		TRANSFORM_TEXTURE0,
+		NUM_TRANSFORMS
+	};
+
+	enum PrimitiveType
+	{
+		TRIANGLE_LIST,
+		TRIANGLE_STRIP,
+	};
+
+	// Clear flags
+	static const unsigned int CLEAR_TARGET = 1;
+	static const unsigned int CLEAR_DEPTH  = 2;
+
+	// Effect parameters, by handle or name
+	typedef const char* EffectHandle;
+
+	// Frames; a NULL swap chain presents the device's own
+	virtual void BeginScene() = 0;
+	virtual void EndScene() = 0;
+	virtual void Present(RenderSwapChain* swapChain) = 0;
+
+	// Device state
+	virtual void SetState(State state, uint32_t value) = 0;
+	virtual void SetTransform(Transform transform, const float* matrix) = 0;
+	virtual void SetTexture(unsigned int stage, RenderTexture* texture) = 0;
+	virtual void SetRenderTarget(unsigned int index, RenderSurface* surface) = 0;
+	virtual void SetDepthStencilSurface(RenderSurface* surface) = 0;
+	virtual void Clear(unsigned int flags, uint32_t color, float z) = 0;
+
+	// Effect parameters
+	virtual void SetMatrix(Effect* effect, EffectHandle handle, const float* matrix) = 0;
+	virtual void SetMatrixArray(Effect* effect, EffectHandle handle, const float* matrices, unsigned int count) = 0;
+	virtual void SetVector(Effect* effect, EffectHandle handle, const float* vector) = 0;
+	virtual void SetFloat(Effect* effect, EffectHandle handle, float value) = 0;
+	virtual void SetEffectTexture(Effect* effect, EffectHandle handle, RenderTexture* texture) = 0;
+
+	// Returns the number of passes
+	virtual unsigned int BeginEffect(Effect* effect) = 0;
+	virtual void BeginPass(Effect* effect, unsigned int pass) = 0;
+	virtual void EndPass(Effect* effect) = 0;
+	virtual void EndEffect(Effect* effect) = 0;
+
+	// Drawing from user memory
+	virtual void DrawPrimitiveUP(PrimitiveType type, unsigned int count, const void* vertices, unsigned int stride) = 0;
+	virtual void DrawIndexedPrimitiveUP(PrimitiveType type, unsigned int numVertices, unsigned int count, const uint16_t* indices, const void* vertices, unsigned int stride) = 0;
+
+	virtual ~IRenderDevice() {}
+};
+
+//
+// Discards everything; effects have a single pass
+//
+class NullRenderDevice : public IRenderDevice
+{
+public:
+	void BeginScene() {}
+	void EndScene() {}
+	void Present(RenderSwapChain*) {}
+
+	void SetState(State, uint32_t) {}
+	void SetTransform(Transform, const float*) {}
+	void SetTexture(unsigned int, RenderTexture*) {}
+	void SetRenderTarget(unsigned int, RenderSurface*) {}
+	void SetDepthStencilSurface(RenderSurface*) {}
+	void Clear(unsigned int, uint32_t, float) {}
+
+	void SetMatrix(Effect*, EffectHandle, const float*) {}
+	void SetMatrixArray(Effect*, EffectHandle, const float*, unsigned int) {}
+	void SetVector(Effect*, EffectHandle, const float*) {}
+	void SetFloat(Effect*, EffectHandle, float) {}
+	void SetEffectTexture(Effect*, EffectHandle, RenderTexture*) {}
+
+	unsigned int BeginEffect(Effect*) { return 1; }
+	void BeginPass(Effect*, unsigned int) {}
+	void EndPass(Effect*) {}
+	void EndEffect(Effect*) {}
+
+	void DrawPrimitiveUP(PrimitiveType, unsigned int, const void*, unsigned int) {}
+	void DrawIndexedPrimitiveUP(PrimitiveType, unsigned int, unsigned int, const uint16_t*, const void*, unsigned int) {}
+};
+
+// What was submitted, as counted by a RecordingRenderDevice
+struct RenderStats
+{
+	unsigned long scenes;
+	unsigned long draws;
+	unsigned long primitives;
+	unsigned long vertices;
+	unsigned long stateChanges;			// States and transforms
+	unsigned long textureChanges;
+	unsigned long targetChanges;		// Render targets and depth buffers
+	unsigned long clears;
+	unsigned long effectParameters;
+	unsigned long effectPasses;
+	unsigned long bytes;				// Vertices, indices and effect parameters
+
+	void Reset() { memset(this, 0, sizeof *this); }
+	RenderStats() { Reset(); }
+};
+
+//
+// Counts what is submitted, and passes it on to another device, if any
+//
+class RecordingRenderDevice : public IRenderDevice
+{
+	IRenderDevice* m_next;
+	RenderStats    m_stats;
+
+public:
+	const RenderStats& GetStats() const { return m_stats; }
+	void               ResetStats()     { m_stats.Reset(); }
+	IRenderDevice*     GetNext() const  { return m_next; }
+
+	void BeginScene();
+	void EndScene();
+	void Present(RenderSwapChain* swapChain);
+
+	void SetState(State state, uint32_t value);
+	void SetTransform(Transform transform, const float* matrix);
+	void SetTexture(unsigned int stage, RenderTexture* texture);
+	void SetRenderTarget(unsigned int index, RenderSurface* surface);
+	void SetDepthStencilSurface(RenderSurface* surface);
+	void Clear(unsigned int flags, uint32_t color, float z);
+
+	void SetMatrix(Effect* effect, EffectHandle handle, const float* matrix);
+	void SetMatrixArray(Effect* effect, EffectHandle handle, const float* matrices, unsigned int count);
+	void SetVector(Effect* effect, EffectHandle handle, const float* vector);
+	void SetFloat(Effect* effect, EffectHandle handle, float value);
+	void SetEffectTexture(Effect* effect, EffectHandle handle, RenderTexture* texture);
+
+	unsigned int BeginEffect(Effect* effect);
+	void BeginPass(Effect* effect, unsigned int pass);
+	void EndPass(Effect* effect);
+	void EndEffect(Effect* effect);
+
+	void DrawPrimitiveUP(PrimitiveType type, unsigned int count, const void* vertices, unsigned int stride);
+	void DrawIndexedPrimitiveUP(PrimitiveType type, unsigned int numVertices, unsigned int count, const uint16_t* indices, const void* vertices, unsigned int stride);
+
+	RecordingRenderDevice(IRenderDevice* next = NULL) : m_next(next) {}
+};
+
+//
+// Remembers the states and textures set through it, and drops calls that
+// would set them to what they already are. Everything else is passed on. The
+// device state must not be changed behind its back, except by effects, which
+// restore it when they end.
+//
+class StateCacheRenderDevice : public IRenderDevice
+{
+	static const unsigned int MAX_STAGES = 8;
+
+	// A value and whether it's known
+	struct CachedState
+	{
+		uint32_t value;
+		bool     valid;
+	};
+
+	IRenderDevice* m_next;
+	CachedState    m_states[NUM_STATES];
+	RenderTexture* m_textures[MAX_STAGES];
+	bool           m_texturesValid[MAX_STAGES];
+	unsigned long  m_numFiltered;
+
+	bool Filter(CachedState& state, uint32_t value);
+
+public:
+	// Forgets all state, e.g. after the device was reset
+	void           Invalidate();
+	IRenderDevice* GetNext() const { return m_next; }
+	void           SetNext(IRenderDevice* next) { m_next = next; Invalidate(); }
+
+	// Number of calls dropped since the last reset
+	unsigned long  GetNumFiltered() const { return m_numFiltered; }
+	void           ResetNumFiltered()     { m_numFiltered = 0; }
+
+	void BeginScene()                          { m_next->BeginScene(); }
+	void EndScene()                            { m_next->EndScene(); }
+	void Present(RenderSwapChain* swapChain)   { m_next->Present(swapChain); }
+
+	void SetState(State state, uint32_t value);
+	void SetTransform(Transform transform, const float* matrix)            { m_next->SetTransform(transform, matrix); }
+	void SetTexture(unsigned int stage, RenderTexture* texture);
+	void SetRenderTarget(unsigned int index, RenderSurface* surface)       { m_next->SetRenderTarget(index, surface); }
+	void SetDepthStencilSurface(RenderSurface* surface)                    { m_next->SetDepthStencilSurface(surface); }
+	void Clear(unsigned int flags, uint32_t color, float z)                { m_next->Clear(flags, color, z); }
+
+	void SetMatrix(Effect* effect, EffectHandle handle, const float* matrix)                          { m_next->SetMatrix(effect, handle, matrix); }
+	void SetMatrixArray(Effect* effect, EffectHandle handle, const float* matrices, unsigned int count) { m_next->SetMatrixArray(effect, handle, matrices, count); }
+	void SetVector(Effect* effect, EffectHandle handle, const float* vector)                          { m_next->SetVector(effect, handle, vector); }
+	void SetFloat(Effect* effect, EffectHandle handle, float value)                                   { m_next->SetFloat(effect, handle, value); }
+	void SetEffectTexture(Effect* effect, EffectHandle handle, RenderTexture* texture)                { m_next->SetEffectTexture(effect, handle, texture); }
+
+	unsigned int BeginEffect(Effect* effect)          { return m_next->BeginEffect(effect); }
+	void BeginPass(Effect* effect, unsigned int pass) { m_next->BeginPass(effect, pass); }
+	void EndPass(Effect* effect)                      { m_next->EndPass(effect); }
+	void EndEffect(Effect* effect)                    { m_next->EndEffect(effect); }
+
+	void DrawPrimitiveUP(PrimitiveType type, unsigned int count, const void* vertices, unsigned int stride) { m_next->DrawPrimitiveUP(type, count, vertices, stride); }
+	void DrawIndexedPrimitiveUP(PrimitiveType type, unsigned int numVertices, unsigned int count, const uint16_t* indices, const void* vertices, unsigned int stride)
+	{
+		m_next->DrawIndexedPrimitiveUP(type, numVertices, count, indices, vertices, stride);
+	}
+
+	StateCacheRenderDevice(IRenderDevice* next) : m_next(next), m_numFiltered(0) { Invalidate(); }
+};
+
+#endif
@@ -0,0 +1,226 @@
+#include "RenderGraph.h"
+using namespace std;
+
+// How a pass is run
+enum PassMode
+{
+	PASS_CULLED,
+	PASS_CLEAR,		// Its output is read, but it has no work
+	PASS_RUN,
+};
+
+void RenderGraph::Clear()
+{
+	m_passes.clear();
+	m_targets.clear();
+	AddTarget();	// SCREEN
+}
+
+RenderGraph::Target RenderGraph::AddTarget()
+{
+	TargetInfo target = {-1, 0, -1, NULL};
+	m_targets.push_back(target);
+	return (Target)m_targets.size() - 1;
+}
+
+void RenderGraph::AddPass(const Pass& pass)
+{
+	m_passes.push_back(pass);
+}
+
+void RenderGraph::Compile()
+{
+	m_modes.assign(m_passes.size(), PASS_RUN);
+	vector<bool> drawn(m_targets.size(), false);
+	for (size_t i = 0; i < m_passes.size(); i++)
+	{
+		if (m_passes[i].hasWork)
+		{
+			for (size_t j = 0; j < m_passes[i].inputs.size(); j++)
+			{
+				m_targets[m_passes[i].inputs[j]].numReaders++;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < m_passes.size(); i++)
+	{
+		Pass& pass = m_passes[i];
+		if (!pass.hasWork)
+		{
+			m_modes[i] = PASS_CLEAR;
+			m_targets[pass.output].writer = (int)i;
+			continue;
+		}
+
+		if (pass.copies != NONE)
+		{
+			// If only the copied input was drawn, and this is its only reader,
+			// the pass that draws it can draw into this pass' output instead
+			bool onlyCopies = drawn[pass.copies];
+			for (size_t j = 0; j < pass.inputs.size(); j++)
+			{
+				onlyCopies = onlyCopies && (pass.inputs[j] == pass.copies || !drawn[pass.inputs[j]]);
+			}
+
+			TargetInfo& source = m_targets[pass.copies];
+			if (onlyCopies && source.numReaders == 1)
+			{
+				m_passes[source.writer].output = pass.output;
+				m_targets[pass.output].writer  = source.writer;
+				drawn[pass.output] = true;
+				source.writer = -1;
+				for (size_t j = 0; j < pass.inputs.size(); j++)
+				{
+					m_targets[pass.inputs[j]].numReaders--;
+				}
+				m_modes[i] = PASS_CULLED;
+				continue;
+			}
+		}
+
+		m_targets[pass.output].writer = (int)i;
+		drawn[pass.output] = true;
+	}
+
+	// Cull the passes whose output isn't needed, from the screen back
+	vector<bool> needed(m_targets.size(), false);
+	needed[SCREEN] = true;
+	for (size_t i = m_passes.size(); i-- > 0; )
+	{
+		const Pass& pass = m_passes[i];
+		if (m_modes[i] != PASS_CULLED && !needed[pass.output])
+		{
+			m_modes[i] = PASS_CULLED;
+		}
+		if (m_modes[i] == PASS_RUN)
+		{
+			for (size_t j = 0; j < pass.inputs.size(); j++)
+			{
+				needed[pass.inputs[j]] = true;
+			}
+		}
+	}
+
+	// When each target's texture can go back to the pool
+	for (size_t i = 0; i < m_passes.size(); i++)
+	{
+		if (m_modes[i] == PASS_RUN)
+		{
+			for (size_t j = 0; j < m_passes[i].inputs.size(); j++)
+			{
+				m_targets[m_passes[i].inputs[j]].lastReader = (int)i;
+			}
+		}
+	}
+}
+
+IDirect3DTexture9* RenderGraph::AcquireTexture(IDirect3DDevice9* pDevice, UINT width, UINT height)
+{
+	if (!m_pool.empty())
+	{
+		IDirect3DTexture9* pTexture = m_pool.back();
+		m_pool.pop_back();
+		return pTexture;
+	}
+
+	IDirect3DTexture9* pTexture = NULL;
+	if (FAILED(pDevice->CreateTexture(width, height, 1, D3DUSAGE_RENDERTARGET, D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT, &pTexture, NULL)))
+	{
+		return NULL;
+	}
+	m_textures.push_back(pTexture);
+	return pTexture;
+}
+
+int RenderGraph::Execute(IDirect3DDevice9* pDevice, IRenderDevice* device, IDirect3DSurface9* pScreen, IDirect3DSurface9* pScreenDepth, IDirect3DSurface9* pTransientDepth)
+{
+	Compile();
+
+	D3DSURFACE_DESC desc;
+	pScreen->GetDesc(&desc);
+
+	int nPasses = 0;
+	for (size_t i = 0; i < m_passes.size(); i++)
+	{
+		if (m_modes[i] == PASS_CULLED)
+		{
+			continue;
+		}
+
+		const Pass&        pass   = m_passes[i];
+		TargetInfo&        output = m_targets[pass.output];
+		IDirect3DSurface9* pSurface;
+		IDirect3DSurface9* pDepth;
+		if (pass.output == SCREEN)
+		{
+			pSurface = pScreen;
+			pDepth   = pScreenDepth;
+			pSurface->AddRef();
+		}
+		else
+		{
+			if (output.texture == NULL && (output.texture = AcquireTexture(pDevice, desc.Width, desc.Height)) == NULL)
+			{
+				// Out of video memory; readers get no texture
+				continue;
+			}
+			output.texture->GetSurfaceLevel(0, &pSurface);
+			pDepth = pTransientDepth;
+		}
+
+		device->SetRenderTarget(0, ToRenderSurface(pSurface));
+		device->SetDepthStencilSurface(ToRenderSurface(pDepth));
+		SAFE_RELEASE(pSurface);
+		if (pass.clearFlags != 0)
+		{
+			device->Clear(pass.clearFlags, pass.clearColor, pass.clearZ);
+		}
+		if (m_modes[i] == PASS_RUN)
+		{
+			pass.execute(device);
+		}
+		nPasses++;
+
+		// Return the textures that are no longer read
+		for (size_t j = 0; j < pass.inputs.size(); j++)
+		{
+			TargetInfo& input = m_targets[pass.inputs[j]];
+			if (m_modes[i] == PASS_RUN && input.lastReader == (int)i && input.texture != NULL)
+			{
+				m_pool.push_back(input.texture);
+				input.texture = NULL;
+			}
+		}
+		if (output.texture != NULL && output.lastReader <= (int)i)
+		{
+			m_pool.push_back(output.texture);
+			output.texture = NULL;
+		}
+	}
+	return nPasses;
+}
+
+IDirect3DTexture9* RenderGraph::GetTexture(Target target) const
+{
+	return m_targets[target].texture;
+}
+
+void RenderGraph::ReleaseTargets()
+{
+	for (size_t i = 0; i < m_textures.size(); i++)
+	{
+		SAFE_RELEASE(m_textures[i]);
+	}
+	for (size_t i = 0; i < m_targets.size(); i++)
+	{
+		m_targets[i].texture = NULL;
+	}
+	m_textures.clear();
+	m_pool.clear();
+}
+
+RenderGraph::~RenderGraph()
+{
+	ReleaseTargets();
+}
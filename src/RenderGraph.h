@@ -0,0 +1,85 @@
+#ifndef RENDERGRAPH_H
+#define RENDERGRAPH_H
+
+#include "D3D9RenderDevice.h"
+#include <functional>
+#include <vector>
+
+//
+// The passes of a frame, with the render targets they draw into and read.
+// Passes run in the order they were added, so a pass must be added after the
+// passes that draw its inputs. Before running, the graph
+//
+//  - culls passes without work, and passes whose output is never used;
+//  - collapses a pass that would only copy one of its inputs, because its
+//    other inputs were not drawn, by drawing that input straight into its
+//    output instead;
+//  - gives each transient target a texture from a pool, from the pass that
+//    first draws it until the pass that last reads it.
+//
+// Transient targets are screen-sized A8R8G8B8 textures and share one depth
+// buffer. The pool keeps its textures across frames until ReleaseTargets.
+//
+class RenderGraph
+{
+public:
+	typedef int Target;
+	static const Target NONE   = -1;
+	static const Target SCREEN = 0;		// The back buffer and its depth buffer
+
+	typedef std::function<void (IRenderDevice* device)> Callback;
+
+	struct Pass
+	{
+		const char*         name;
+		Target              output;
+		std::vector<Target> inputs;
+		Target              copies;		// Input the pass only copies when its other inputs weren't drawn, or NONE
+		bool                hasWork;	// Passes without work only clear their output, if it is read
+		unsigned int        clearFlags;	// IRenderDevice::CLEAR_*
+		uint32_t            clearColor;
+		float               clearZ;
+		Callback            execute;
+	};
+
+	// Starts a new frame; a graph is run once
+	void   Clear();
+	Target AddTarget();
+	void   AddPass(const Pass& pass);
+
+	// Runs the passes that are needed. Returns the number of passes run.
+	int    Execute(IDirect3DDevice9* pDevice, IRenderDevice* device, IDirect3DSurface9* pScreen, IDirect3DSurface9* pScreenDepth, IDirect3DSurface9* pTransientDepth);
+
+	// The texture of a target, while a pass that reads or draws it runs
+	IDirect3DTexture9* GetTexture(Target target) const;
+
+	// Releases the pooled textures, e.g. before resetting the device
+	void   ReleaseTargets();
+
+	RenderGraph() { Clear(); }
+	~RenderGraph();
+
+private:
+	struct TargetInfo
+	{
+		int                writer;		// Pass that draws it, or -1
+		int                numReaders;
+		int                lastReader;
+		IDirect3DTexture9* texture;
+	};
+
+	void Compile();
+	IDirect3DTexture9* AcquireTexture(IDirect3DDevice9* pDevice, UINT width, UINT height);
+
+	std::vector<Pass>               m_passes;
+	std::vector<int>                m_modes;		// How each pass is run
+	std::vector<TargetInfo>         m_targets;
+	std::vector<IDirect3DTexture9*> m_pool;			// Free textures
+	std::vector<IDirect3DTexture9*> m_textures;		// All textures
+
+	// No copying
+	RenderGraph(const RenderGraph&);
+	RenderGraph& operator=(const RenderGraph&);
+};
+
+#endif
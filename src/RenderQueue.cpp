@@ -0,0 +1,123 @@
+#include "RenderQueue.h"
+#include "ParticleSystem.h"
+#include <algorithm>
+#include <string.h>
+using namespace std;
+
+//
+// Key layout, from the most significant bit down:
+//
+//   63-62  pass
+//   61-60  layer
+//
+// then, for the opaque layer, which is grouped by state:
+//
+//   59-56  blend mode
+//   55     depth test disabled
+//   54-40  texture id
+//   39-24  depth bucket, front to back
+//
+// and for the sorted layer, which must be drawn back to front:
+//
+//   59-44  depth bucket, back to front
+//
+// The rest is zero. The sort is stable, so emitters with equal keys are drawn
+// in the order they were submitted; in the sorted layer this keeps the
+// emitters of one particle system in their own order. Grouping by state puts
+// emitters that can be drawn in one batch next to each other.
+//
+// Additive and multiplicative emitters don't depend on the order among
+// themselves, but they do against alpha blended ones: one behind smoke must
+// be drawn before it. So every blended emitter is in the sorted layer, where
+// depth ranks above state, and only the neighbours that happen to share
+// their state get batched.
+//
+enum Layer
+{
+	LAYER_OPAQUE,		// Depth-tested, order doesn't matter
+	LAYER_SORTED,		// Blended; back to front
+};
+
+static Layer GetLayer(RenderQueue::Pass pass, int blendMode)
+{
+	if (pass == RenderQueue::PASS_NORMAL && blendMode == ParticleSystem::BLEND_NONE)
+	{
+		return LAYER_OPAQUE;
+	}
+	// Everything else, heat included, is blended in a way that depends on order
+	return LAYER_SORTED;
+}
+
+// Quantizes a depth to 16 bits. The top bits of a positive float increase
+// with its value, so this keeps about 1% relative precision at any distance.
+static uint64_t GetDepthBucket(float depth)
+{
+	depth = max(depth, 0.0f);
+	uint32_t bits;
+	memcpy(&bits, &depth, sizeof bits);
+	return bits >> 15;
+}
+
+uint64_t RenderQueue::MakeKey(Pass pass, int blendMode, bool depthTest, IDirect3DTexture9* colorTexture, IDirect3DTexture9* normalTexture, float depth)
+{
+	Layer    layer = GetLayer(pass, blendMode);
+	uint64_t key   = ((uint64_t)pass << 62) | ((uint64_t)layer << 60);
+	if (layer == LAYER_SORTED)
+	{
+		return key | ((0xFFFF - GetDepthBucket(depth)) << 44);
+	}
+
+	TextureIdMap::const_iterator p = m_textureIds.insert(make_pair(TexturePair(colorTexture, normalTexture), (unsigned int)m_textureIds.size())).first;
+	return key | ((uint64_t)(blendMode & 0xF) << 56) | ((uint64_t)!depthTest << 55) | ((uint64_t)(p->second & 0x7FFF) << 40) | (GetDepthBucket(depth) << 24);
+}
+
+void RenderQueue::Submit(uint64_t key, EmitterInstance* emitter)
+{
+	Item item = {key, emitter};
+	m_items.push_back(item);
+}
+
+// Sorts the items by key with an LSD radix sort, one byte per pass.
+// Bytes that are the same in all keys are skipped.
+void RenderQueue::Sort()
+{
+	m_scratch.resize(m_items.size());
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		size_t offsets[256] = {0};
+		for (size_t i = 0; i < m_items.size(); i++)
+		{
+			offsets[(m_items[i].key >> shift) & 0xFF]++;
+		}
+
+		if (m_items.empty() || offsets[(m_items[0].key >> shift) & 0xFF] == m_items.size())
+		{
+			continue;
+		}
+
+		for (size_t i = 0, sum = 0; i < 256; i++)
+		{
+			size_t count = offsets[i];
+			offsets[i] = sum;
+			sum += count;
+		}
+
+		for (size_t i = 0; i < m_items.size(); i++)
+		{
+			m_scratch[offsets[(m_items[i].key >> shift) & 0xFF]++] = m_items[i];
+		}
+		m_items.swap(m_scratch);
+	}
+}
+
+size_t RenderQueue::GetFirstItem(Pass pass) const
+{
+	uint64_t key = (uint64_t)pass << 62;
+	return lower_bound(m_items.begin(), m_items.end(), key, [](const Item& item, uint64_t key) { return item.key < key; }) - m_items.begin();
+}
+
+void RenderQueue::Clear()
+{
+	m_items.clear();
+	m_textureIds.clear();
+}
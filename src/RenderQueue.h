@@ -0,0 +1,54 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include "types.h"
+#include <vector>
+#include <map>
+
+class EmitterInstance;
+
+//
+// The emitters to draw in a frame, ordered by a 64-bit sort key.
+// Emitters submit themselves each frame; the queue is sorted once and then
+// drawn front to back, so the key decides both correctness and state changes.
+//
+class RenderQueue
+{
+public:
+	enum Pass
+	{
+		PASS_NORMAL,	// Drawn into the scene texture
+		PASS_HEAT,		// Drawn into the distortion texture
+	};
+
+	struct Item
+	{
+		uint64_t         key;
+		EmitterInstance* emitter;
+	};
+
+	// Builds the key of an emitter. The depth is the view-space distance of
+	// whatever the emitter belongs to; larger is further away.
+	uint64_t MakeKey(Pass pass, int blendMode, bool depthTest, IDirect3DTexture9* colorTexture, IDirect3DTexture9* normalTexture, float depth);
+
+	static Pass GetPass(uint64_t key) { return (Pass)(key >> 62); }
+
+	// Index of the first item of a pass, or where it would be; once sorted
+	size_t GetFirstItem(Pass pass) const;
+
+	void Submit(uint64_t key, EmitterInstance* emitter);
+	void Sort();
+	void Clear();
+
+	const std::vector<Item>& GetItems() const { return m_items; }
+
+private:
+	typedef std::pair<IDirect3DTexture9*, IDirect3DTexture9*> TexturePair;
+	typedef std::map<TexturePair, unsigned int> TextureIdMap;
+
+	std::vector<Item> m_items;
+	std::vector<Item> m_scratch;
+	TextureIdMap      m_textureIds;		// Numbered as they're first seen in a frame
+};
+
+#endif
@@ -57,6 +57,7 @@
 #define IDD_RESCALE_SYSTEM              141
 #define IDS_TOOLTIP_KEYS_DELETE         141
 #define IDD_RESCALE_EMITTER             142
+#define IDD_PARTICLE_BUDGET             143
 #define IDS_TOOLTIP_INTERPOLATE_LINEAR  142
 #define IDS_TOOLTIP_INTERPOLATE_SMOOTH  143
 #define IDS_TOOLTIP_INTERPOLATE_STEP    144
@@ -95,6 +96,12 @@
 #define IDS_ERROR_EMITTER_PASTE         177
 #define IDS_EXPAT_COPYRIGHT             178
 #define IDS_DISCLAIMER                  179
+#define IDS_FILES_OBJ                   180
+#define IDS_FILES_ATLAS                 181
+#define IDS_FILES_TGA                   182
+#define IDS_STATUS_BUDGET               183
+#define IDS_STATUS_NO_BUDGET            184
+#define IDS_TITLE_VIEW                  185
 #define IDC_EDIT1                       1005
 #define IDC_EDIT2                       1006
 #define IDC_BUTTON1                     1007
@@ -193,6 +200,17 @@
 #define ID_TOGGLE_EMITTER_VISIBILITY    40079
 #define ID_SHOW_ALL_EMITTERS            40084
 #define ID_HIDE_ALL_EMITTERS            40085
+#define ID_VIEW_PIPELINED               40086
+#define ID_VIEW_LOD                     40087
+#define ID_EMITTERS_LOADMESH            40088
+#define ID_EMITTERS_CLEARMESH           40089
+#define ID_EMITTER_SORTPARTICLES        40090
+#define ID_VIEW_LOADATLAS               40091
+#define ID_VIEW_CLEARATLAS              40092
+#define ID_VIEW_REFERENCEIMAGE          40093
+#define ID_VIEW_PARTICLEBUDGET          40094
+#define ID_VIEW_NEWVIEW                 40095
+#define ID_EDIT_SPAWNGRID               40096
 
 // Next default values for new objects
 // 
@@ -0,0 +1,54 @@
+#include "Simulation.h"
+using namespace std;
+
+const TimeF FixedStepSimulation::STEP    = 1.0f / 60;
+const float FixedStepSimulation::SPACING = 100.0f;
+
+void GetGridPositions(size_t count, float spacing, const D3DXVECTOR3& center, vector<D3DXVECTOR3>& positions)
+{
+	size_t columns = 1;
+	while (columns * columns < count)
+	{
+		columns++;
+	}
+	const size_t rows = (count + columns - 1) / columns;
+
+	positions.clear();
+	positions.reserve(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		positions.push_back(center + D3DXVECTOR3(
+			((i % columns) - (columns - 1) * 0.5f) * spacing,
+			((i / columns) - (rows    - 1) * 0.5f) * spacing, 0));
+	}
+}
+
+void FixedStepSimulation::StepTo(TimeF time)
+{
+	do
+	{
+		m_time = min(m_time + STEP, time);
+		SetTimeF(m_time);
+		m_engine.Update();
+	} while (m_time < time);
+}
+
+FixedStepSimulation::FixedStepSimulation(Engine& engine, const ParticleSystem& system, const Engine::Camera& camera, unsigned int seed, size_t numInstances)
+	: m_engine(engine), m_time(0)
+{
+	srand(seed);
+	SetTimeF(0);
+	engine.Clear();
+	engine.SetPipelined(false);
+	engine.SetCamera(camera);
+	if (numInstances == 1)
+	{
+		engine.SpawnParticleSystem(system, NULL);
+	}
+	else
+	{
+		vector<D3DXVECTOR3> positions;
+		GetGridPositions(numInstances, SPACING, D3DXVECTOR3(0,0,0), positions);
+		engine.SpawnParticleSystems(system, positions.data(), positions.size());
+	}
+}
@@ -0,0 +1,39 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "engine.h"
+#include <vector>
+
+// Positions on the ground for a number of instances: rows of them, 'spacing'
+// apart, in a square centred on 'center'
+void GetGridPositions(size_t count, float spacing, const D3DXVECTOR3& center, std::vector<D3DXVECTOR3>& positions);
+
+//
+// Plays a particle system from its start at a fixed rate, for the modes that
+// render it offline. The same seed and frame times give the same particles,
+// however long the frames take to render.
+//
+class FixedStepSimulation
+{
+	Engine& m_engine;
+	TimeF   m_time;
+
+public:
+	// The simulation never steps further than this, however far apart the frames are
+	static const TimeF STEP;
+
+	// Updates the engine in steps until the time is reached
+	void  StepTo(TimeF time);
+	TimeF GetTime() const { return m_time; }
+
+	// Stops the clock (see SetTimeF), clears the engine, seeds the random
+	// numbers and spawns the system at the origin; several instances are
+	// spawned in a grid around it. Pipelining is turned off, so a render
+	// shows the last update.
+	FixedStepSimulation(Engine& engine, const ParticleSystem& system, const Engine::Camera& camera, unsigned int seed, size_t numInstances = 1);
+
+	// The distance between the instances of the grid
+	static const float SPACING;
+};
+
+#endif
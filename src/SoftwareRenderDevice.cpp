@@ -0,0 +1,367 @@
+#include "SoftwareRenderDevice.h"
+#include "EmitterInstance.h"
+using namespace std;
+
+// How the particle shaders blend, by blend mode
+static const Rasterizer::Blend ShaderBlends[Engine::NUM_SHADERS] = {
+	Rasterizer::BLEND_OPAQUE,	// BLEND_NONE
+	Rasterizer::BLEND_ADDITIVE,	// BLEND_ADDITIVE
+	Rasterizer::BLEND_ALPHA,	// BLEND_TRANSPARENT
+	Rasterizer::BLEND_MODULATE,	// BLEND_INVERSE
+	Rasterizer::BLEND_ADDITIVE,	// BLEND_DEPTH_ADDITIVE
+	Rasterizer::BLEND_ALPHA,	// BLEND_DEPTH_TRANSPARENT
+	Rasterizer::BLEND_MODULATE,	// BLEND_DEPTH_INVERSE
+	Rasterizer::BLEND_ALPHA,	// BLEND_DIFFUSE_TRANSPARENT
+	Rasterizer::BLEND_DARKEN,	// BLEND_STENCIL_DARKEN
+	Rasterizer::BLEND_DARKEN,	// BLEND_STENCIL_DARKEN_BLUR
+	Rasterizer::BLEND_ALPHA,	// BLEND_HEAT
+	Rasterizer::BLEND_ALPHA,	// BLEND_BUMP
+	Rasterizer::BLEND_ALPHA,	// BLEND_DECAL_BUMP
+	Rasterizer::BLEND_ALPHA,	// BLEND_SCANLINES
+};
+
+// As in SceneHeat.fx
+static const float DISTORTION_AMOUNT = 0.5f;
+
+static Rasterizer::Color ToColor(uint32_t color)
+{
+	Rasterizer::Color c = {
+		((color >> 16) & 0xFF) / 255.0f,
+		((color >>  8) & 0xFF) / 255.0f,
+		((color >>  0) & 0xFF) / 255.0f,
+		((color >> 24) & 0xFF) / 255.0f,
+	};
+	return c;
+}
+
+void SoftwareRenderDevice::SetState(State state, uint32_t value)
+{
+	m_states[state] = value;
+}
+
+void SoftwareRenderDevice::SetTexture(unsigned int stage, RenderTexture* texture)
+{
+	// Stage 1 has the normal map, which isn't used
+	if (stage == 0)
+	{
+		m_texture = ToD3D(texture);
+	}
+}
+
+void SoftwareRenderDevice::SetRenderTarget(unsigned int index, RenderSurface* target)
+{
+	if (index != 0)
+	{
+		return;
+	}
+
+	IDirect3DSurface9* surface = ToD3D(target);
+
+	m_target = NULL;
+	if (surface != NULL)
+	{
+		TargetMap::iterator p = m_targets.find(surface);
+		if (p == m_targets.end())
+		{
+			surface->AddRef();
+			p = m_targets.insert(make_pair(surface, new Rasterizer(m_numThreads))).first;
+		}
+
+		D3DSURFACE_DESC desc;
+		surface->GetDesc(&desc);
+		m_target = p->second;
+		if (m_target->GetWidth() != desc.Width || m_target->GetHeight() != desc.Height)
+		{
+			m_target->Resize(desc.Width, desc.Height);
+		}
+	}
+}
+
+void SoftwareRenderDevice::Clear(unsigned int flags, uint32_t color, float z)
+{
+	if (m_target != NULL)
+	{
+		m_target->Clear((flags & CLEAR_TARGET) != 0, (flags & CLEAR_DEPTH) != 0, ToColor(color), z);
+	}
+}
+
+void SoftwareRenderDevice::SetEffectTexture(Effect* effect, EffectHandle handle, RenderTexture* texture)
+{
+	// The composite sets its textures by name
+	if (GetShaderIndex(effect) < 0)
+	{
+		if (strcmp(handle, "SceneTexture")      == 0) m_sceneTexture   = ToD3D(texture);
+		if (strcmp(handle, "DistortionTexture") == 0) m_distortTexture = ToD3D(texture);
+	}
+}
+
+int SoftwareRenderDevice::GetShaderIndex(Effect* effect) const
+{
+	if (effect == NULL)
+	{
+		return -1;
+	}
+	for (int i = 0; i < Engine::NUM_SHADERS; i++)
+	{
+		if (m_engine.GetShader(i) == effect)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Returns the rasterizer that a render target texture was drawn with, if any
+Rasterizer* SoftwareRenderDevice::GetTarget(IDirect3DBaseTexture9* texture)
+{
+	if (texture == NULL || texture->GetType() != D3DRTYPE_TEXTURE)
+	{
+		return NULL;
+	}
+
+	IDirect3DSurface9* pSurface;
+	if (FAILED(static_cast<IDirect3DTexture9*>(texture)->GetSurfaceLevel(0, &pSurface)))
+	{
+		return NULL;
+	}
+	TargetMap::const_iterator p = m_targets.find(pSurface);
+	pSurface->Release();
+	return (p != m_targets.end()) ? p->second : NULL;
+}
+
+// Reads a texture back, the first time it's used. Textures that can't be
+// read are drawn white.
+const Image* SoftwareRenderDevice::GetImage(IDirect3DBaseTexture9* texture)
+{
+	if (texture == NULL)
+	{
+		return NULL;
+	}
+
+	ImageMap::const_iterator p = m_images.find(texture);
+	if (p != m_images.end())
+	{
+		return p->second;
+	}
+
+	Image* image = NULL;
+	IDirect3DTexture9* pTexture = static_cast<IDirect3DTexture9*>(texture);
+	D3DSURFACE_DESC    desc;
+	D3DLOCKED_RECT     rect;
+	if (texture->GetType() == D3DRTYPE_TEXTURE && SUCCEEDED(pTexture->GetLevelDesc(0, &desc)) &&
+		SUCCEEDED(pTexture->LockRect(0, &rect, NULL, D3DLOCK_READONLY)))
+	{
+		const uint8_t* bits = (const uint8_t*)rect.pBits;
+		if (desc.Format == D3DFMT_A8R8G8B8 || desc.Format == D3DFMT_X8R8G8B8)
+		{
+			image = new Image;
+			image->Resize(desc.Width, desc.Height);
+			for (UINT y = 0; y < desc.Height; y++)
+			{
+				const uint8_t* src = bits + y * rect.Pitch;
+				for (UINT x = 0; x < desc.Width; x++, src += 4)
+				{
+					Image::Pixel& pixel = (*image)(x, y);
+					pixel.b = src[0];
+					pixel.g = src[1];
+					pixel.r = src[2];
+					pixel.a = (desc.Format == D3DFMT_A8R8G8B8) ? src[3] : 255;
+				}
+			}
+		}
+		else if (Image::GetDXTBlockSize(desc.Format) != 0)
+		{
+			// The pitch is per row of blocks, which may be padded
+			size_t          rowSize = Image::GetDXTSize(desc.Format, desc.Width, 4);
+			UINT            numRows = (desc.Height + 3) / 4;
+			vector<uint8_t> blocks(rowSize * numRows);
+			for (UINT y = 0; y < numRows; y++)
+			{
+				memcpy(&blocks[y * rowSize], bits + y * rect.Pitch, rowSize);
+			}
+			image = new Image;
+			image->DecodeDXT(desc.Format, &blocks[0], desc.Width, desc.Height);
+		}
+		pTexture->UnlockRect(0);
+	}
+
+	texture->AddRef();
+	m_images.insert(make_pair(texture, image));
+	return image;
+}
+
+Rasterizer::State SoftwareRenderDevice::GetState()
+{
+	Rasterizer::State state = {GetImage(m_texture), Rasterizer::BLEND_OPAQUE, m_states[STATE_DEPTH_TEST] != FALSE, m_states[STATE_DEPTH_WRITE] != FALSE};
+	int shader = GetShaderIndex(m_effect);
+	if (shader >= 0)
+	{
+		// The shaders only write depth when they don't blend
+		state.blend      = ShaderBlends[shader];
+		state.depthWrite = (state.blend == Rasterizer::BLEND_OPAQUE);
+	}
+	else if (m_states[STATE_BLEND])
+	{
+		const uint32_t srcBlend  = m_states[STATE_SRC_BLEND];
+		const uint32_t destBlend = m_states[STATE_DEST_BLEND];
+		if (srcBlend == BLEND_ZERO)
+		{
+			state.blend = (destBlend == BLEND_INV_SRC_ALPHA) ? Rasterizer::BLEND_DARKEN : Rasterizer::BLEND_MODULATE;
+		}
+		else if (destBlend == BLEND_ONE)
+		{
+			state.blend = Rasterizer::BLEND_ADDITIVE;
+		}
+		else if (srcBlend == BLEND_DEST_COLOR)
+		{
+			state.blend = Rasterizer::BLEND_MODULATE;
+		}
+		else
+		{
+			state.blend = Rasterizer::BLEND_ALPHA;
+		}
+	}
+	return state;
+}
+
+// The heat composite distorts the scene with the heat, over the whole target
+void SoftwareRenderDevice::Composite()
+{
+	Rasterizer* scene = GetTarget(m_sceneTexture);
+	Rasterizer* heat  = GetTarget(m_distortTexture);
+	if (scene == NULL || scene == m_target)
+	{
+		return;
+	}
+
+	scene->Resolve(m_scene);
+	if (heat != NULL)
+	{
+		heat->Resolve(m_distortion);
+	}
+	else
+	{
+		// Undistorted
+		Image::Pixel neutral = {128, 128, 255, 255};
+		m_distortion.Resize(1, 1);
+		m_distortion(0, 0) = neutral;
+	}
+	m_target->Distort(m_scene, m_distortion, DISTORTION_AMOUNT);
+}
+
+void SoftwareRenderDevice::Draw(PrimitiveType type, unsigned int numVertices, unsigned int count, const uint16_t* indices, const void* vertices, unsigned int stride)
+{
+	if (m_target == NULL || count == 0)
+	{
+		return;
+	}
+
+	if (m_effect != NULL && GetShaderIndex(m_effect) < 0)
+	{
+		Composite();
+		return;
+	}
+
+	const D3DXMATRIX& m = m_engine.GetRenderView().viewProjection;
+	m_vertices.resize(numVertices);
+	for (UINT i = 0; i < numVertices; i++)
+	{
+		const EmitterInstance::Vertex& src = *(const EmitterInstance::Vertex*)((const char*)vertices + i * stride);
+		const D3DXVECTOR3& p = src.Position;
+		const Rasterizer::Color c = ToColor(src.Color);
+		Rasterizer::Vertex& v = m_vertices[i];
+		v.x = p.x * m._11 + p.y * m._21 + p.z * m._31 + m._41;
+		v.y = p.x * m._12 + p.y * m._22 + p.z * m._32 + m._42;
+		v.z = p.x * m._13 + p.y * m._23 + p.z * m._33 + m._43;
+		v.w = p.x * m._14 + p.y * m._24 + p.z * m._34 + m._44;
+		v.u = src.TexCoord0.x;
+		v.v = src.TexCoord0.y;
+		v.r = c.r; v.g = c.g; v.b = c.b; v.a = c.a;
+	}
+
+	// Turn lists without indices and strips into indexed lists
+	m_indices.resize(count * 3);
+	for (UINT i = 0; i < count; i++)
+	{
+		uint16_t* triangle = &m_indices[i * 3];
+		if (type == TRIANGLE_STRIP)
+		{
+			triangle[0] = (uint16_t)(i + 0);
+			triangle[1] = (uint16_t)(i + 1);
+			triangle[2] = (uint16_t)(i + 2);
+		}
+		else if (indices != NULL)
+		{
+			copy(&indices[i * 3], &indices[i * 3] + 3, triangle);
+		}
+		else
+		{
+			triangle[0] = (uint16_t)(i * 3 + 0);
+			triangle[1] = (uint16_t)(i * 3 + 1);
+			triangle[2] = (uint16_t)(i * 3 + 2);
+		}
+	}
+
+	m_target->DrawTriangles(GetState(), &m_vertices[0], &m_indices[0], count);
+}
+
+void SoftwareRenderDevice::DrawPrimitiveUP(PrimitiveType type, unsigned int count, const void* vertices, unsigned int stride)
+{
+	Draw(type, (type == TRIANGLE_STRIP) ? count + 2 : count * 3, count, NULL, vertices, stride);
+}
+
+void SoftwareRenderDevice::DrawIndexedPrimitiveUP(PrimitiveType type, unsigned int numVertices, unsigned int count, const uint16_t* indices, const void* vertices, unsigned int stride)
+{
+	if (type == TRIANGLE_LIST)
+	{
+		Draw(type, numVertices, count, indices, vertices, stride);
+	}
+}
+
+void SoftwareRenderDevice::Resolve(Image& image)
+{
+	if (m_target != NULL)
+	{
+		m_target->Resolve(image);
+	}
+	else
+	{
+		image.Resize(0, 0);
+	}
+}
+
+void SoftwareRenderDevice::Invalidate()
+{
+	for (TargetMap::iterator p = m_targets.begin(); p != m_targets.end(); ++p)
+	{
+		p->first->Release();
+		delete p->second;
+	}
+	for (ImageMap::iterator p = m_images.begin(); p != m_images.end(); ++p)
+	{
+		p->first->Release();
+		delete p->second;
+	}
+	m_targets.clear();
+	m_images.clear();
+	m_target         = NULL;
+	m_texture        = NULL;
+	m_sceneTexture   = NULL;
+	m_distortTexture = NULL;
+}
+
+SoftwareRenderDevice::SoftwareRenderDevice(const Engine& engine, unsigned int numThreads)
+	: m_engine(engine), m_numThreads(numThreads), m_target(NULL), m_texture(NULL), m_effect(NULL),
+	  m_sceneTexture(NULL), m_distortTexture(NULL)
+{
+	m_states[STATE_DEPTH_TEST]  = TRUE;
+	m_states[STATE_DEPTH_WRITE] = TRUE;
+	m_states[STATE_BLEND]       = FALSE;
+	m_states[STATE_SRC_BLEND]   = BLEND_ONE;
+	m_states[STATE_DEST_BLEND]  = BLEND_ZERO;
+}
+
+SoftwareRenderDevice::~SoftwareRenderDevice()
+{
+	Invalidate();
+}
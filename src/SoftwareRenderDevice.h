@@ -0,0 +1,89 @@
+#ifndef SOFTWARERENDERDEVICE_H
+#define SOFTWARERENDERDEVICE_H
+
+#include "D3D9RenderDevice.h"
+#include "../tools/common/Rasterizer.h"
+#include <map>
+
+class Engine;
+
+//
+// Draws the frame with the software rasterizer instead of Direct3D, for
+// rendering without a GPU and for reference images.
+//
+// The particle shaders are replaced by their blend equations, with the color
+// texture times the vertex color; lighting, bump maps and the texture
+// transform are ignored. Any other effect is taken to be the heat composite.
+// Each render target surface gets its own rasterizer, with its own depth.
+// Textures are read back once and kept until Invalidate, so they must be
+// lockable (managed) or render targets that were drawn through this device.
+//
+class SoftwareRenderDevice : public IRenderDevice
+{
+public:
+	// Renders what was drawn into the last render target, e.g. the screen
+	void Resolve(Image& image);
+
+	// Forgets the textures and targets, e.g. after textures were reloaded
+	void Invalidate();
+
+	void BeginScene() {}
+	void EndScene() {}
+	void Present(RenderSwapChain*) {}
+
+	void SetState(State state, uint32_t value);
+	void SetTransform(Transform, const float*) {}
+	void SetTexture(unsigned int stage, RenderTexture* texture);
+	void SetRenderTarget(unsigned int index, RenderSurface* surface);
+	void SetDepthStencilSurface(RenderSurface*) {}
+	void Clear(unsigned int flags, uint32_t color, float z);
+
+	void SetMatrix(Effect*, EffectHandle, const float*) {}
+	void SetMatrixArray(Effect*, EffectHandle, const float*, unsigned int) {}
+	void SetVector(Effect*, EffectHandle, const float*) {}
+	void SetFloat(Effect*, EffectHandle, float) {}
+	void SetEffectTexture(Effect* effect, EffectHandle handle, RenderTexture* texture);
+
+	unsigned int BeginEffect(Effect* effect) { m_effect = effect; return 1; }
+	void BeginPass(Effect*, unsigned int) {}
+	void EndPass(Effect*) {}
+	void EndEffect(Effect*)                  { m_effect = NULL; }
+
+	void DrawPrimitiveUP(PrimitiveType type, unsigned int count, const void* vertices, unsigned int stride);
+	void DrawIndexedPrimitiveUP(PrimitiveType type, unsigned int numVertices, unsigned int count, const uint16_t* indices, const void* vertices, unsigned int stride);
+
+	// 0 threads uses one per hardware thread
+	SoftwareRenderDevice(const Engine& engine, unsigned int numThreads = 0);
+	~SoftwareRenderDevice();
+
+private:
+	typedef std::map<IDirect3DSurface9*, Rasterizer*> TargetMap;
+	typedef std::map<IDirect3DBaseTexture9*, Image*>  ImageMap;
+
+	int          GetShaderIndex(Effect* effect) const;
+	Rasterizer*  GetTarget(IDirect3DBaseTexture9* texture);
+	const Image* GetImage(IDirect3DBaseTexture9* texture);
+	void         Draw(PrimitiveType type, unsigned int numVertices, unsigned int count, const uint16_t* indices, const void* vertices, unsigned int stride);
+	void         Composite();
+	Rasterizer::State GetState();
+
+	const Engine&                   m_engine;
+	unsigned int                    m_numThreads;
+	TargetMap                       m_targets;		// Surfaces are referenced while mapped
+	ImageMap                        m_images;		// Textures are referenced while mapped
+	Rasterizer*                     m_target;
+	IDirect3DBaseTexture9*          m_texture;
+	Effect*                         m_effect;
+	IDirect3DBaseTexture9*          m_sceneTexture;
+	IDirect3DBaseTexture9*          m_distortTexture;
+	uint32_t                        m_states[NUM_STATES];
+	std::vector<Rasterizer::Vertex> m_vertices;
+	std::vector<uint16_t>           m_indices;
+	Image                           m_scene, m_distortion;
+
+	// No copying
+	SoftwareRenderDevice(const SoftwareRenderDevice&);
+	SoftwareRenderDevice& operator=(const SoftwareRenderDevice&);
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include "TextureAtlas.h"
+#include "exceptions.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+using namespace std;
+
+static string ToUpper(string str)
+{
+	transform(str.begin(), str.end(), str.begin(), ::toupper);
+	return str;
+}
+
+bool TextureAtlas::Find(const string& texture, string& atlas, D3DXVECTOR4& rect) const
+{
+	EntryMap::const_iterator p = m_entries.find(ToUpper(texture));
+	if (p == m_entries.end())
+	{
+		return false;
+	}
+	atlas = m_atlases[p->second.atlas];
+	rect  = p->second.rect;
+	return true;
+}
+
+TextureAtlas::TextureAtlas(IFile* file, const string& directory)
+{
+	string text(file->size(), '\0');
+	if (!text.empty() && file->read(&text[0], (unsigned long)text.size()) != text.size())
+	{
+		throw ReadException();
+	}
+
+	// Names are quoted as by std::quoted; unquoted ones end at whitespace
+	vector<pair<unsigned int, unsigned int> > sizes;
+	istringstream lines(text);
+	string line;
+	while (getline(lines, line))
+	{
+		istringstream tokens(line);
+		string type;
+		tokens >> type;
+		if (type == "atlas")
+		{
+			string       name;
+			unsigned int width, height;
+			if (!(tokens >> quoted(name) >> width >> height) || width == 0 || height == 0)
+			{
+				throw BadFileException();
+			}
+			m_atlases.push_back(directory + name);
+			sizes.push_back(make_pair(width, height));
+		}
+		else if (type == "texture")
+		{
+			// Pixel positions; converted to texture coordinates with the atlas' size
+			string       name;
+			Entry        entry;
+			unsigned int x, y, width, height;
+			if (!(tokens >> quoted(name) >> entry.atlas >> x >> y >> width >> height) || entry.atlas >= sizes.size())
+			{
+				throw BadFileException();
+			}
+			float w = (float)sizes[entry.atlas].first;
+			float h = (float)sizes[entry.atlas].second;
+			entry.rect = D3DXVECTOR4(x / w, y / h, width / w, height / h);
+			m_entries[ToUpper(name)] = entry;
+		}
+		else if (!type.empty() && type[0] != '#')
+		{
+			throw BadFileException();
+		}
+	}
+}
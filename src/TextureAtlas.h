@@ -0,0 +1,36 @@
+#ifndef TEXTUREATLAS_H
+#define TEXTUREATLAS_H
+
+#include "types.h"
+#include "files.h"
+#include <map>
+#include <string>
+#include <vector>
+
+//
+// A remap table written by the AtlasPacker tool. It tells in which atlas, and
+// where in it, a color texture was packed.
+//
+class TextureAtlas : public RefCounted
+{
+	struct Entry
+	{
+		size_t      atlas;
+		D3DXVECTOR4 rect;
+	};
+	typedef std::map<std::string, Entry> EntryMap;
+
+	std::vector<std::string> m_atlases;		// Paths of the atlas textures
+	EntryMap                 m_entries;		// By upper-case texture name
+
+	~TextureAtlas() {}
+public:
+	// Finds a texture. The rect is the texture's offset (x, y) and size (z, w)
+	// within the atlas, in texture coordinates.
+	bool Find(const std::string& texture, std::string& atlas, D3DXVECTOR4& rect) const;
+
+	// Atlas files are relative to 'directory'
+	TextureAtlas(IFile* file, const std::string& directory);
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include "ParticleSystemInstance.h"
 #include "EmitterInstance.h"
 #include "SphericalHarmonics.h"
+#include "TextureAtlas.h"
 using namespace std;
 
 static const char* ShaderNames[Engine::NUM_SHADERS] = {
@@ -34,19 +35,41 @@ D3DVERTEXELEMENT9 Engine::ParticleElements[] = {
 	D3DDECL_END()
 };
 
+static bool  ClockStopped = false;
+static TimeF StoppedTime;
+
 TimeF GetTimeF()
 {
     static auto start = GetTickCount();
-    return (GetTickCount() - start) / 1000.0f;
+    return ClockStopped ? StoppedTime : (GetTickCount() - start) / 1000.0f;
 }
 
-ParticleSystemInstance* Engine::SpawnParticleSystem(const ParticleSystem& system, Object3D* parent)
+void SetTimeF(TimeF time)
 {
-	auto instance = std::make_unique<ParticleSystemInstance>(*this, system, parent);
+    ClockStopped = true;
+    StoppedTime  = time;
+}
+
+ParticleSystemInstance* Engine::SpawnParticleSystem(const ParticleSystem& system, Object3D* parent, EmissionMesh* mesh)
+{
+	auto instance = std::make_unique<ParticleSystemInstance>(*this, system, parent, mesh);
     m_instances.push_back(std::move(instance));
 	return m_instances.back().get();
 }
 
+void Engine::SpawnParticleSystems(const ParticleSystem& system, const D3DXVECTOR3* positions, size_t count, EmissionMesh* mesh)
+{
+	TimeF now = GetTimeF();
+	vector<size_t> roots;
+	ParticleSystemInstance::GetRootEmitters(system, roots);
+
+	m_instances.reserve(m_instances.size() + count);
+	for (size_t i = 0; i < count; i++)
+	{
+		m_instances.push_back(std::make_unique<ParticleSystemInstance>(*this, system, positions[i], now, roots, mesh));
+	}
+}
+
 void Engine::DetachParticleSystem(ParticleSystemInstance* instance)
 {
     instance->Detach();
@@ -77,12 +100,62 @@ void Engine::Clear()
 
 void Engine::Update()
 {
+	if (m_updatePending)
+	{
+		// The previous update never got rendered, finish it first
+		m_updatePending = false;
+		BeginUpdate(m_updateTime, false);
+		EndUpdate();
+	}
+
 	TimeF currentTime = GetTimeF();
+	if (m_pipelined)
+	{
+		// Simulated while the next Render submits the current frame
+		m_updateTime    = currentTime;
+		m_updatePending = true;
+	}
+	else
+	{
+		BeginUpdate(currentTime, false);
+		EndUpdate();
+	}
+}
+
+// Starts simulating the instances, either on the simulation thread or right here
+void Engine::BeginUpdate(TimeF currentTime, bool async)
+{
+	m_updateTime = currentTime;
+	m_numUpdates++;
+	m_simulated.clear();
+	for (auto& instance : m_instances)
+	{
+		m_simulated.push_back(instance.get());
+	}
+
+	if (async)
+	{
+		lock_guard<mutex> lock(m_simulationMutex);
+		m_simulating = true;
+		m_simulationCond.notify_all();
+	}
+	else
+	{
+		Simulate();
+	}
+}
+
+// Waits for the simulation to finish and completes the update
+void Engine::EndUpdate()
+{
+	{
+		unique_lock<mutex> lock(m_simulationMutex);
+		m_simulationCond.wait(lock, [this] { return !m_simulating; });
+	}
 
-    // Update existing instances
     for (auto it = m_instances.begin(); it != m_instances.end();)
     {
-        m_numParticles += (*it)->Update(currentTime);
+        m_numParticles += (*it)->Resolve(m_updateTime);
 
 		// Check if the instance is dead and nobody's referring to it anymore
 		if ((*it)->IsDead() && (*it)->Detached())
@@ -94,12 +167,127 @@ void Engine::Update()
 			++it;
 		}
     }
+
+	ApplyParticleBudget();
+}
+
+void Engine::SetLodLevels(const vector<LodLevel>& levels)
+{
+	m_lodLevels = levels;
+	sort(m_lodLevels.begin(), m_lodLevels.end(), [](const LodLevel& l1, const LodLevel& l2) {
+		return l1.distance < l2.distance;
+	});
+}
+
+// Returns the level of detail at a distance from the camera, or NULL for full detail
+const Engine::LodLevel* Engine::GetLodLevel(float distance) const
+{
+	const LodLevel* level = NULL;
+	for (size_t i = 0; i < m_lodLevels.size() && distance >= m_lodLevels[i].distance; i++)
+	{
+		level = &m_lodLevels[i];
+	}
+	return level;
+}
+
+// Throttles spawning on the least important instances when a particle budget is
+// exceeded. An instance's priority is its system's importance over its distance
+// to the camera; see ParticleBudget.
+void Engine::ApplyParticleBudget()
+{
+	static const int N = ParticleSystem::NUM_BLEND_MODES;
+
+	m_particleBudget.Clear();
+	if (!m_particleBudget.IsLimited())
+	{
+		if (m_throttled)
+		{
+			// Budgets have been lifted
+			float scales[N];
+			fill(scales, scales + N, 1.0f);
+			for (auto& instance : m_instances)
+			{
+				instance->SetSpawnScales(scales);
+			}
+			m_throttled = false;
+		}
+		return;
+	}
+
+	for (auto& instance : m_instances)
+	{
+		int counts[N] = {0};
+		instance->GetParticleCounts(counts);
+
+		D3DXVECTOR3 delta = instance->GetPosition() - m_mainView.camera.Position;
+		m_particleBudget.AddClaim(instance->GetParticleSystem().getImportance() / max(1.0f, D3DXVec3Length(&delta)), counts);
+	}
+
+	m_particleBudget.Fit();
+	for (size_t i = 0; i < m_instances.size(); i++)
+	{
+		m_instances[i]->SetSpawnScales(m_particleBudget.GetScales(i));
+	}
+	m_throttled = true;
+}
+
+// Only touches the instances' simulation state; Render doesn't read that
+void Engine::Simulate()
+{
+	for (ParticleSystemInstance* instance : m_simulated)
+	{
+		m_numParticles += instance->Simulate(m_updateTime);
+	}
+}
+
+void Engine::SimulationThread()
+{
+	unique_lock<mutex> lock(m_simulationMutex);
+	for (;;)
+	{
+		m_simulationCond.wait(lock, [this] { return m_simulating || m_quitSimulation; });
+		if (m_quitSimulation)
+		{
+			break;
+		}
+
+		lock.unlock();
+		Simulate();
+		lock.lock();
+
+		m_simulating = false;
+		m_simulationCond.notify_all();
+	}
+}
+
+void Engine::SetPipelined(bool pipelined)
+{
+	if (pipelined && !m_simulationThread.joinable())
+	{
+		m_simulationThread = thread(&Engine::SimulationThread, this);
+	}
+
+	if (!pipelined && m_updatePending)
+	{
+		m_updatePending = false;
+		BeginUpdate(m_updateTime, false);
+		EndUpdate();
+	}
+	m_pipelined = pipelined;
 }
 
-bool Engine::Render()
+// The projection of all views, with the far plane at infinity
+static void SetPerspective(D3DXMATRIX& projection, UINT width, UINT height)
 {
-	static const D3DXMATRIX Identity(1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1);
+	// http://www.gamedev.net/columns/hardcore/shadowvolume/page4.asp
+	float n = 1.0f;
+	D3DXMatrixPerspectiveFovRH(&projection, D3DXToRadian(45), (float)width / height, n, 1000.0f );
+	projection._33 = -1.0f;
+	projection._43 = -2 * n;
+}
 
+bool Engine::Render(bool present)
+{
 	// See if we can render
 	switch (m_pDevice->TestCooperativeLevel())
 	{
@@ -111,147 +299,437 @@ bool Engine::Render()
 			break;
 	}
 
-    // Set all effect parameters
-    for (int i = 0; i < NUM_SHADERS; i++)
-    {
-        static D3DXMATRIX Identity(1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1);
+	// Simulate the pending update while this frame is submitted
+	bool updating = m_updatePending;
+	if (updating)
+	{
+		m_updatePending = false;
+		BeginUpdate(m_updateTime, true);
+	}
 
-        const Effect::Handles& handles = m_pShaders[i]->getHandles();
-        ID3DXEffect* pEffect = m_pShaders[i]->getD3DEffect();
+	// Submit through the state cache, which passes on to the recorder, if
+	// stats are wanted, and the render device
+	IRenderDevice* device = m_stateCache;
+	m_stateCache->ResetNumFiltered();
+	if (m_recorder != NULL)
+	{
+		m_recorder->ResetStats();
+	}
 
-        // World, View, Projection Transforms
-        pEffect->SetMatrix(handles.hWorld,               &Identity);
-        pEffect->SetMatrix(handles.hWorldInverse,        &Identity);
-        pEffect->SetMatrix(handles.hProjection,          &m_projection);
-        pEffect->SetMatrix(handles.hViewProjection,      &m_viewProjection);
-        pEffect->SetMatrix(handles.hViewInverse,         &m_viewInverse);
-        pEffect->SetMatrix(handles.hView,                &m_view);
-        pEffect->SetMatrix(handles.hWorldViewProjection, &m_viewProjection);
-        pEffect->SetMatrix(handles.hWorldViewInverse,    &m_viewInverse);
-        pEffect->SetMatrix(handles.hWorldView,           &m_view);
-        pEffect->SetVector(handles.hEyePosition,         &D3DXVECTOR4(m_eye.Position.x, m_eye.Position.y, m_eye.Position.z, 1));
-
-        // Lighting
-        pEffect->SetVector(handles.hGlobalAmbient,    &m_ambient);
-        pEffect->SetVector(handles.hDirLightVec0,     &m_lights[0].Position);
-        pEffect->SetVector(handles.hDirLightObjVec0,  &m_lights[0].Position);
-        pEffect->SetVector(handles.hDirLightDiffuse,  &m_lights[0].Diffuse);
-        pEffect->SetVector(handles.hDirLightSpecular, &m_lights[0].Specular);
-        pEffect->SetMatrixArray(handles.hSphLightAll,  m_sphLightAll,  3);
-        pEffect->SetMatrixArray(handles.hSphLightFill, m_sphLightFill, 3);
-
-        // Time
-        pEffect->SetFloat(handles.hTime, GetTimeF());
-        SAFE_RELEASE(pEffect);
-    }
+	device->BeginScene();
+	m_numRenderPasses = RenderFrame(m_renderGraph, m_pBackBuffer, m_pBackBufferDepth, m_pDepthStencilSurface);
+	device->EndScene();
+	if (present)
+	{
+		device->Present(NULL);
+	}
 
-    // Sort the particle systems on distance from camera
-    // Negative Z is further away, thus drawn first.
-    // Therefore we need a normal ascending sort.
-	sort(m_instances.begin(), m_instances.end(), [](const auto& p1, const auto& p2) {
-		return p1->GetZDistance() < p2->GetZDistance();
-	});
-	
-	m_pDevice->BeginScene();
-
-	IDirect3DSurface9* pScreenSurface;
-	IDirect3DSurface9* pDepthSurface;
-	m_pDevice->GetRenderTarget(0, &pScreenSurface);
-    m_pDevice->GetDepthStencilSurface(&pDepthSurface);
-
-    // Set the new depth buffer
-    m_pDevice->SetDepthStencilSurface(m_pDepthStencilSurface);
-
-	// Render to the scene texture
-	IDirect3DSurface9* pSceneSurface;
-	m_pSceneTexture->GetSurfaceLevel(0, &pSceneSurface);
-	m_pDevice->SetRenderTarget(0, pSceneSurface);
-	SAFE_RELEASE(pSceneSurface);
-
-    D3DCOLOR clearColor = D3DCOLOR_XRGB(GetRValue(m_background), GetGValue(m_background), GetBValue(m_background));
-	m_pDevice->Clear(0, NULL, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, clearColor, 1.0f, 0);
-	if (m_showGround)
-	{
-		static const float TEXTURE_SCALE  = 256;
-		static const float MAP_SIZE       = 80;
-		static const float UNITS_PER_CELL = 20;
-		static const EmitterInstance::Vertex ground[4] = {
-			{D3DXVECTOR3(-UNITS_PER_CELL*MAP_SIZE/2,-UNITS_PER_CELL*MAP_SIZE/2,0), D3DXVECTOR3(0,0,1), D3DXVECTOR2(                                    0,                                     0), D3DXVECTOR2(0,0), D3DCOLOR_RGBA(255,255,255,255)},
-			{D3DXVECTOR3( UNITS_PER_CELL*MAP_SIZE/2,-UNITS_PER_CELL*MAP_SIZE/2,0), D3DXVECTOR3(0,0,1), D3DXVECTOR2(MAP_SIZE*UNITS_PER_CELL/TEXTURE_SCALE,                                     0), D3DXVECTOR2(0,0), D3DCOLOR_RGBA(255,255,255,255)},
-			{D3DXVECTOR3(-UNITS_PER_CELL*MAP_SIZE/2, UNITS_PER_CELL*MAP_SIZE/2,0), D3DXVECTOR3(0,0,1), D3DXVECTOR2(                                    0, MAP_SIZE*UNITS_PER_CELL/TEXTURE_SCALE), D3DXVECTOR2(0,0), D3DCOLOR_RGBA(255,255,255,255)},
-			{D3DXVECTOR3( UNITS_PER_CELL*MAP_SIZE/2, UNITS_PER_CELL*MAP_SIZE/2,0), D3DXVECTOR3(0,0,1), D3DXVECTOR2(MAP_SIZE*UNITS_PER_CELL/TEXTURE_SCALE, MAP_SIZE*UNITS_PER_CELL/TEXTURE_SCALE), D3DXVECTOR2(0,0), D3DCOLOR_RGBA(255,255,255,255)}
-		};
-
-		m_pDevice->SetTexture(0, m_pGroundTexture);
-		m_pDevice->SetTransform(D3DTS_TEXTURE0, &Identity);
-		m_pDevice->SetTexture(1, NULL);
-		m_pDevice->SetRenderState(D3DRS_ZENABLE,          TRUE);
-		m_pDevice->SetRenderState(D3DRS_ZWRITEENABLE,     TRUE);
-		m_pDevice->SetRenderState(D3DRS_ALPHABLENDENABLE, FALSE);
-		m_pDevice->DrawPrimitiveUP(D3DPT_TRIANGLESTRIP, 2, ground, sizeof(EmitterInstance::Vertex));
-	}
-
-    for (auto& instance : m_instances)
-    {
-        instance->RenderNormal(m_pDevice);
+	if (m_recorder != NULL)
+	{
+		m_renderStats = m_recorder->GetStats();
 	}
-    m_pDevice->SetTextureStageState(0, D3DTSS_COLOROP, D3DTOP_MODULATE);
 
-	// Now render to the heat texture
-	IDirect3DSurface9* pDistortSurface;
-	m_pDistortTexture->GetSurfaceLevel(0, &pDistortSurface);
-	m_pDevice->SetRenderTarget(0, pDistortSurface);
-	SAFE_RELEASE(pDistortSurface);
+	if (updating)
+	{
+		EndUpdate();
+	}
+	return true;
+}
 
-	m_pDevice->Clear(0, NULL, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, D3DCOLOR_XRGB(129,128,255), 1.0f, 0);
+// Queues the emitters and draws them through the render graph, as seen from
+// the render view. Returns the number of passes run.
+int Engine::RenderFrame(RenderGraph& graph, IDirect3DSurface9* pScreen, IDirect3DSurface9* pScreenDepth, IDirect3DSurface9* pTransientDepth)
+{
+	IRenderDevice* device = m_stateCache;
+	const View&    view   = GetRenderView();
+
+    SetSharedConstants(device);
+	device->SetTransform(IRenderDevice::TRANSFORM_VIEW,       view.view);
+	device->SetTransform(IRenderDevice::TRANSFORM_PROJECTION, view.projection);
+
+    // Queue the emitters to draw; sorting the queue orders them by pass,
+    // then by depth or render state (see RenderQueue)
+	m_renderQueue.Clear();
 	for (auto& instance : m_instances)
-    {
-        instance->RenderHeat(m_pDevice);
+	{
+		instance->Submit(m_renderQueue);
 	}
+	m_renderQueue.Sort();
 
-	// Now render to the screen
-	m_pDevice->SetRenderTarget(0, pScreenSurface);
-    m_pDevice->SetDepthStencilSurface(pDepthSurface);
-	SAFE_RELEASE(pScreenSurface);
-    SAFE_RELEASE(pDepthSurface);
-	m_pDevice->Clear(0, NULL, D3DCLEAR_TARGET, D3DCOLOR_XRGB(0,0,0), 0.0f, 0);
+	if (m_overdrawEstimator != NULL && IsMainView())
+	{
+		m_overdrawEstimator->Estimate(m_renderQueue, view.viewProjection, m_presentationParameters.BackBufferWidth, m_presentationParameters.BackBufferHeight);
+		m_overdrawStats = m_overdrawEstimator->GetStats();
+	}
 
-	static const EmitterInstance::Vertex quad[4] = {
-		{D3DXVECTOR3(-1,-1,0), D3DXVECTOR2(0, 1), D3DXVECTOR4(1,1,1,1)},
-		{D3DXVECTOR3( 1,-1,0), D3DXVECTOR2(1, 1), D3DXVECTOR4(1,1,1,1)},
-		{D3DXVECTOR3(-1, 1,0), D3DXVECTOR2(0, 0), D3DXVECTOR4(1,1,1,1)},
-		{D3DXVECTOR3( 1, 1,0), D3DXVECTOR2(1, 0), D3DXVECTOR4(1,1,1,1)}
+	//
+	// The frame draws the scene and the heat into their own textures, and
+	// distorts the scene with the heat onto the screen. Without heat, the
+	// graph draws the scene straight onto the screen.
+	//
+	const size_t heatItem = m_renderQueue.GetFirstItem(RenderQueue::PASS_HEAT);
+	graph.Clear();
+	RenderGraph::Target scene = graph.AddTarget();
+	RenderGraph::Target heat  = graph.AddTarget();
+
+	RenderGraph::Pass scenePass = {"Scene", scene, {}, RenderGraph::NONE, true,
+		IRenderDevice::CLEAR_TARGET | IRenderDevice::CLEAR_DEPTH, D3DCOLOR_XRGB(GetRValue(m_background), GetGValue(m_background), GetBValue(m_background)), 1.0f,
+		[this](IRenderDevice* device)
+		{
+			static const D3DXMATRIX Identity(1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1);
+			if (m_showGround)
+			{
+				static const float TEXTURE_SCALE  = 256;
+				static const float MAP_SIZE       = 80;
+				static const float UNITS_PER_CELL = 20;
+				static const EmitterInstance::Vertex ground[4] = {
+					{D3DXVECTOR3(-UNITS_PER_CELL*MAP_SIZE/2,-UNITS_PER_CELL*MAP_SIZE/2,0), D3DXVECTOR3(0,0,1), D3DXVECTOR2(                                    0,                                     0), D3DXVECTOR2(0,0), D3DCOLOR_RGBA(255,255,255,255)},
+					{D3DXVECTOR3( UNITS_PER_CELL*MAP_SIZE/2,-UNITS_PER_CELL*MAP_SIZE/2,0), D3DXVECTOR3(0,0,1), D3DXVECTOR2(MAP_SIZE*UNITS_PER_CELL/TEXTURE_SCALE,                                     0), D3DXVECTOR2(0,0), D3DCOLOR_RGBA(255,255,255,255)},
+					{D3DXVECTOR3(-UNITS_PER_CELL*MAP_SIZE/2, UNITS_PER_CELL*MAP_SIZE/2,0), D3DXVECTOR3(0,0,1), D3DXVECTOR2(                                    0, MAP_SIZE*UNITS_PER_CELL/TEXTURE_SCALE), D3DXVECTOR2(0,0), D3DCOLOR_RGBA(255,255,255,255)},
+					{D3DXVECTOR3( UNITS_PER_CELL*MAP_SIZE/2, UNITS_PER_CELL*MAP_SIZE/2,0), D3DXVECTOR3(0,0,1), D3DXVECTOR2(MAP_SIZE*UNITS_PER_CELL/TEXTURE_SCALE, MAP_SIZE*UNITS_PER_CELL/TEXTURE_SCALE), D3DXVECTOR2(0,0), D3DCOLOR_RGBA(255,255,255,255)}
+				};
+
+				device->SetTexture(0, ToRenderTexture(m_pGroundTexture));
+				device->SetTransform(IRenderDevice::TRANSFORM_TEXTURE0, Identity);
+				device->SetTexture(1, NULL);
+				device->SetState(IRenderDevice::STATE_DEPTH_TEST,  TRUE);
+				device->SetState(IRenderDevice::STATE_DEPTH_WRITE, TRUE);
+				device->SetState(IRenderDevice::STATE_BLEND,       FALSE);
+				device->DrawPrimitiveUP(IRenderDevice::TRIANGLE_STRIP, 2, ground, sizeof(EmitterInstance::Vertex));
+			}
+
+			size_t item = 0;
+			RenderPass(device, RenderQueue::PASS_NORMAL, item);
+		}
 	};
+	graph.AddPass(scenePass);
+
+	// The heat texture is cleared to an undistorted normal
+	RenderGraph::Pass heatPass = {"Heat", heat, {}, RenderGraph::NONE, heatItem < m_renderQueue.GetItems().size(),
+		IRenderDevice::CLEAR_TARGET | IRenderDevice::CLEAR_DEPTH, D3DCOLOR_XRGB(129,128,255), 1.0f,
+		[this, heatItem](IRenderDevice* device)
+		{
+			size_t item = heatItem;
+			RenderPass(device, RenderQueue::PASS_HEAT, item);
+		}
+	};
+	graph.AddPass(heatPass);
+
+	RenderGraph::Pass compositePass = {"Composite", RenderGraph::SCREEN, {scene, heat}, scene, true,
+		IRenderDevice::CLEAR_TARGET, D3DCOLOR_XRGB(0,0,0), 0.0f,
+		[this, &graph, scene, heat](IRenderDevice* device)
+		{
+			static const EmitterInstance::Vertex quad[4] = {
+				{D3DXVECTOR3(-1,-1,0), D3DXVECTOR2(0, 1), D3DXVECTOR4(1,1,1,1)},
+				{D3DXVECTOR3( 1,-1,0), D3DXVECTOR2(1, 1), D3DXVECTOR4(1,1,1,1)},
+				{D3DXVECTOR3(-1, 1,0), D3DXVECTOR2(0, 0), D3DXVECTOR4(1,1,1,1)},
+				{D3DXVECTOR3( 1, 1,0), D3DXVECTOR2(1, 0), D3DXVECTOR4(1,1,1,1)}
+			};
+
+			RenderTexture* pSceneTexture   = ToRenderTexture(graph.GetTexture(scene));
+			RenderTexture* pDistortTexture = ToRenderTexture(graph.GetTexture(heat));
+			device->SetTexture(0, pSceneTexture);
+			device->SetTexture(1, pDistortTexture);
+			device->SetEffectTexture(m_pDistortShader, "SceneTexture",      pSceneTexture);
+			device->SetEffectTexture(m_pDistortShader, "DistortionTexture", pDistortTexture);
+
+			UINT nPasses = device->BeginEffect(m_pDistortShader);
+			for (UINT i = 0; i < nPasses; i++)
+			{
+				device->BeginPass(m_pDistortShader, i);
+				device->DrawPrimitiveUP(IRenderDevice::TRIANGLE_STRIP, 2, quad, sizeof(EmitterInstance::Vertex));
+				device->EndPass(m_pDistortShader);
+			}
+			device->EndEffect(m_pDistortShader);
+		}
+	};
+	graph.AddPass(compositePass);
+
+	return graph.Execute(m_pDevice, device, pScreen, pScreenDepth, pTransientDepth);
+}
+
+int Engine::AddView(HWND hWnd, const Camera& camera)
+{
+	auto extra = std::make_unique<ExtraView>();
+	extra->hWnd          = hWnd;
+	extra->pSwapChain    = NULL;
+	extra->pDepthSurface = NULL;
+
+	// Until it's drawn, the view culls with the window's current shape
+	RECT rect;
+	GetClientRect(hWnd, &rect);
+	D3DXMATRIX projection;
+	SetPerspective(projection, max(rect.right - rect.left, 1L), max(rect.bottom - rect.top, 1L));
+	extra->view.Set(camera, projection);
+
+	m_views.push_back(std::move(extra));
+	return (int)m_views.size() - 1;
+}
+
+void Engine::RemoveView(int view)
+{
+	ReleaseViewTargets(*m_views[view]);
+	m_views.erase(m_views.begin() + view);
+}
+
+void Engine::SetViewCamera(int view, const Camera& camera)
+{
+	View& v = m_views[view]->view;
+	v.Set(camera, v.projection);
+}
+
+bool Engine::CreateViewTargets(ExtraView& extra, UINT width, UINT height)
+{
+	// Like the device's own swap chain, without multisampling, so that the
+	// back buffer can share the depth buffer of the render graph's textures
+	D3DPRESENT_PARAMETERS parameters = m_presentationParameters;
+	parameters.hDeviceWindow          = extra.hWnd;
+	parameters.BackBufferWidth        = width;
+	parameters.BackBufferHeight       = height;
+	parameters.BackBufferCount        = 1;
+	parameters.MultiSampleType        = D3DMULTISAMPLE_NONE;
+	parameters.MultiSampleQuality     = 0;
+	parameters.EnableAutoDepthStencil = FALSE;
+	parameters.Flags                  = 0;
+	if (FAILED(m_pDevice->CreateAdditionalSwapChain(&parameters, &extra.pSwapChain)))
+	{
+		return false;
+	}
+	if (FAILED(m_pDevice->CreateDepthStencilSurface(width, height, m_presentationParameters.AutoDepthStencilFormat, D3DMULTISAMPLE_NONE, 0, TRUE, &extra.pDepthSurface, NULL)))
+	{
+		ReleaseViewTargets(extra);
+		return false;
+	}
+
+	D3DXMATRIX projection;
+	SetPerspective(projection, width, height);
+	extra.view.Set(extra.view.camera, projection);
+	return true;
+}
+
+void Engine::ReleaseViewTargets(ExtraView& extra)
+{
+	extra.renderGraph.ReleaseTargets();
+	SAFE_RELEASE(extra.pDepthSurface);
+	SAFE_RELEASE(extra.pSwapChain);
+}
+
+bool Engine::RenderView(int view, bool present)
+{
+	// Render resets a lost device
+	if (m_pDevice->TestCooperativeLevel() != D3D_OK)
+	{
+		return false;
+	}
 
-    ID3DXEffect* pEffect = m_pDistortShader->getD3DEffect();
-    m_pDevice->SetTexture(0, m_pSceneTexture);
-    m_pDevice->SetTexture(1, m_pDistortTexture);
-	pEffect->SetTexture("SceneTexture",      m_pSceneTexture);
-	pEffect->SetTexture("DistortionTexture", m_pDistortTexture);
+	ExtraView& extra = *m_views[view];
+	RECT rect;
+	GetClientRect(extra.hWnd, &rect);
+	const UINT width  = rect.right  - rect.left;
+	const UINT height = rect.bottom - rect.top;
+	if (width == 0 || height == 0)
+	{
+		return false;
+	}
+
+	// The swap chain is made again when the window is resized
+	if (extra.pSwapChain != NULL)
+	{
+		D3DPRESENT_PARAMETERS parameters;
+		extra.pSwapChain->GetPresentParameters(&parameters);
+		if (parameters.BackBufferWidth != width || parameters.BackBufferHeight != height)
+		{
+			ReleaseViewTargets(extra);
+		}
+	}
+	if (extra.pSwapChain == NULL && !CreateViewTargets(extra, width, height))
+	{
+		return false;
+	}
 
-	UINT nPasses = 1;
-	pEffect->Begin(&nPasses, 0);
-	for (UINT i = 0; i < nPasses; i++)
+	IDirect3DSurface9* pBackBuffer;
+	if (FAILED(extra.pSwapChain->GetBackBuffer(0, D3DBACKBUFFER_TYPE_MONO, &pBackBuffer)))
 	{
-		pEffect->BeginPass(i);
-		m_pDevice->DrawPrimitiveUP(D3DPT_TRIANGLESTRIP, 2, quad, sizeof(EmitterInstance::Vertex));
-		pEffect->EndPass();
+		return false;
 	}
-	pEffect->End();
-    SAFE_RELEASE(pEffect);
 
-	m_pDevice->EndScene();
-	m_pDevice->Present(NULL, NULL, NULL, NULL);
+	// The view's camera replaces the main one in the shaders for this frame
+	m_renderView = &extra.view;
+	m_constantVersions[CONSTANTS_CAMERA]++;
+
+	IRenderDevice* device = m_stateCache;
+	device->BeginScene();
+	RenderFrame(extra.renderGraph, pBackBuffer, extra.pDepthSurface, extra.pDepthSurface);
+	device->EndScene();
+	SAFE_RELEASE(pBackBuffer);
+
+	if (m_recorder != NULL)
+	{
+		// Render reset the recorder, so this adds to the frame's stats
+		m_renderStats = m_recorder->GetStats();
+	}
+
+	m_renderView = &m_mainView;
+	m_constantVersions[CONSTANTS_CAMERA]++;
+
+	if (present)
+	{
+		device->Present(ToRenderSwapChain(extra.pSwapChain));
+	}
 	return true;
 }
 
+// Sets the constants of all shaders that are out of date. Only the time
+// changes every frame.
+void Engine::SetSharedConstants(IRenderDevice* device)
+{
+    static const D3DXMATRIX Identity(1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1);
+
+    for (int i = 0; i < NUM_SHADERS; i++)
+    {
+        Effect*                effect   = m_pShaders[i];
+        const Effect::Handles& handles  = effect->getHandles();
+        unsigned int*          versions = m_shaderConstantVersions[i];
+
+        if (versions[CONSTANTS_CAMERA] != m_constantVersions[CONSTANTS_CAMERA])
+        {
+            // World, View, Projection Transforms
+            const View& view = GetRenderView();
+            D3DXVECTOR4 eyePosition(view.camera.Position.x, view.camera.Position.y, view.camera.Position.z, 1);
+            device->SetMatrix(effect, handles.hWorld,               Identity);
+            device->SetMatrix(effect, handles.hWorldInverse,        Identity);
+            device->SetMatrix(effect, handles.hProjection,          view.projection);
+            device->SetMatrix(effect, handles.hViewProjection,      view.viewProjection);
+            device->SetMatrix(effect, handles.hViewInverse,         view.viewInverse);
+            device->SetMatrix(effect, handles.hView,                view.view);
+            device->SetMatrix(effect, handles.hWorldViewProjection, view.viewProjection);
+            device->SetMatrix(effect, handles.hWorldViewInverse,    view.viewInverse);
+            device->SetMatrix(effect, handles.hWorldView,           view.view);
+            device->SetVector(effect, handles.hEyePosition,         eyePosition);
+            versions[CONSTANTS_CAMERA] = m_constantVersions[CONSTANTS_CAMERA];
+        }
+
+        if (versions[CONSTANTS_LIGHTING] != m_constantVersions[CONSTANTS_LIGHTING])
+        {
+            device->SetVector(effect, handles.hGlobalAmbient,    m_ambient);
+            device->SetVector(effect, handles.hDirLightVec0,     m_lights[0].Position);
+            device->SetVector(effect, handles.hDirLightObjVec0,  m_lights[0].Position);
+            device->SetVector(effect, handles.hDirLightDiffuse,  m_lights[0].Diffuse);
+            device->SetVector(effect, handles.hDirLightSpecular, m_lights[0].Specular);
+            device->SetMatrixArray(effect, handles.hSphLightAll,  m_sphLightAll[0],  3);
+            device->SetMatrixArray(effect, handles.hSphLightFill, m_sphLightFill[0], 3);
+            versions[CONSTANTS_LIGHTING] = m_constantVersions[CONSTANTS_LIGHTING];
+        }
+
+        device->SetFloat(effect, handles.hTime, GetTimeF());
+    }
+}
+
+// Makes all shaders get all constants on the next frame
+void Engine::InvalidateSharedConstants()
+{
+    memset(m_shaderConstantVersions, 0, sizeof m_shaderConstantVersions);
+}
+
+// Draws the queued emitters of a pass, starting at 'item'. Runs of emitters
+// that can share a draw call are drawn as one batch.
+void Engine::RenderPass(IRenderDevice* device, RenderQueue::Pass pass, size_t& item)
+{
+	// Batched quads are indexed with 16 bits
+	static const int MAX_BATCH_PARTICLES = 0x10000 / NUM_VERTICES_PER_PARTICLE;
+
+	const vector<RenderQueue::Item>& items = m_renderQueue.GetItems();
+	while (item < items.size() && RenderQueue::GetPass(items[item].key) == pass)
+	{
+		EmitterInstance* first = items[item].emitter;
+		int nParticles = first->GetNumRenderParticles();
+		m_batch.clear();
+		m_batch.push_back(first);
+		while (++item < items.size() && RenderQueue::GetPass(items[item].key) == pass && items[item].emitter->CanBatchWith(*first)
+			&& nParticles + items[item].emitter->GetNumRenderParticles() <= MAX_BATCH_PARTICLES)
+		{
+			nParticles += items[item].emitter->GetNumRenderParticles();
+			m_batch.push_back(items[item].emitter);
+		}
+		EmitterInstance::RenderBatch(device, m_batch);
+	}
+}
+
+void Engine::SetRenderDevice(IRenderDevice* device)
+{
+	m_renderDevice = (device != NULL) ? device : m_d3dRenderDevice;
+	InvalidateSharedConstants();
+	if (m_recorder != NULL)
+	{
+		// Record what goes to the new device
+		SetRecordRenderStats(true);
+	}
+	else
+	{
+		m_stateCache->SetNext(m_renderDevice);
+	}
+}
+
+void Engine::SetRecordRenderStats(bool record)
+{
+	delete m_recorder;
+	m_recorder = record ? new RecordingRenderDevice(m_renderDevice) : NULL;
+	m_renderStats.Reset();
+	m_stateCache->SetNext(record ? m_recorder : m_renderDevice);
+}
+
+void Engine::SetEstimateOverdraw(bool estimate)
+{
+	delete m_overdrawEstimator;
+	m_overdrawEstimator = estimate ? new OverdrawEstimator : NULL;
+	m_overdrawStats.Reset();
+}
+
 IDirect3DTexture9* Engine::GetTexture(const string& name) const
 {
-	return m_textureManager.getTexture(m_pDevice, name);
+	TextureMap::const_iterator p = m_textures.find(name);
+	if (p == m_textures.end())
+	{
+		p = m_textures.insert(make_pair(name, m_textureManager.getTexture(m_pDevice, name))).first;
+	}
+
+	if (p->second != NULL)
+	{
+		p->second->AddRef();
+	}
+	return p->second;
+}
+
+void Engine::ClearTextures()
+{
+	for (TextureMap::iterator p = m_textures.begin(); p != m_textures.end(); p++)
+	{
+		SAFE_RELEASE(p->second);
+	}
+	m_textures.clear();
+}
+
+void Engine::SetTextureAtlas(TextureAtlas* atlas)
+{
+	if (atlas != NULL)
+	{
+		atlas->AddRef();
+	}
+	SAFE_RELEASE(m_textureAtlas);
+	m_textureAtlas = atlas;
+
+	// Let the emitters pick their textures again
+	OnParticleSystemChanged(-1);
 }
 
 void Engine::OnParticleSystemChanged(int track)
 {
+	if (track == -1)
+	{
+		// Emitters look their textures up again; pick up changed files
+		ClearTextures();
+	}
+
 	for (auto& instance : m_instances)
     {
 		instance->onParticleSystemChanged(*this, track);
@@ -265,26 +743,73 @@ void Engine::GetViewPort(D3DVIEWPORT9* viewport) const
 
 const Engine::Camera& Engine::GetCamera() const
 {
-	return m_eye;
+	return m_mainView.camera;
 }
 
-void Engine::SetCamera( const Camera& camera )
+void Engine::View::Set(const Camera& camera, const D3DXMATRIX& projection)
 {
-	m_eye = camera;
+	this->camera     = camera;
+	this->projection = projection;
 
 	// Construct matrices
-	D3DXMatrixLookAtRH(&m_view, &camera.Position, &camera.Target, &camera.Up );
-	D3DXMatrixMultiply(&m_viewProjection, &m_view, &m_projection);
+	D3DXMatrixLookAtRH(&view, &camera.Position, &camera.Target, &camera.Up );
+	D3DXMatrixMultiply(&viewProjection, &view, &projection);
+
+	// Extract the frustum planes from the view-projection matrix
+	const D3DXMATRIX& m = viewProjection;
+	frustum[0] = D3DXPLANE(m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41);
+	frustum[1] = D3DXPLANE(m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41);
+	frustum[2] = D3DXPLANE(m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42);
+	frustum[3] = D3DXPLANE(m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42);
+	frustum[4] = D3DXPLANE(m._13,         m._23,         m._33,         m._43);
 
 	// Create some resulting matrices
-	m_viewRotation = m_view;
-	m_viewRotation._41 = m_viewRotation._42 = m_viewRotation._43 = 0.0;
-	D3DXMatrixInverse(&m_billboard,   NULL, &m_viewRotation);
-    D3DXMatrixInverse(&m_viewInverse, NULL, &m_view);
+	viewRotation = view;
+	viewRotation._41 = viewRotation._42 = viewRotation._43 = 0.0;
+	D3DXMatrixInverse(&billboard,   NULL, &viewRotation);
+    D3DXMatrixInverse(&viewInverse, NULL, &view);
+}
 
-    // Set matrices
-	m_pDevice->SetTransform(D3DTS_VIEW,       &m_view);
-	m_pDevice->SetTransform(D3DTS_PROJECTION, &m_projection);
+bool Engine::View::IsVisible(const D3DXVECTOR3& min, const D3DXVECTOR3& max) const
+{
+	for (int i = 0; i < 5; i++)
+	{
+		// Test the corner furthest along the plane's normal
+		const D3DXPLANE& plane = frustum[i];
+		D3DXVECTOR3 corner(
+			(plane.a >= 0) ? max.x : min.x,
+			(plane.b >= 0) ? max.y : min.y,
+			(plane.c >= 0) ? max.z : min.z);
+		if (D3DXPlaneDotCoord(&plane, &corner) < 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Emitters are simulated once for all views, so they're kept while any view
+// sees them
+bool Engine::IsVisible(const D3DXVECTOR3& min, const D3DXVECTOR3& max) const
+{
+	if (m_mainView.IsVisible(min, max))
+	{
+		return true;
+	}
+	for (size_t i = 0; i < m_views.size(); i++)
+	{
+		if (m_views[i]->view.IsVisible(min, max))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void Engine::SetCamera( const Camera& camera )
+{
+	m_mainView.Set(camera, m_mainView.projection);
+    m_constantVersions[CONSTANTS_CAMERA]++;
 }
 
 void Engine::SetGround(bool enable)			        { m_showGround = enable; }
@@ -311,6 +836,7 @@ void Engine::SetLight(LightType which, const Light& light)
 	// Recalculate Spherical Harmonics matrices
 	SPH_Calculate_Matrices(m_sphLightFill, &m_lights[1], 2, m_ambient);
 	SPH_Calculate_Matrices(m_sphLightAll,  &m_lights[0], 3, m_ambient);
+	m_constantVersions[CONSTANTS_LIGHTING]++;
 }
 
 void Engine::SetAmbient(const D3DXVECTOR4& color)
@@ -320,13 +846,19 @@ void Engine::SetAmbient(const D3DXVECTOR4& color)
 	// Recalculate Spherical Harmonics matrices
 	SPH_Calculate_Matrices(m_sphLightFill, &m_lights[1], 2, m_ambient);
 	SPH_Calculate_Matrices(m_sphLightAll,  &m_lights[0], 3, m_ambient);
+	m_constantVersions[CONSTANTS_LIGHTING]++;
 }
 
 void Engine::Reset()
 {
-	SAFE_RELEASE(m_pDistortTexture);
-	SAFE_RELEASE(m_pSceneTexture);
+	m_renderGraph.ReleaseTargets();
+	for (size_t i = 0; i < m_views.size(); i++)
+	{
+		ReleaseViewTargets(*m_views[i]);
+	}
     SAFE_RELEASE(m_pDepthStencilSurface);
+	SAFE_RELEASE(m_pBackBuffer);
+	SAFE_RELEASE(m_pBackBufferDepth);
 
 	// Reset device
 	m_presentationParameters.BackBufferWidth  = 0;
@@ -349,72 +881,33 @@ void Engine::Reset()
         m_pShaders[i]->OnResetDevice();
     }
 
+	// The device state was reset
 	ResetParameters();
+	m_stateCache->Invalidate();
 }
 
 void Engine::ResetParameters()
 {
+	// The frames are drawn onto the device's own back buffer
+	m_pDevice->GetBackBuffer(0, 0, D3DBACKBUFFER_TYPE_MONO, &m_pBackBuffer);
+	m_pDevice->GetDepthStencilSurface(&m_pBackBufferDepth);
+
 	if (m_presentationParameters.BackBufferWidth > 0 && m_presentationParameters.BackBufferHeight > 0)
 	{
-		// http://www.gamedev.net/columns/hardcore/shadowvolume/page4.asp
-		float n = 1.0f;
-		D3DXMatrixPerspectiveFovRH(&m_projection, D3DXToRadian(45), (float)m_presentationParameters.BackBufferWidth / m_presentationParameters.BackBufferHeight, n, 1000.0f );
-		m_projection._33 = -1.0f;
-		m_projection._43 = -2 * n;
-
-		// Create dynamic textures
-		if (FAILED(m_pDevice->CreateTexture(m_presentationParameters.BackBufferWidth, m_presentationParameters.BackBufferHeight, 1, D3DUSAGE_RENDERTARGET, D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT, &m_pSceneTexture, NULL)))
-		{
-			throw runtime_error("Unable to create texture");
-		}
-
-		if (FAILED(m_pDevice->CreateTexture(m_presentationParameters.BackBufferWidth, m_presentationParameters.BackBufferHeight, 1, D3DUSAGE_RENDERTARGET, D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT, &m_pDistortTexture, NULL)))
-		{
-			SAFE_RELEASE(m_pSceneTexture);
-			throw runtime_error("Unable to create texture");
-		}
+		SetPerspective(m_mainView.projection, m_presentationParameters.BackBufferWidth, m_presentationParameters.BackBufferHeight);
 
+		// Create the depth buffer of the render graph's textures; the
+		// textures are created as the graph needs them
         if (FAILED(m_pDevice->CreateDepthStencilSurface(m_presentationParameters.BackBufferWidth, m_presentationParameters.BackBufferHeight, m_presentationParameters.AutoDepthStencilFormat, D3DMULTISAMPLE_NONE, 0, TRUE, &m_pDepthStencilSurface, NULL)))
         {
-            SAFE_RELEASE(m_pDistortTexture);
-			SAFE_RELEASE(m_pSceneTexture);
 			throw runtime_error("Unable to create depth buffer");
         }
 
 		// Reset states
-		m_pDevice->SetRenderState(D3DRS_CULLMODE, D3DCULL_NONE);
-		m_pDevice->SetRenderState(D3DRS_LIGHTING, FALSE);
-
-		// Reset vertex declaration
-		m_pDevice->SetVertexDeclaration(m_pDeclaration);
-
-		// Set color texture properties
-		m_pDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
-		m_pDevice->SetTextureStageState(0, D3DTSS_TEXCOORDINDEX, 0);
-		m_pDevice->SetTextureStageState(0, D3DTSS_ALPHAOP,   D3DTOP_MODULATE);
-		m_pDevice->SetTextureStageState(0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE);
-		m_pDevice->SetTextureStageState(0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE);
-		m_pDevice->SetSamplerState(0, D3DSAMP_MAGFILTER, D3DTEXF_LINEAR);
-		m_pDevice->SetSamplerState(0, D3DSAMP_MINFILTER, D3DTEXF_LINEAR);
-		m_pDevice->SetSamplerState(0, D3DSAMP_MIPFILTER, D3DTEXF_LINEAR);
-
-		// Set normal texture properties
-		m_pDevice->SetTextureStageState(1, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
-		m_pDevice->SetTextureStageState(1, D3DTSS_TEXCOORDINDEX, 1);
-		m_pDevice->SetTextureStageState(1, D3DTSS_ALPHAOP,   D3DTOP_MODULATE);
-		m_pDevice->SetTextureStageState(1, D3DTSS_ALPHAARG1, D3DTA_TEXTURE);
-		m_pDevice->SetTextureStageState(1, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE);
-		m_pDevice->SetSamplerState(1, D3DSAMP_MAGFILTER, D3DTEXF_LINEAR);
-		m_pDevice->SetSamplerState(1, D3DSAMP_MINFILTER, D3DTEXF_LINEAR);
-		m_pDevice->SetSamplerState(1, D3DSAMP_MIPFILTER, D3DTEXF_LINEAR);
-
-		// Set world matrix
-		D3DXMATRIX identity;
-		D3DXMatrixIdentity(&identity);
-		m_pDevice->SetTransform(D3DTS_WORLD, &identity);
+		m_d3dRenderDevice->ResetState(m_pDeclaration);
 
 		// Reset camera
-		SetCamera(m_eye);
+		SetCamera(m_mainView.camera);
 	}
 }
 
@@ -462,18 +955,40 @@ D3DMULTISAMPLE_TYPE Engine::GetMultiSampleType(DWORD* MultiSampleQuality, D3DFOR
 }
 
 Engine::Engine(HWND hFocus, HWND hDevice, ITextureManager& textureManager, IShaderManager& shaderManager)
-    : m_textureManager(textureManager)
+    : m_textureManager(textureManager), m_particleBudget(ParticleSystem::NUM_BLEND_MODES)
 {
 	// Initialize members
 	m_showGround     = true;
 	m_debugHeat      = false;
 	m_gravity        = D3DXVECTOR3(0,0,-1);
 	m_wind           = D3DXVECTOR3(0,0,0);
-	m_eye.Position   = D3DXVECTOR3(0,-250,125);
-	m_eye.Target     = D3DXVECTOR3(0,0,0);
-	m_eye.Up		 = D3DXVECTOR3(0,0,1);
+	m_mainView.camera.Position = D3DXVECTOR3(0,-250,125);
+	m_mainView.camera.Target   = D3DXVECTOR3(0,0,0);
+	m_mainView.camera.Up       = D3DXVECTOR3(0,0,1);
+	D3DXMatrixIdentity(&m_mainView.projection);
+	m_renderView     = &m_mainView;
     m_numEmitters    = 0;
     m_numParticles   = 0;
+    for (int i = 0; i < 5; i++)
+    {
+        // Until the camera is set, everything is visible
+        m_mainView.frustum[i] = D3DXPLANE(0, 0, 0, 0);
+    }
+    m_throttled      = false;
+    m_textureAtlas   = NULL;
+    m_recorder       = NULL;
+    m_pBackBuffer      = NULL;
+    m_pBackBufferDepth = NULL;
+    m_overdrawEstimator = NULL;
+    m_numRenderPasses = 0;
+    fill(m_constantVersions, m_constantVersions + NUM_CONSTANT_GROUPS, 1);
+    memset(m_shaderConstantVersions, 0, sizeof m_shaderConstantVersions);
+    m_pipelined      = false;
+    m_updatePending  = false;
+    m_updateTime     = 0.0f;
+    m_numUpdates     = 0;
+    m_simulating     = false;
+    m_quitSimulation = false;
     m_ambient        = D3DXVECTOR4(0,0,0,0);
     m_background     = RGB(0x14,0x08,0x34);
 
@@ -607,21 +1122,46 @@ Engine::Engine(HWND hFocus, HWND hDevice, ITextureManager& textureManager, IShad
     SetLight(LT_SUN,   sun);
     SetLight(LT_FILL1, fill);
     SetLight(LT_FILL2, fill);
+
+	m_d3dRenderDevice = new D3D9RenderDevice(m_pDevice);
+	m_renderDevice    = m_d3dRenderDevice;
+	m_stateCache      = new StateCacheRenderDevice(m_renderDevice);
 	ResetParameters();
 }
 
 Engine::~Engine()
 {
+	if (m_simulationThread.joinable())
+	{
+		{
+			lock_guard<mutex> lock(m_simulationMutex);
+			m_quitSimulation = true;
+			m_simulationCond.notify_all();
+		}
+		m_simulationThread.join();
+	}
+
     for (int i = 0; i < NUM_SHADERS; i++)
     {
         SAFE_RELEASE(m_pShaders[i]);
     }
+    ClearTextures();
+    SAFE_RELEASE(m_textureAtlas);
     SAFE_RELEASE(m_pDepthStencilSurface);
+	SAFE_RELEASE(m_pBackBuffer);
+	SAFE_RELEASE(m_pBackBufferDepth);
 	SAFE_RELEASE(m_pDistortShader);
-	SAFE_RELEASE(m_pDistortTexture);
-	SAFE_RELEASE(m_pSceneTexture);
+	m_renderGraph.ReleaseTargets();
+	for (size_t i = 0; i < m_views.size(); i++)
+	{
+		ReleaseViewTargets(*m_views[i]);
+	}
 	SAFE_RELEASE(m_pGroundTexture);
 	SAFE_RELEASE(m_pDeclaration);
+	delete m_stateCache;
+	delete m_recorder;
+	delete m_overdrawEstimator;
+	delete m_d3dRenderDevice;
 	SAFE_RELEASE(m_pDevice);
 	SAFE_RELEASE(m_pDirect3D);
 }
@@ -4,7 +4,15 @@
 #include "managers.h"
 #include "ParticleSystem.h"
 #include "utils.h"
+#include "RenderQueue.h"
+#include "D3D9RenderDevice.h"
+#include "RenderGraph.h"
+#include "Overdraw.h"
+#include "ParticleBudget.h"
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 class Object3D
 {
@@ -51,8 +59,14 @@ public:
 typedef float TimeF;
 TimeF GetTimeF();
 
+// Stops the clock at a time, for simulating at a fixed rate; GetTimeF returns
+// the last time set from then on
+void  SetTimeF(TimeF time);
+
 class ParticleSystemInstance;
 class EmitterInstance;
+class EmissionMesh;
+class TextureAtlas;
 
 class Engine
 {
@@ -82,10 +96,64 @@ public:
 		D3DXVECTOR3 Up;
 	};
 
+	// A camera and the matrices that follow from it
+	struct View
+	{
+		Camera     camera;
+		D3DXMATRIX view;
+		D3DXMATRIX viewInverse;
+		D3DXMATRIX viewRotation;	// The view without its translation
+		D3DXMATRIX billboard;		// Turns quads in the XY plane towards the camera
+		D3DXMATRIX projection;
+		D3DXMATRIX viewProjection;
+		D3DXPLANE  frustum[5];		// Left, right, bottom, top and near; the far plane is at infinity
+
+		void Set(const Camera& camera, const D3DXMATRIX& projection);
+
+		// Tests a bounding box against the frustum. Conservative; boxes near the
+		// frustum's corners may be reported as visible.
+		bool IsVisible(const D3DXVECTOR3& min, const D3DXVECTOR3& max) const;
+	};
+
+	// A distance-based level of detail. Instances further than 'distance' from the
+	// camera spawn 'spawnScale' times as many particles, enlarged to cover the same area.
+	struct LodLevel
+	{
+		float distance;
+		float spawnScale;
+		float minSize;		// Emitters whose particles never grow this large are disabled
+		bool  heat;			// Keep heat emitters enabled?
+	};
+
 	void Update();
-	bool Render();
 
-	ParticleSystemInstance* SpawnParticleSystem(const ParticleSystem& system, Object3D* parent);
+	// Without presenting, e.g. when another render device draws the frame, the
+	// window keeps showing the last frame that was presented
+	bool Render(bool present = true);
+
+	// Extra views draw the same particles into other windows, through their own
+	// cameras. The particles are simulated once, for the main camera; a view
+	// only turns their quads towards its camera and sorts them again. Levels of
+	// detail, weather and the particle budget follow the main camera, and
+	// emitters are culled when no view sees them. Render the main view first;
+	// RenderView draws what it simulated. Removing a view renumbers the later ones.
+	int           AddView(HWND hWnd, const Camera& camera);
+	void          RemoveView(int view);
+	int           GetNumViews() const             { return (int)m_views.size(); }
+	const Camera& GetViewCamera(int view) const   { return m_views[view]->view.camera; }
+	void          SetViewCamera(int view, const Camera& camera);
+	bool          RenderView(int view, bool present = true);
+
+	// The view being drawn: an extra view during RenderView, the main view otherwise
+	const View&   GetRenderView() const { return *m_renderView; }
+	bool          IsMainView() const    { return m_renderView == &m_mainView; }
+
+	ParticleSystemInstance* SpawnParticleSystem(const ParticleSystem& system, Object3D* parent, EmissionMesh* mesh = NULL);
+
+	// Spawns an instance at each position. The spawn time and the root
+	// emitters are looked up once for all of them. The instances have no
+	// parent, so the engine removes them when they die.
+	void SpawnParticleSystems(const ParticleSystem& system, const D3DXVECTOR3* positions, size_t count, EmissionMesh* mesh = NULL);
     
 	void DetachParticleSystem(ParticleSystemInstance* instance);
 	void KillParticleSystem(ParticleSystemInstance* instance);
@@ -93,17 +161,49 @@ public:
 	
 	IDirect3DTexture9* GetTexture(const std::string& name) const;
 
+	// Color textures are looked up in the texture atlas first, if there is one
+	const TextureAtlas* GetTextureAtlas() const { return m_textureAtlas; }
+	void                SetTextureAtlas(TextureAtlas* atlas);
+
 	void OnParticleSystemChanged(int track);
 
-	const D3DXMATRIX& GetProjectionMatrix()   const { return m_projection; }
-	const D3DXMATRIX& GetViewMatrix()         const { return m_view; }
-	const D3DXMATRIX& GetViewRotationMatrix() const { return m_viewRotation; }
-	const D3DXMATRIX& GetBillboardMatrix()    const { return m_billboard; }
+	// Frames are submitted to Direct3D unless another render device is set;
+	// NULL restores Direct3D. The device is not owned by the engine.
+	IRenderDevice* GetRenderDevice() const { return m_renderDevice; }
+	void           SetRenderDevice(IRenderDevice* device);
+
+	// When recording, GetRenderStats returns what the last frame submitted,
+	// including the extra views drawn since
+	bool               IsRecordingRenderStats() const { return m_recorder != NULL; }
+	void               SetRecordRenderStats(bool record);
+	const RenderStats& GetRenderStats() const         { return m_renderStats; }
+
+	// When estimating, GetOverdrawStats returns the estimated fill of the last
+	// frame (see OverdrawEstimator)
+	bool                 IsEstimatingOverdraw() const { return m_overdrawEstimator != NULL; }
+	void                 SetEstimateOverdraw(bool estimate);
+	const OverdrawStats& GetOverdrawStats() const     { return m_overdrawStats; }
+
+	// Redundant render state and texture changes dropped in the last frame
+	unsigned long GetNumFilteredStates() const { return m_stateCache->GetNumFiltered(); }
+
+	// Passes of the render graph run in the last frame
+	int           GetNumRenderPasses() const   { return m_numRenderPasses; }
+
+	// The main view's matrices
+	const D3DXMATRIX& GetProjectionMatrix()   const { return m_mainView.projection; }
+	const D3DXMATRIX& GetViewMatrix()         const { return m_mainView.view; }
+	const D3DXMATRIX& GetViewRotationMatrix() const { return m_mainView.viewRotation; }
+	const D3DXMATRIX& GetBillboardMatrix()    const { return m_mainView.billboard; }
 	void  GetViewPort(D3DVIEWPORT9* viewport) const;
 
+	// Is a bounding box in the main view or any extra view?
+	bool  IsVisible(const D3DXVECTOR3& min, const D3DXVECTOR3& max) const;
+
 	const Camera& GetCamera() const;
 	void  SetCamera(const Camera& camera);
 
+	bool     IsPipelined() const    { return m_pipelined; }
 	bool     GetGround() const		{ return m_showGround; }
 	bool     GetHeatDebug() const   { return m_debugHeat; }
     COLORREF GetBackground() const  { return m_background; }
@@ -115,6 +215,22 @@ public:
     int GetNumParticles() const { return m_numParticles; }
     int GetNumInstances() const { return (int)m_instances.size(); }
 
+    // The number of updates simulated so far; drawing never simulates
+    unsigned long GetNumUpdates() const { return m_numUpdates; }
+
+    // Particle budgets; a budget of 0 is unlimited.
+    // The pressure is the number of particles relative to the budget.
+    int   GetParticleBudget() const                  { return m_particleBudget.GetBudget(); }
+    int   GetParticleBudget(int blendMode) const     { return m_particleBudget.GetBudget(blendMode); }
+    float GetParticlePressure() const                { return m_particleBudget.GetPressure(); }
+    float GetParticlePressure(int blendMode) const   { return m_particleBudget.GetPressure(blendMode); }
+    void  SetParticleBudget(int budget)              { m_particleBudget.SetBudget(budget); }
+    void  SetParticleBudget(int blendMode, int budget) { m_particleBudget.SetBudget(blendMode, budget); }
+
+    // Instances the budgets made spawn less, or not at all, in the last update
+    int   GetNumThrottled() const                    { return m_particleBudget.GetNumThrottled(); }
+    int   GetNumCulled() const                       { return m_particleBudget.GetNumCulled(); }
+
     void OnEmitterCreated(int numParticles)   { m_numEmitters++; m_numParticles += numParticles; }
     void OnEmitterDestroyed() { m_numEmitters--; }
 
@@ -126,6 +242,11 @@ public:
 	void SetGravity(const D3DXVECTOR3& gravity);
 	void SetGround(bool enable);
 	void SetHeatDebug(bool debug);
+	void SetPipelined(bool pipelined);
+
+	const std::vector<LodLevel>& GetLodLevels() const { return m_lodLevels; }
+	const LodLevel*              GetLodLevel(float distance) const;
+	void                         SetLodLevels(const std::vector<LodLevel>& levels);
 
 	void				Reset();
 	Engine(HWND hFocus, HWND hDevice, ITextureManager& textureManager, IShaderManager& shaderManager);
@@ -136,6 +257,16 @@ private:
 	D3DFORMAT           GetDepthStencilFormat(D3DFORMAT AdapterFormat, bool withStencilBuffer);
 	void				ResetParameters();
 
+	void				BeginUpdate(TimeF currentTime, bool async);
+	void				EndUpdate();
+	void				Simulate();
+	void				ApplyParticleBudget();
+	void				SimulationThread();
+	int 				RenderFrame(RenderGraph& graph, IDirect3DSurface9* pScreen, IDirect3DSurface9* pScreenDepth, IDirect3DSurface9* pTransientDepth);
+	void				RenderPass(IRenderDevice* device, RenderQueue::Pass pass, size_t& item);
+	void				SetSharedConstants(IRenderDevice* device);
+	void				InvalidateSharedConstants();
+
 	//
 	// Data members
 	//
@@ -145,14 +276,60 @@ private:
     int m_numParticles;
     int m_numEmitters;
 
+	// Particle budget
+	ParticleBudget m_particleBudget;
+	bool           m_throttled;
+
+	// The emitters to draw in the current frame
+	RenderQueue                   m_renderQueue;
+	std::vector<EmitterInstance*> m_batch;
+
+	// Where frames are submitted
+	IRenderDevice*                m_renderDevice;
+	D3D9RenderDevice*             m_d3dRenderDevice;
+	RecordingRenderDevice*        m_recorder;
+	RenderStats                   m_renderStats;
+	StateCacheRenderDevice*       m_stateCache;		// In front of the recorder and device
+	OverdrawEstimator*            m_overdrawEstimator;
+	OverdrawStats                 m_overdrawStats;
+
+	// The passes of the current frame
+	RenderGraph                   m_renderGraph;
+	int                           m_numRenderPasses;
+
+	// Levels of detail, by increasing distance
+	std::vector<LodLevel> m_lodLevels;
+
+	// Pipelined updating: an update is simulated on the simulation thread
+	// while the previous one is rendered.
+	bool                                 m_pipelined;
+	bool                                 m_updatePending;
+	TimeF                                m_updateTime;
+	unsigned long                        m_numUpdates;
+	std::vector<ParticleSystemInstance*> m_simulated;
+	std::thread                          m_simulationThread;
+	std::mutex                           m_simulationMutex;
+	std::condition_variable              m_simulationCond;
+	bool                                 m_simulating;
+	bool                                 m_quitSimulation;
+
 	// Viewing
-	Camera		m_eye;
-	D3DXMATRIX	m_view;
-    D3DXMATRIX	m_viewInverse;
-	D3DXMATRIX  m_viewRotation;
-	D3DXMATRIX	m_billboard;
-	D3DXMATRIX	m_projection;
-	D3DXMATRIX	m_viewProjection;
+	View		m_mainView;
+	const View*	m_renderView;
+
+	// A window drawn by RenderView. Its swap chain and depth buffer are created
+	// when it's drawn, at the window's size, and released when the device is reset.
+	struct ExtraView
+	{
+		HWND                 hWnd;
+		View                 view;
+		IDirect3DSwapChain9* pSwapChain;
+		IDirect3DSurface9*   pDepthSurface;		// Of the back buffer and the render graph's textures
+		RenderGraph          renderGraph;
+	};
+	std::vector<std::unique_ptr<ExtraView>> m_views;
+	bool                CreateViewTargets(ExtraView& view, UINT width, UINT height);
+	void                ReleaseViewTargets(ExtraView& view);
 
     COLORREF    m_background;
 	bool		m_showGround;
@@ -166,13 +343,31 @@ private:
 
 	// Resources
 	IDirect3DTexture9*	m_pGroundTexture;
-	IDirect3DTexture9*	m_pSceneTexture;
-    IDirect3DSurface9*  m_pDepthStencilSurface;
-	IDirect3DTexture9*	m_pDistortTexture;
+    IDirect3DSurface9*  m_pDepthStencilSurface;	// Of the render graph's textures
+    IDirect3DSurface9*  m_pBackBuffer;			// What the main view is drawn onto
+    IDirect3DSurface9*  m_pBackBufferDepth;
 	Effect*             m_pDistortShader;
     Effect*             m_pShaders[NUM_SHADERS];
 
+	// Constants shared by all shaders, in groups that change together. Each
+	// group has a version that changes with it; a shader gets a group only
+	// when its copy is of an older version.
+	enum ConstantGroup
+	{
+		CONSTANTS_CAMERA,		// Transforms and eye position
+		CONSTANTS_LIGHTING,
+		NUM_CONSTANT_GROUPS
+	};
+	unsigned int        m_constantVersions[NUM_CONSTANT_GROUPS];
+	unsigned int        m_shaderConstantVersions[NUM_SHADERS][NUM_CONSTANT_GROUPS];
+
 	ITextureManager&				m_textureManager;
+
+	// Textures looked up by emitter instances, so spawning doesn't reload them
+	typedef std::map<std::string, IDirect3DTexture9*> TextureMap;
+	mutable TextureMap				m_textures;
+	TextureAtlas*					m_textureAtlas;
+	void                            ClearTextures();
 	IDirect3D9*						m_pDirect3D;
 	D3DPRESENT_PARAMETERS			m_presentationParameters;
 	IDirect3DDevice9*				m_pDevice;
@@ -7,12 +7,19 @@
 #include <cfloat>
 #include <sstream>
 #include <queue>
+#include <functional>
+#include <chrono>
 
 #include "exceptions.h"
 #include "UI/UI.h"
 #include "utils.h"
 #include "engine.h"
 #include "ParticleSystemInstance.h"
+#include "EmissionMesh.h"
+#include "TextureAtlas.h"
+#include "SoftwareRenderDevice.h"
+#include "Flipbook.h"
+#include "Simulation.h"
 #include "Rescale.h"
 #include "resource.h"
 
@@ -28,6 +35,9 @@ static const int VERSION_MINOR = 5;
 // Show up to this amount of files in the File menu
 static const int NUM_HISTORY_ITEMS = 9;
 
+// Edit > Spawn Instance Grid spawns this many instances (5 by 5)
+static const int GRID_INSTANCES    = 25;
+
 static const int N_TRACKS          = 7;
 static const int MIN_WINDOW_WIDTH  = 860;
 static const int MIN_WINDOW_HEIGHT = 750;
@@ -434,10 +444,12 @@ struct APPLICATION_INFO
 
 	Engine*         engine;
 	MouseCursor		mouseCursor;
+	vector<HWND>    views;		// Windows of the engine's extra views, in its order
 
 	ParticleSystem*			 particleSystem;
     ParticleSystem::Emitter* selectedEmitter;
 	ParticleSystemInstance*  attachedParticleSystem;
+	EmissionMesh*            emissionMesh;
 
 	wstring   filename;
 	bool      changed;
@@ -722,6 +734,238 @@ static bool DoOpenFile(APPLICATION_INFO* info)
     return LoadFile(info, filename);
 }
 
+// Loads the mesh that placed particle systems emit from
+static bool DoLoadEmissionMesh(APPLICATION_INFO* info)
+{
+	TCHAR filename[MAX_PATH];
+	filename[0] = L'\0';
+
+    wstring filter = LoadString(IDS_FILES_OBJ) + wstring(L" (*.obj)\0*.OBJ\0", 15)
+                   + LoadString(IDS_FILES_ALL) + wstring(L" (*.*)\0*.*\0", 11);
+
+	OPENFILENAME ofn;
+	memset(&ofn, 0, sizeof(OPENFILENAME));
+	ofn.lStructSize  = sizeof(OPENFILENAME);
+	ofn.hwndOwner    = info->hMainWnd;
+	ofn.hInstance    = info->hInstance;
+    ofn.lpstrFilter  = filter.c_str();
+	ofn.nFilterIndex = 1;
+	ofn.lpstrFile    = filename;
+	ofn.nMaxFile     = MAX_PATH;
+	ofn.Flags        = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST | OFN_HIDEREADONLY;
+	if (GetOpenFileName(&ofn) == 0)
+	{
+		return false;
+	}
+
+	EmissionMesh* mesh = NULL;
+	try
+	{
+		PhysicalFile* file = new PhysicalFile(filename);
+		try
+		{
+			mesh = new EmissionMesh(file);
+		}
+		catch (...)
+		{
+			file->Release();
+			throw;
+		}
+		file->Release();
+	}
+	catch (wexception& e)
+	{
+		MessageBox(info->hMainWnd, LoadString(IDS_ERROR_FILE_OPEN, e.what()).c_str(), NULL, MB_OK | MB_ICONERROR );
+		return false;
+	}
+
+	// Instances that were spawned with the old mesh keep a reference
+	SAFE_RELEASE(info->emissionMesh);
+	info->emissionMesh = mesh;
+	return true;
+}
+
+static bool DoLoadTextureAtlas(APPLICATION_INFO* info)
+{
+	TCHAR filename[MAX_PATH];
+	filename[0] = L'\0';
+
+    wstring filter = LoadString(IDS_FILES_ATLAS) + wstring(L" (*.txt)\0*.TXT\0", 15)
+                   + LoadString(IDS_FILES_ALL)   + wstring(L" (*.*)\0*.*\0", 11);
+
+	OPENFILENAME ofn;
+	memset(&ofn, 0, sizeof(OPENFILENAME));
+	ofn.lStructSize  = sizeof(OPENFILENAME);
+	ofn.hwndOwner    = info->hMainWnd;
+	ofn.hInstance    = info->hInstance;
+    ofn.lpstrFilter  = filter.c_str();
+	ofn.nFilterIndex = 1;
+	ofn.lpstrFile    = filename;
+	ofn.nMaxFile     = MAX_PATH;
+	ofn.Flags        = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST | OFN_HIDEREADONLY;
+	if (GetOpenFileName(&ofn) == 0)
+	{
+		return false;
+	}
+
+	// The atlases are next to the table
+	string directory = WideToAnsi(wstring(filename, ofn.nFileOffset));
+
+	TextureAtlas* atlas = NULL;
+	try
+	{
+		PhysicalFile* file = new PhysicalFile(filename);
+		try
+		{
+			atlas = new TextureAtlas(file, directory);
+		}
+		catch (...)
+		{
+			file->Release();
+			throw;
+		}
+		file->Release();
+	}
+	catch (wexception& e)
+	{
+		MessageBox(info->hMainWnd, LoadString(IDS_ERROR_FILE_OPEN, e.what()).c_str(), NULL, MB_OK | MB_ICONERROR );
+		return false;
+	}
+
+	info->engine->SetTextureAtlas(atlas);
+	atlas->Release();
+	return true;
+}
+
+// Renders the current frame with the software rasterizer, and saves it
+static bool DoSaveReferenceImage(APPLICATION_INFO* info)
+{
+	TCHAR filename[MAX_PATH];
+	filename[0] = L'\0';
+
+    wstring filter = LoadString(IDS_FILES_TGA) + wstring(L" (*.tga)\0*.TGA\0", 15)
+                   + LoadString(IDS_FILES_ALL) + wstring(L" (*.*)\0*.*\0", 11);
+
+	OPENFILENAME ofn;
+	memset(&ofn, 0, sizeof(OPENFILENAME));
+	ofn.lStructSize  = sizeof(OPENFILENAME);
+	ofn.hwndOwner    = info->hMainWnd;
+	ofn.hInstance    = info->hInstance;
+    ofn.lpstrFilter  = filter.c_str();
+    ofn.lpstrDefExt  = L"tga";
+	ofn.nFilterIndex = 1;
+	ofn.lpstrFile    = filename;
+	ofn.nMaxFile     = MAX_PATH;
+	ofn.Flags        = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT;
+	if (GetSaveFileName(&ofn) == 0)
+	{
+		return false;
+	}
+
+	Image image;
+	{
+		IRenderDevice*       previous = info->engine->GetRenderDevice();
+		SoftwareRenderDevice device(*info->engine);
+		info->engine->SetRenderDevice(&device);
+		bool rendered = info->engine->Render(false);
+		info->engine->SetRenderDevice(previous);
+		if (!rendered)
+		{
+			return false;
+		}
+		device.Resolve(image);
+	}
+
+	try
+	{
+		image.SaveTGA(WideToAnsi(filename));
+	}
+	catch (exception& e)
+	{
+		MessageBox(info->hMainWnd, LoadString(IDS_ERROR_FILE_SAVE, AnsiToWide(e.what()).c_str()).c_str(), NULL, MB_OK | MB_ICONERROR );
+		return false;
+	}
+	return true;
+}
+
+// Opens a window that shows the scene through the camera of the main view, as
+// it is now. Its ViewWindowProc adds it to the engine's views.
+static HWND DoNewView(APPLICATION_INFO* info)
+{
+    wstring title = LoadString(IDS_TITLE_VIEW, (int)info->views.size() + 1);
+    return CreateWindow(L"ParticleEditorView", title.c_str(), WS_OVERLAPPEDWINDOW | WS_VISIBLE,
+        CW_USEDEFAULT, CW_USEDEFAULT, 640, 480, info->hMainWnd, NULL, info->hInstance, info);
+}
+
+struct BUDGET_OPTIONS
+{
+    int   budget;
+    float importance;
+};
+
+static INT_PTR CALLBACK ParticleBudgetDialogFunc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+	BUDGET_OPTIONS* options = (BUDGET_OPTIONS*)(LONG_PTR)GetWindowLongPtr(hWnd, GWLP_USERDATA);
+    switch (uMsg)
+    {
+    case WM_INITDIALOG:
+    {
+		options = (BUDGET_OPTIONS*)lParam;
+		SetWindowLongPtr(hWnd, GWLP_USERDATA, (LONG)(LONG_PTR)options);
+        SPINNER_INFO si;
+        si.Mask = SPIF_ALL;
+
+        si.IsFloat     = false;
+        si.i.MinValue  = 0;
+        si.i.MaxValue  = INT_MAX;
+        si.i.Increment = 100;
+        si.i.Value     = options->budget;
+        Spinner_SetInfo(GetDlgItem(hWnd, IDC_SPINNER1), &si);
+
+        si.IsFloat     = true;
+        si.f.MinValue  = 0.01f;
+        si.f.MaxValue  = FLT_MAX;
+        si.f.Increment = 0.1f;
+        si.f.Value     = options->importance;
+        Spinner_SetInfo(GetDlgItem(hWnd, IDC_SPINNER2), &si);
+        break;
+    }
+
+    case WM_COMMAND:
+        if (lParam != 0 && HIWORD(wParam) == BN_CLICKED)
+        {
+            UINT id = LOWORD(wParam);
+            if (id == IDOK)
+            {
+                SPINNER_INFO si;
+                si.Mask = SPIF_VALUE;
+                Spinner_GetInfo(GetDlgItem(hWnd, IDC_SPINNER1), &si); options->budget     = (int)si.i.Value;
+                Spinner_GetInfo(GetDlgItem(hWnd, IDC_SPINNER2), &si); options->importance = si.f.Value;
+            }
+            if (id == IDOK || id == IDCANCEL)
+            {
+                EndDialog(hWnd, (id == IDOK));
+            }
+        }
+        break;
+    }
+    return FALSE;
+}
+
+// Sets the engine's particle budget and the importance of the edited system,
+// which its instances are throttled by
+static bool DoParticleBudget(APPLICATION_INFO* info)
+{
+    BUDGET_OPTIONS options = {info->engine->GetParticleBudget(), info->particleSystem->getImportance()};
+    if (!DialogBoxParam(info->hInstance, MAKEINTRESOURCE(IDD_PARTICLE_BUDGET), info->hMainWnd, ParticleBudgetDialogFunc, (LPARAM)&options))
+    {
+        return false;
+    }
+    info->engine->SetParticleBudget(options.budget);
+    info->particleSystem->setImportance(options.importance);
+    return true;
+}
+
 static bool DoSaveFile(APPLICATION_INFO* info, bool saveas = false)
 {
 	if (info->filename == L"")
@@ -823,15 +1067,26 @@ static bool DoCloseFile(APPLICATION_INFO* info)
 static void DoMenuInit(HMENU hMenu, APPLICATION_INFO* info)
 {
     EnableMenuItem(hMenu, ID_EDIT_CLEARALLPARTICLES, MF_BYCOMMAND | (info->engine == NULL || info->engine->GetNumInstances() > 0 ? MF_ENABLED : MF_GRAYED ));
+    EnableMenuItem(hMenu, ID_EDIT_SPAWNGRID,         MF_BYCOMMAND | (info->engine != NULL && info->particleSystem != NULL ? MF_ENABLED : MF_GRAYED ));
 
     EnableMenuItem(hMenu, ID_NEW_EMITTER_LIFETIME,      MF_BYCOMMAND | (info->selectedEmitter != NULL && info->selectedEmitter->spawnDuringLife == -1 ? MF_ENABLED : MF_GRAYED ));
     EnableMenuItem(hMenu, ID_NEW_EMITTER_DEATH,         MF_BYCOMMAND | (info->selectedEmitter != NULL && info->selectedEmitter->spawnOnDeath    == -1 ? MF_ENABLED : MF_GRAYED ));
     EnableMenuItem(hMenu, ID_EMITTER_RENAME,            MF_BYCOMMAND | (info->selectedEmitter != NULL ? MF_ENABLED : MF_GRAYED ));
     EnableMenuItem(hMenu, ID_EMITTER_RESCALE,           MF_BYCOMMAND | (info->selectedEmitter != NULL ? MF_ENABLED : MF_GRAYED ));
     EnableMenuItem(hMenu, ID_TOGGLE_EMITTER_VISIBILITY, MF_BYCOMMAND | (info->selectedEmitter != NULL ? MF_ENABLED : MF_GRAYED ));
+    EnableMenuItem(hMenu, ID_EMITTERS_CLEARMESH,        MF_BYCOMMAND | (info->emissionMesh != NULL ? MF_ENABLED : MF_GRAYED ));
+    EnableMenuItem(hMenu, ID_EMITTER_SORTPARTICLES,     MF_BYCOMMAND | (info->selectedEmitter != NULL ? MF_ENABLED : MF_GRAYED ));
+    CheckMenuItem (hMenu, ID_EMITTER_SORTPARTICLES,     MF_BYCOMMAND | (info->selectedEmitter != NULL && info->selectedEmitter->sortParticles ? MF_CHECKED : MF_UNCHECKED));
 
     CheckMenuItem (hMenu, ID_VIEW_SHOWGROUND, MF_BYCOMMAND | (info->engine != NULL && info->engine->GetGround()     ? MF_CHECKED : MF_UNCHECKED));
     CheckMenuItem (hMenu, ID_VIEW_DEBUGHEAT,  MF_BYCOMMAND | (info->engine != NULL && info->engine->GetHeatDebug()  ? MF_CHECKED : MF_UNCHECKED));
+    CheckMenuItem (hMenu, ID_VIEW_PIPELINED,  MF_BYCOMMAND | (info->engine != NULL && info->engine->IsPipelined()   ? MF_CHECKED : MF_UNCHECKED));
+    CheckMenuItem (hMenu, ID_VIEW_LOD,        MF_BYCOMMAND | (info->engine != NULL && !info->engine->GetLodLevels().empty() ? MF_CHECKED : MF_UNCHECKED));
+    EnableMenuItem(hMenu, ID_VIEW_LOADATLAS,  MF_BYCOMMAND | (info->engine != NULL ? MF_ENABLED : MF_GRAYED));
+    EnableMenuItem(hMenu, ID_VIEW_CLEARATLAS, MF_BYCOMMAND | (info->engine != NULL && info->engine->GetTextureAtlas() != NULL ? MF_ENABLED : MF_GRAYED));
+    EnableMenuItem(hMenu, ID_VIEW_REFERENCEIMAGE, MF_BYCOMMAND | (info->engine != NULL ? MF_ENABLED : MF_GRAYED));
+    EnableMenuItem(hMenu, ID_VIEW_NEWVIEW,    MF_BYCOMMAND | (info->engine != NULL ? MF_ENABLED : MF_GRAYED));
+    EnableMenuItem(hMenu, ID_VIEW_PARTICLEBUDGET, MF_BYCOMMAND | (info->engine != NULL && info->particleSystem != NULL ? MF_ENABLED : MF_GRAYED));
 }
 
 static bool DoMenuItem(APPLICATION_INFO* info, UINT id)
@@ -863,6 +1118,16 @@ static bool DoMenuItem(APPLICATION_INFO* info, UINT id)
             }
             break;
 
+        case ID_EDIT_SPAWNGRID:
+            if (info->engine != NULL && info->particleSystem != NULL)
+            {
+                // A crowd of instances, to see how the system holds up
+                vector<D3DXVECTOR3> positions;
+                GetGridPositions(GRID_INSTANCES, FixedStepSimulation::SPACING, D3DXVECTOR3(0,0,0), positions);
+                info->engine->SpawnParticleSystems(*info->particleSystem, positions.data(), positions.size(), info->emissionMesh);
+            }
+            break;
+
         case ID_NEW_EMITTER_ROOT:          EmitterList_AddRootEmitter(info->hEmitterList); break;
         case ID_NEW_EMITTER_LIFETIME:      EmitterList_AddLifetimeEmitter(info->hEmitterList); break;
         case ID_NEW_EMITTER_DEATH:         EmitterList_AddDeathEmitter(info->hEmitterList); break;
@@ -870,6 +1135,14 @@ static bool DoMenuItem(APPLICATION_INFO* info, UINT id)
         case ID_TOGGLE_EMITTER_VISIBILITY: EmitterList_ToggleEmitterVisibility(info->hEmitterList); break;
         case ID_SHOW_ALL_EMITTERS:         EmitterList_SetAllEmitterVisibility(info->hEmitterList, true);  break;
         case ID_HIDE_ALL_EMITTERS:         EmitterList_SetAllEmitterVisibility(info->hEmitterList, false); break;
+        case ID_EMITTERS_LOADMESH:         DoLoadEmissionMesh(info); break;
+        case ID_EMITTERS_CLEARMESH:        SAFE_RELEASE(info->emissionMesh); break;
+        case ID_EMITTER_SORTPARTICLES:
+            if (info->selectedEmitter != NULL)
+            {
+                info->selectedEmitter->sortParticles = !info->selectedEmitter->sortParticles;
+            }
+            break;
         case ID_EMITTERS_RESCALE:
             if (info->selectedEmitter != NULL)
             {
@@ -897,6 +1170,65 @@ static bool DoMenuItem(APPLICATION_INFO* info, UINT id)
             }
 			break;
 
+		case ID_VIEW_PIPELINED:
+            if (info->engine != NULL)
+            {
+			    info->engine->SetPipelined(!info->engine->IsPipelined());
+            }
+			break;
+
+		case ID_VIEW_LOD:
+            if (info->engine != NULL)
+            {
+                vector<Engine::LodLevel> levels;
+                if (info->engine->GetLodLevels().empty())
+                {
+                    // Distance, spawn scale, minimum size, heat
+                    static const Engine::LodLevel DefaultLevels[] = {
+                        {  750.0f, 0.5f,  0.0f, true  },
+                        { 1500.0f, 0.25f, 5.0f, false },
+                    };
+                    levels.assign(DefaultLevels, DefaultLevels + 2);
+                }
+                info->engine->SetLodLevels(levels);
+            }
+			break;
+
+		case ID_VIEW_LOADATLAS:
+            if (info->engine != NULL)
+            {
+                DoLoadTextureAtlas(info);
+            }
+			break;
+
+		case ID_VIEW_CLEARATLAS:
+            if (info->engine != NULL)
+            {
+                info->engine->SetTextureAtlas(NULL);
+            }
+			break;
+
+		case ID_VIEW_REFERENCEIMAGE:
+            if (info->engine != NULL)
+            {
+                DoSaveReferenceImage(info);
+            }
+			break;
+
+		case ID_VIEW_NEWVIEW:
+            if (info->engine != NULL)
+            {
+                DoNewView(info);
+            }
+			break;
+
+		case ID_VIEW_PARTICLEBUDGET:
+            if (info->engine != NULL && info->particleSystem != NULL)
+            {
+                DoParticleBudget(info);
+            }
+			break;
+
         case ID_VIEW_RESETCAMERA:
             if (info->engine != NULL)
             {
@@ -924,6 +1256,11 @@ static void Render(APPLICATION_INFO* info)
 	// Update and Render!
 	info->engine->Update();
     info->engine->Render();
+    for (int i = 0; i < info->engine->GetNumViews(); i++)
+    {
+        // The extra views draw the same update
+        info->engine->RenderView(i);
+    }
     measurer.measure();
 
     const D3DXVECTOR3 cursor = info->mouseCursor.GetPosition();
@@ -932,7 +1269,15 @@ static void Render(APPLICATION_INFO* info)
     // Update status bar
     SendMessage(info->hStatusBar, SB_SETTEXT, 0, (LPARAM)LoadString(IDS_STATUS_INSTANCES, info->engine->GetNumInstances(), info->engine->GetNumEmitters()).c_str());
     SendMessage(info->hStatusBar, SB_SETTEXT, 1, (LPARAM)LoadString(IDS_STATUS_PARTICLES, info->engine->GetNumParticles()).c_str());
-    SendMessage(info->hStatusBar, SB_SETTEXT, 2, (LPARAM)LoadString(IDS_STATUS_FPS,       (int)measurer.getFPS()).c_str());
+    SendMessage(info->hStatusBar, SB_SETTEXT, 3, (LPARAM)LoadString(IDS_STATUS_FPS,       (int)measurer.getFPS()).c_str());
+    if (info->engine->GetParticleBudget() > 0)
+    {
+        SendMessage(info->hStatusBar, SB_SETTEXT, 2, (LPARAM)LoadString(IDS_STATUS_BUDGET, info->engine->GetParticleBudget(), info->engine->GetNumThrottled(), info->engine->GetNumCulled()).c_str());
+    }
+    else
+    {
+        SendMessage(info->hStatusBar, SB_SETTEXT, 2, (LPARAM)LoadString(IDS_STATUS_NO_BUDGET).c_str());
+    }
 }
 
 static LRESULT CALLBACK MainWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
@@ -1021,9 +1366,9 @@ static LRESULT CALLBACK MainWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPAR
 				return -1;
 			}
 
-            INT widths[] = {140, 230, 280, 475, -1};
-            SendMessage(info->hStatusBar, SB_SETPARTS, 5, (LPARAM)widths);
-            SendMessage(info->hStatusBar, SB_SETTEXT, 4, (LPARAM)LoadString(IDS_STATUS_SHIFT_TO_SPAWN).c_str());
+            INT widths[] = {140, 230, 410, 460, 655, -1};
+            SendMessage(info->hStatusBar, SB_SETPARTS, 6, (LPARAM)widths);
+            SendMessage(info->hStatusBar, SB_SETTEXT, 5, (LPARAM)LoadString(IDS_STATUS_SHIFT_TO_SPAWN).c_str());
 
 			//
 			// Create the track tab window
@@ -1102,6 +1447,7 @@ static LRESULT CALLBACK MainWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPAR
             }
 			delete info->particleSystem;
 			info->particleSystem = NULL;
+			SAFE_RELEASE(info->emissionMesh);
 			PostQuitMessage(0);
 			break;
 
@@ -1323,6 +1669,42 @@ static void GetCursorPos3D(Engine* engine, short x, short y, D3DXVECTOR3& positi
 	D3DXPlaneIntersectLine(&position, &plane, &front, &back);
 }
 
+// An extra view of the engine (see Engine::AddView). The main loop draws it
+// after the main view; it is removed from the engine when it's closed.
+static LRESULT CALLBACK ViewWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+	APPLICATION_INFO* info = (APPLICATION_INFO*)(LONG_PTR)GetWindowLongPtr(hWnd, GWLP_USERDATA);
+	switch (uMsg)
+	{
+		case WM_CREATE:
+		{
+			CREATESTRUCT* pcs = (CREATESTRUCT*)lParam;
+			info = (APPLICATION_INFO*)pcs->lpCreateParams;
+			SetWindowLongPtr(hWnd, GWLP_USERDATA, (LONG)(LONG_PTR)info);
+			info->engine->AddView(hWnd, info->engine->GetCamera());
+			info->views.push_back(hWnd);
+			break;
+		}
+
+		case WM_PAINT:
+		{
+			// Draw the last update again
+			int view = (int)(find(info->views.begin(), info->views.end(), hWnd) - info->views.begin());
+			info->engine->RenderView(view);
+			break;
+		}
+
+		case WM_DESTROY:
+		{
+			vector<HWND>::iterator p = find(info->views.begin(), info->views.end(), hWnd);
+			info->engine->RemoveView((int)(p - info->views.begin()));
+			info->views.erase(p);
+			break;
+		}
+	}
+	return DefWindowProc(hWnd, uMsg, wParam, lParam);
+}
+
 static LRESULT CALLBACK RenderWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
 	APPLICATION_INFO* info = (APPLICATION_INFO*)(LONG_PTR)GetWindowLongPtr(hWnd, GWLP_USERDATA);
@@ -1392,10 +1774,10 @@ static LRESULT CALLBACK RenderWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LP
 				// Spawn cursor-bound particle system
 				D3DXVECTOR3 position;
 				GetCursorPos3D(info->engine, (SHORT)LOWORD(lParam), (SHORT)HIWORD(lParam), position);
-				info->attachedParticleSystem = info->engine->SpawnParticleSystem(*info->particleSystem, &info->mouseCursor);
+				info->attachedParticleSystem = info->engine->SpawnParticleSystem(*info->particleSystem, &info->mouseCursor, info->emissionMesh);
 
                 // Clear statusbar hint
-                SendMessage(info->hStatusBar, SB_SETTEXT, 4, (LPARAM)L"");
+                SendMessage(info->hStatusBar, SB_SETTEXT, 5, (LPARAM)L"");
 			}
 			break;
 
@@ -1472,7 +1854,7 @@ static LRESULT CALLBACK RenderWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LP
             }
 
             // Update statusbar
-            SendMessage(info->hStatusBar, SB_SETTEXT, 3, (LPARAM)LoadString(IDS_STATUS_MOUSE, cursor.x, cursor.y, cursor.z).c_str());
+            SendMessage(info->hStatusBar, SB_SETTEXT, 4, (LPARAM)LoadString(IDS_STATUS_MOUSE, cursor.x, cursor.y, cursor.z).c_str());
             break;
         }
 
@@ -1575,7 +1957,8 @@ static void getGamePath_Shell(vector<wstring>& strings)
 	}
 }
 
-static FileManager* createFileManager( HWND hWnd, const vector<wstring>& argv )
+// Without 'interactive', a missing data path fails instead of asking for one
+static FileManager* createFileManager( HWND hWnd, const vector<wstring>& argv, bool interactive )
 {
 	// Search for the Empire at War path
 	vector<wstring> EmpireAtWarPaths;
@@ -1624,6 +2007,11 @@ static FileManager* createFileManager( HWND hWnd, const vector<wstring>& argv )
 		}
 		catch (FileNotFoundException&)
 		{
+			if (!interactive)
+			{
+				break;
+			}
+
 			// This path didn't work; ask the user to select a path
             const wstring title = LoadString(IDS_QUERY_DATA_PATH);
 
@@ -1652,13 +2040,596 @@ static FileManager* createFileManager( HWND hWnd, const vector<wstring>& argv )
 	return fileManager;
 }
 
-void main( APPLICATION_INFO* info, const vector<wstring>& argv )
+static bool ParseVector(const wstring& str, D3DXVECTOR3& v)
 {
-	FileManager* fileManager = createFileManager( info->hMainWnd, argv );
+	return swscanf(str.c_str(), L"%f,%f,%f", &v.x, &v.y, &v.z) == 3;
+}
+
+static wstring GetBaseName(const wstring& filename)
+{
+	wstring name = filename;
+	size_t pos = name.find_last_of('\\');
+	if (pos != wstring::npos) name = name.substr(pos + 1);
+	pos = name.find_last_of('.');
+	if (pos != wstring::npos) name = name.substr(0, pos);
+	return name;
+}
+
+// Sizes the render window's client area, and with it the back buffer
+static void SetRenderSize(APPLICATION_INFO* info, unsigned int width, unsigned int height)
+{
+	RECT rect = {0, 0, (LONG)width, (LONG)height};
+	AdjustWindowRectEx(&rect, GetWindowLong(info->hRenderWnd, GWL_STYLE), FALSE, GetWindowLong(info->hRenderWnd, GWL_EXSTYLE));
+	SetWindowPos(info->hRenderWnd, NULL, 0, 0, rect.right - rect.left, rect.bottom - rect.top, SWP_NOMOVE | SWP_NOZORDER);
+}
+
+//
+// The options that the headless modes share: the simulated frames, and the
+// camera they're seen from. Arguments that aren't options are files, save for
+// directories, which are data paths for createFileManager.
+//
+struct HeadlessOptions
+{
+	vector<wstring> files;
+	unsigned int    numFrames;
+	float           duration;		// Seconds of simulation the frames span
+	unsigned int    seed;
+	Engine::Camera  camera;
+
+	HeadlessOptions(unsigned int numFrames) : numFrames(numFrames), duration(2.0f), seed(0)
+	{
+		camera.Position = D3DXVECTOR3(0,-250,125);
+		camera.Target   = D3DXVECTOR3(0,0,0);
+		camera.Up       = D3DXVECTOR3(0,0,1);
+	}
+};
+
+// Parses the arguments after the mode. The mode's own options are passed to
+// 'option' with their value; it returns false for options it doesn't know or
+// values it doesn't accept. Returns false for invalid arguments.
+static bool ParseHeadlessOptions(const vector<wstring>& argv, HeadlessOptions& options, const function<bool(const wstring&, const wstring&)>& option)
+{
+	for (size_t i = 2; i < argv.size(); i++)
+	{
+		const wstring& arg = argv[i];
+		if (arg[0] != L'-')
+		{
+			if (!PathIsDirectory(arg.c_str()))
+			{
+				options.files.push_back(arg);
+			}
+			continue;
+		}
+
+		if (i + 1 == argv.size())
+		{
+			return false;
+		}
+
+		const wstring& value = argv[++i];
+		bool valid = true;
+		if      (arg == L"-frames")   valid = (options.numFrames = _wtoi(value.c_str())) > 0;
+		else if (arg == L"-duration") valid = (options.duration  = (float)_wtof(value.c_str())) > 0;
+		else if (arg == L"-seed")     options.seed = _wtoi(value.c_str());
+		else if (arg == L"-camera")   valid = ParseVector(value, options.camera.Position);
+		else if (arg == L"-target")   valid = ParseVector(value, options.camera.Target);
+		else valid = option(arg, value);
+
+		if (!valid)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Parses a positive number for an option
+static bool ParseSize(const wstring& value, unsigned int& size)
+{
+	int n = _wtoi(value.c_str());
+	size = (unsigned int)max(n, 0);
+	return n > 0;
+}
+
+// Loads a particle system for a headless mode. Errors are reported on the
+// console; returns NULL then.
+static ParticleSystem* LoadHeadlessSystem(const wstring& filename)
+{
+	try
+	{
+		PhysicalFile* file = new PhysicalFile(filename);
+		try
+		{
+			ParticleSystem* system = new ParticleSystem(file);
+			file->Release();
+			return system;
+		}
+		catch (...)
+		{
+			file->Release();
+			throw;
+		}
+	}
+	catch (wexception& e)
+	{
+		fwprintf(stderr, L"%ls: %ls\n", filename.c_str(), e.what());
+	}
+	catch (exception& e)
+	{
+		fwprintf(stderr, L"%ls: %hs\n", filename.c_str(), e.what());
+	}
+	return NULL;
+}
+
+//
+// ParticleEditor -bake <input.alo> <output.alo> [-frames n] [-size pixels] [-duration seconds]
+//                [-camera x,y,z] [-target x,y,z] [-seed n] [data path]
+//
+// Bakes the input system into a flipbook atlas, saved as a Targa image next to
+// the output, and writes a system that plays it on a single billboard.
+// Nothing is shown; errors go to the console and the exit code.
+//
+static int DoBake(APPLICATION_INFO* info, const vector<wstring>& argv)
+{
+	HeadlessOptions options(16);
+	unsigned int    frameSize = 128;
+	bool valid = ParseHeadlessOptions(argv, options, [&](const wstring& arg, const wstring& value) {
+		return arg == L"-size" && ParseSize(value, frameSize);
+	});
+
+	if (!valid || options.files.size() != 2)
+	{
+		fprintf(stderr, "Usage: ParticleEditor -bake <input.alo> <output.alo> [-frames n] [-size pixels]\n"
+		                "       [-duration seconds] [-camera x,y,z] [-target x,y,z] [-seed n] [data path]\n");
+		return 2;
+	}
+
+	if (info->engine == NULL)
+	{
+		fprintf(stderr, "Unable to initialize the renderer\n");
+		return 1;
+	}
+
+	FlipbookSettings settings;
+	settings.numFrames = options.numFrames;
+	settings.frameSize = frameSize;
+	settings.duration  = options.duration;
+	settings.camera    = options.camera;
+	settings.seed      = options.seed;
+	const vector<wstring>& files = options.files;
+
+	// The back buffer is one frame
+	SetRenderSize(info, settings.frameSize, settings.frameSize);
+
+	// The atlas goes next to the output, under the same name
+	TCHAR atlasFile[MAX_PATH];
+	wcsncpy(atlasFile, files[1].c_str(), MAX_PATH - 5);
+	atlasFile[MAX_PATH - 5] = L'\0';
+	PathRenameExtension(atlasFile, L".tga");
+
+	wstring name = GetBaseName(files[1]);
+	transform(name.begin(), name.end(), name.begin(), tolower);
+
+	ParticleSystem* system = LoadHeadlessSystem(files[0]);
+	if (system == NULL)
+	{
+		return 1;
+	}
+
+	settings.blendMode = GetFlipbookBlendMode(*system);
+	try
+	{
+		Image atlas;
+		float size = BakeFlipbook(*info->engine, *system, settings, atlas);
+		atlas.SaveTGA(WideToAnsi(atlasFile));
+
+		ParticleSystem flipbook;
+		CreateFlipbookSystem(flipbook, settings, WideToAnsi(PathFindFileName(atlasFile)), size);
+		flipbook.setName(WideToAnsi(name,"_"));
+
+		PhysicalFile* file = new PhysicalFile(files[1], PhysicalFile::WRITE);
+		try
+		{
+			flipbook.write(file);
+			file->Release();
+		}
+		catch (...)
+		{
+			file->Release();
+			throw;
+		}
+	}
+	catch (wexception& e)
+	{
+		delete system;
+		fwprintf(stderr, L"%ls\n", e.what());
+		return 1;
+	}
+	catch (exception& e)
+	{
+		delete system;
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	delete system;
+
+	printf("Baked %u frames of %ux%u pixels into %ls\n", settings.numFrames, settings.frameSize, settings.frameSize, atlasFile);
+	return 0;
+}
+
+//
+// ParticleEditor -overdraw <input.alo> [-width pixels] [-height pixels] [-frames n]
+//                [-duration seconds] [-camera x,y,z] [-target x,y,z] [-seed n] [data path]
+//
+// Simulates the system at a fixed rate and prints its estimated fill at
+// evenly spaced frames (see OverdrawEstimator), then what each emitter adds
+// to the frame that shades the most pixels. Nothing is drawn or shown.
+//
+static int DoOverdraw(APPLICATION_INFO* info, const vector<wstring>& argv)
+{
+	HeadlessOptions options(20);
+	unsigned int    width  = 1024;
+	unsigned int    height = 768;
+	bool valid = ParseHeadlessOptions(argv, options, [&](const wstring& arg, const wstring& value) {
+		return (arg == L"-width"  && ParseSize(value, width))
+		    || (arg == L"-height" && ParseSize(value, height));
+	});
+
+	if (!valid || options.files.size() != 1)
+	{
+		fprintf(stderr, "Usage: ParticleEditor -overdraw <input.alo> [-width pixels] [-height pixels] [-frames n]\n"
+		                "       [-duration seconds] [-camera x,y,z] [-target x,y,z] [-seed n] [data path]\n");
+		return 2;
+	}
+
+	if (info->engine == NULL)
+	{
+		fprintf(stderr, "Unable to initialize the renderer\n");
+		return 1;
+	}
+	Engine& engine = *info->engine;
+	SetRenderSize(info, width, height);
+
+	ParticleSystem* system = LoadHeadlessSystem(options.files[0]);
+	if (system == NULL)
+	{
+		return 1;
+	}
+
+	FixedStepSimulation simulation(engine, *system, options.camera, options.seed);
+
+	// The frames are only queued and estimated, not drawn
+	NullRenderDevice device;
+	engine.SetRenderDevice(&device);
+	engine.SetEstimateOverdraw(true);
+
+	printf("%8s %12s %12s %8s %6s\n", "time", "pixels", "covered", "average", "peak");
+	OverdrawStats worst;
+	TimeF         worstTime = 0;
+	bool          rendered  = true;
+	for (unsigned int frame = 0; frame < options.numFrames && rendered; frame++)
+	{
+		simulation.StepTo(options.duration * frame / max(options.numFrames - 1, 1u));
+
+		rendered = engine.Render(false);
+		const OverdrawStats& stats = engine.GetOverdrawStats();
+		printf("%8.3f %12lu %12lu %8.2f %6u\n", simulation.GetTime(), stats.pixels, stats.coveredPixels, stats.GetAverageOverdraw(), stats.peakOverdraw);
+		if (stats.pixels > worst.pixels)
+		{
+			worst     = stats;
+			worstTime = simulation.GetTime();
+		}
+	}
+
+	engine.SetEstimateOverdraw(false);
+	engine.SetRenderDevice(NULL);
+	engine.Clear();
+	delete system;
+
+	if (!rendered)
+	{
+		fprintf(stderr, "Unable to render the frames\n");
+		return 1;
+	}
+
+	if (!worst.emitters.empty())
+	{
+		printf("\nEmitters at %.3f seconds, with %lu pixels (%.1f screens):\n", worstTime, worst.pixels, (float)worst.pixels / (width * height));
+		printf("%-32s %10s %12s %7s\n", "emitter", "particles", "pixels", "share");
+		for (size_t i = 0; i < worst.emitters.size(); i++)
+		{
+			const OverdrawStats::Emitter& emitter = worst.emitters[i];
+			printf("%-32s %10lu %12lu %6.1f%%\n", emitter.emitter->name.c_str(), emitter.particles, emitter.pixels, 100.0f * emitter.pixels / worst.pixels);
+		}
+	}
+	return 0;
+}
+
+//
+// ParticleEditor -rasterbench <input.alo> [-width pixels] [-height pixels] [-frames n] [-threads n]
+//                [-instances n] [-duration seconds] [-camera x,y,z] [-target x,y,z] [-seed n]
+//                [-output file.tga] [data path]
+//
+// Measures the software rasterizer with a real particle system: simulates it
+// at a fixed rate, and draws evenly spaced frames with a SoftwareRenderDevice.
+// Simulating, which expands the emitters into quads, and drawing are timed
+// apart. 0 threads uses one per hardware thread. Several instances are
+// spawned in a grid. The last frame can be saved.
+//
+static int DoRasterBench(APPLICATION_INFO* info, const vector<wstring>& argv)
+{
+	HeadlessOptions options(60);
+	unsigned int    width   = 1280;
+	unsigned int    height  = 720;
+	unsigned int    threads = 0;
+	unsigned int    numInstances = 1;
+	wstring         output;
+	bool valid = ParseHeadlessOptions(argv, options, [&](const wstring& arg, const wstring& value) {
+		if (arg == L"-instances")
+		{
+			return ParseSize(value, numInstances);
+		}
+		if (arg == L"-threads")
+		{
+			int n = _wtoi(value.c_str());
+			threads = (unsigned int)max(n, 0);
+			return n >= 0;
+		}
+		if (arg == L"-output")
+		{
+			output = value;
+			return true;
+		}
+		return (arg == L"-width"  && ParseSize(value, width))
+		    || (arg == L"-height" && ParseSize(value, height));
+	});
+
+	if (!valid || options.files.size() != 1)
+	{
+		fprintf(stderr, "Usage: ParticleEditor -rasterbench <input.alo> [-width pixels] [-height pixels] [-frames n] [-threads n]\n"
+		                "       [-instances n] [-duration seconds] [-camera x,y,z] [-target x,y,z] [-seed n]\n"
+		                "       [-output file.tga] [data path]\n");
+		return 2;
+	}
+
+	if (info->engine == NULL)
+	{
+		fprintf(stderr, "Unable to initialize the renderer\n");
+		return 1;
+	}
+	Engine& engine = *info->engine;
+	SetRenderSize(info, width, height);
+
+	ParticleSystem* system = LoadHeadlessSystem(options.files[0]);
+	if (system == NULL)
+	{
+		return 1;
+	}
+
+	FixedStepSimulation simulation(engine, *system, options.camera, options.seed, numInstances);
+
+	// The recorder counts what the emitters submit
+	SoftwareRenderDevice device(engine, threads);
+	engine.SetRenderDevice(&device);
+	engine.SetRecordRenderStats(true);
+
+	typedef chrono::steady_clock Clock;
+	Clock::duration simulating(0), drawing(0);
+	unsigned long   numParticles = 0, numTriangles = 0;
+	bool            rendered     = true;
+	for (unsigned int frame = 0; frame < options.numFrames && rendered; frame++)
+	{
+		Clock::time_point start = Clock::now();
+		simulation.StepTo(options.duration * frame / max(options.numFrames - 1, 1u));
+		Clock::time_point simulated = Clock::now();
+		rendered = engine.Render(false);
+		Clock::time_point drawn = Clock::now();
+
+		simulating   += simulated - start;
+		drawing      += drawn - simulated;
+		numParticles += engine.GetNumParticles();
+		numTriangles += engine.GetRenderStats().primitives;
+	}
+
+	Image image;
+	device.Resolve(image);
+	engine.SetRecordRenderStats(false);
+	engine.SetRenderDevice(NULL);
+	engine.Clear();
+	delete system;
+
+	if (!rendered)
+	{
+		fprintf(stderr, "Unable to render the frames\n");
+		return 1;
+	}
+
+	const double simulateSeconds = chrono::duration<double>(simulating).count();
+	const double drawSeconds     = chrono::duration<double>(drawing).count();
+	printf("%u frames of %ux%u, %.0f particles and %.0f triangles per frame\n",
+		options.numFrames, width, height, (double)numParticles / options.numFrames, (double)numTriangles / options.numFrames);
+	printf("simulating: %.2f ms/frame\n", 1000 * simulateSeconds / options.numFrames);
+	printf("drawing:    %.2f ms/frame, %.2f Mtriangles/s\n", 1000 * drawSeconds / options.numFrames, numTriangles / max(drawSeconds, 1e-9) / 1e6);
+
+	if (!output.empty())
+	{
+		try
+		{
+			image.SaveTGA(WideToAnsi(output));
+		}
+		catch (exception& e)
+		{
+			fprintf(stderr, "%s\n", e.what());
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//
+// ParticleEditor -viewtest <input.alo> [-width pixels] [-height pixels] [-instances n]
+//                [-duration seconds] [-camera x,y,z] [-target x,y,z] [-seed n] [data path]
+//
+// Checks the extra views (see Engine::AddView). Spawns a grid of instances
+// of the system in one go (see Engine::SpawnParticleSystems), which must
+// each start with the root emitters. Simulates them for the
+// duration, and draws the last update in the main view and in two views, in
+// hidden windows of the same size, with the render stats recorded. The views
+// must not simulate, and must add as many draws to the stats as the main
+// view. Then a pipelined update, which Render simulates, must be simulated
+// once too. Nothing is shown; returns 0 when all checks pass.
+//
+static int DoViewTest(APPLICATION_INFO* info, const vector<wstring>& argv)
+{
+	static const int NUM_VIEWS = 2;
+
+	HeadlessOptions options(1);
+	unsigned int    width  = 320;
+	unsigned int    height = 240;
+	unsigned int    numInstances = 4;
+	bool valid = ParseHeadlessOptions(argv, options, [&](const wstring& arg, const wstring& value) {
+		return (arg == L"-width"     && ParseSize(value, width))
+		    || (arg == L"-height"    && ParseSize(value, height))
+		    || (arg == L"-instances" && ParseSize(value, numInstances));
+	});
+
+	if (!valid || options.files.size() != 1)
+	{
+		fprintf(stderr, "Usage: ParticleEditor -viewtest <input.alo> [-width pixels] [-height pixels] [-instances n]\n"
+		                "       [-duration seconds] [-camera x,y,z] [-target x,y,z] [-seed n] [data path]\n");
+		return 2;
+	}
+
+	if (info->engine == NULL)
+	{
+		fprintf(stderr, "Unable to initialize the renderer\n");
+		return 1;
+	}
+	Engine& engine = *info->engine;
+	SetRenderSize(info, width, height);
+
+	ParticleSystem* system = LoadHeadlessSystem(options.files[0]);
+	if (system == NULL)
+	{
+		return 1;
+	}
+
+	int failures = 0;
+	auto check = [&failures](const char* what, unsigned long actual, unsigned long expected) {
+		if (actual != expected)
+		{
+			printf("FAILED: %s is %lu, expected %lu\n", what, actual, expected);
+			failures++;
+		}
+	};
+
+	// Particles that spawn with their emitter can start child emitters right
+	// away, so with those only the root emitters are certain
+	vector<size_t> roots;
+	ParticleSystemInstance::GetRootEmitters(*system, roots);
+	const bool hasChildren = roots.size() < system->getEmitters().size();
+
+	FixedStepSimulation simulation(engine, *system, options.camera, options.seed, numInstances);
+	const unsigned long rootEmitters = (unsigned long)(numInstances * roots.size());
+	check("instances", engine.GetNumInstances(), numInstances);
+	check("emitters",  hasChildren ? min<unsigned long>(engine.GetNumEmitters(), rootEmitters) : engine.GetNumEmitters(), rootEmitters);
+	simulation.StepTo(options.duration);
+
+	// The windows add themselves to the engine's views, with the main camera
+	RECT rect = {0, 0, (LONG)width, (LONG)height};
+	AdjustWindowRect(&rect, WS_OVERLAPPEDWINDOW, FALSE);
+	for (int i = 0; i < NUM_VIEWS; i++)
+	{
+		CreateWindow(L"ParticleEditorView", NULL, WS_OVERLAPPEDWINDOW, 0, 0, rect.right - rect.left, rect.bottom - rect.top,
+			info->hMainWnd, NULL, info->hInstance, info);
+	}
+	check("views", engine.GetNumViews(), NUM_VIEWS);
+
+	engine.SetRecordRenderStats(true);
+	for (int pipelined = 0; pipelined < 2 && failures == 0; pipelined++)
+	{
+		unsigned long updates = engine.GetNumUpdates();
+		if (pipelined)
+		{
+			// Update only schedules the step; Render simulates it
+			engine.SetPipelined(true);
+			SetTimeF(simulation.GetTime() + FixedStepSimulation::STEP);
+			engine.Update();
+			updates++;
+		}
+
+		bool rendered = engine.Render(false);
+		const RenderStats main      = engine.GetRenderStats();
+		const int         particles = engine.GetNumParticles();
+		for (int i = 0; i < NUM_VIEWS; i++)
+		{
+			rendered = engine.RenderView(i, false) && rendered;
+		}
+		if (!rendered)
+		{
+			fprintf(stderr, "Unable to render the views\n");
+			failures++;
+			break;
+		}
+
+		const RenderStats& stats = engine.GetRenderStats();
+		check(pipelined ? "pipelined updates"   : "updates",   engine.GetNumUpdates(),   updates);
+		check(pipelined ? "pipelined particles" : "particles", engine.GetNumParticles(), particles);
+		check(pipelined ? "pipelined scenes"    : "scenes",    stats.scenes,             (1 + NUM_VIEWS) * main.scenes);
+		if (!pipelined)
+		{
+			// The pipelined main view draws the update before the one the
+			// views draw, so only the same update is compared
+			check("draws",      stats.draws,      (1 + NUM_VIEWS) * main.draws);
+			check("primitives", stats.primitives, (1 + NUM_VIEWS) * main.primitives);
+			if (main.primitives == 0)
+			{
+				printf("FAILED: nothing was drawn\n");
+				failures++;
+			}
+		}
+	}
+	engine.SetRecordRenderStats(false);
+	engine.SetPipelined(false);
+
+	while (!info->views.empty())
+	{
+		DestroyWindow(info->views.back());
+	}
+	check("views after closing them", engine.GetNumViews(), 0);
+	engine.Clear();
+	delete system;
+
+	if (failures == 0)
+	{
+		printf("All checks passed\n");
+	}
+	return (failures == 0) ? 0 : 1;
+}
+
+int main( APPLICATION_INFO* info, const vector<wstring>& argv )
+{
+	const bool bake        = (argv.size() > 1 && argv[1] == L"-bake");
+	const bool overdraw    = (argv.size() > 1 && argv[1] == L"-overdraw");
+	const bool rasterBench = (argv.size() > 1 && argv[1] == L"-rasterbench");
+	const bool viewTest    = (argv.size() > 1 && argv[1] == L"-viewtest");
+	const bool headless    = bake || overdraw || rasterBench || viewTest;
+	if (headless && AttachConsole(ATTACH_PARENT_PROCESS))
+	{
+		// Report to the console we were started from
+		freopen("conout$", "wb", stdout);
+		freopen("conout$", "wb", stderr);
+	}
+
+	FileManager* fileManager = createFileManager( info->hMainWnd, argv, !headless );
 	if (fileManager == NULL)
 	{
 		// No file manager, no play
-		return;
+		if (headless)
+		{
+			fprintf(stderr, "Unable to find the game data\n");
+		}
+		return 1;
 	}
 
 	try
@@ -1678,6 +2649,13 @@ void main( APPLICATION_INFO* info, const vector<wstring>& argv )
             DestroyWindow(info->hRenderWnd);
         }
 		
+		if (headless)
+		{
+			int result = bake ? DoBake(info, argv) : overdraw ? DoOverdraw(info, argv) : rasterBench ? DoRasterBench(info, argv) : DoViewTest(info, argv);
+			delete fileManager;
+			return result;
+		}
+
 		DoCloseFile(info);
 
         bool loaded = false;
@@ -1735,6 +2713,7 @@ void main( APPLICATION_INFO* info, const vector<wstring>& argv )
 		delete fileManager;
 		throw;
 	}
+	return 0;
 }
 
 static bool InitializeWindows( APPLICATION_INFO* info )
@@ -1770,9 +2749,21 @@ static bool InitializeWindows( APPLICATION_INFO* info )
 		return false;
 	}
 
+	wcx.lpfnWndProc   = ViewWindowProc;
+	wcx.hIcon         = LoadIcon(GetModuleHandle(NULL), MAKEINTRESOURCE(IDI_LOGO));
+	wcx.lpszClassName = L"ParticleEditorView";
+
+	if (!RegisterClassEx(&wcx))
+	{
+		UnregisterClass(L"ParticleEditorRenderer", info->hInstance);
+		UnregisterClass(L"ParticleEditor", info->hInstance);
+		return false;
+	}
+
 	if ((info->hMainWnd = CreateWindow(L"ParticleEditor", L"Particle Editor", WS_OVERLAPPEDWINDOW | WS_CLIPCHILDREN | WS_GROUP,
 		50, 50, 1150, 850, NULL, NULL, info->hInstance, info)) == NULL)
 	{
+		UnregisterClass(L"ParticleEditorView", info->hInstance);
 		UnregisterClass(L"ParticleEditorRenderer", info->hInstance);
 		UnregisterClass(L"ParticleEditor", info->hInstance);
 		return false;
@@ -1783,6 +2774,7 @@ static bool InitializeWindows( APPLICATION_INFO* info )
 		400, 4, 100, 100, info->hMainWnd, NULL, info->hInstance, info)) == NULL)
 	{
 		DestroyWindow(info->hMainWnd);
+		UnregisterClass(L"ParticleEditorView", info->hInstance);
 		UnregisterClass(L"ParticleEditorRenderer", info->hInstance);
 		UnregisterClass(L"ParticleEditor", info->hInstance);
 		return false;
@@ -1827,6 +2819,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int)
 	info.hMainWnd				= NULL;
 	info.particleSystem			= NULL;
 	info.attachedParticleSystem = NULL;
+	info.emissionMesh           = NULL;
 	info.engine					= NULL;
 	info.dragmode				= APPLICATION_INFO::NONE;
 	info.isMinimized			= false;
@@ -0,0 +1,416 @@
+//
+// AtlasPacker: packs the color textures used by particle systems into atlases.
+//
+// Usage: AtlasPacker [options] <file.alo or directory>...
+//
+//   -t <dir>      Texture directory to search (recursively); may be repeated
+//   -o <dir>      Output directory (default: current directory)
+//   -n <name>     Base name of the atlases and remap table (default: atlas)
+//   -s <size>     Maximum atlas width and height, rounded down to a power of
+//                 two (default: 2048)
+//   -p <pixels>   Padding around each texture, filled with its edge (default: 2)
+//
+// Writes <name>0.tga, <name>1.tga, ... and the remap table <name>.txt, which
+// the editor loads with View > Load Texture Atlas. Each line of the table is
+//
+//   atlas   <file> <width> <height>
+//   texture <name> <atlas index> <x> <y> <width> <height>
+//
+// Files and names are in double quotes, with quotes and backslashes in them
+// escaped by a backslash (std::quoted), so they may contain spaces.
+//
+// Texture names are upper case, like the editor looks them up. Normal maps are
+// not packed; they are sampled with their own texture coordinates.
+//
+// Runs without Direct3D; see tools/CMakeLists.txt.
+//
+#include "../common/Image.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string.h>
+using namespace std;
+namespace fs = std::filesystem;
+
+struct Texture
+{
+	string       name;		// As referenced, in upper case
+	fs::path     path;
+	Image        image;
+	unsigned int atlas;
+	unsigned int x, y;		// Position in the atlas, without padding
+};
+
+struct Options
+{
+	vector<fs::path> textureDirs;
+	fs::path         outputDir;
+	string           name;
+	unsigned int     maxSize;
+	unsigned int     padding;
+
+	Options() : outputDir("."), name("atlas"), maxSize(2048), padding(2) {}
+};
+
+static string ToUpper(string str)
+{
+	transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return (char)toupper(c); });
+	return str;
+}
+
+//
+// Reading particle systems. Only the emitters' texture chunks are needed, so
+// this walks the chunk tree instead of loading the particle system.
+//
+static uint32_t ReadLong(const uint8_t* p) { return (uint32_t)(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24)); }
+
+static void ReadChunks(const vector<uint8_t>& data, size_t begin, size_t end, uint32_t parent, set<string>& textures)
+{
+	while (begin + 8 <= end)
+	{
+		uint32_t type = ReadLong(&data[begin]);
+		uint32_t size = ReadLong(&data[begin + 4]);
+		size_t   next = begin + 8 + (size & 0x7FFFFFFF);
+		if (next > end)
+		{
+			throw runtime_error("chunk exceeds its parent");
+		}
+
+		if (size & 0x80000000)
+		{
+			ReadChunks(data, begin + 8, next, type, textures);
+		}
+		else if (parent == 0x0700 && type == 0x0003)
+		{
+			// Emitter color texture
+			string name((const char*)&data[begin + 8], strnlen((const char*)&data[begin + 8], next - begin - 8));
+			if (!name.empty())
+			{
+				textures.insert(ToUpper(name));
+			}
+		}
+		begin = next;
+	}
+}
+
+static void ReadParticleSystem(const fs::path& path, set<string>& textures)
+{
+	ifstream file(path, ios::binary);
+	vector<uint8_t> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	if (data.size() < 8 || ReadLong(&data[0]) != 0x0900)
+	{
+		throw runtime_error("not a particle system");
+	}
+	ReadChunks(data, 0, data.size(), 0, textures);
+}
+
+//
+// Finding textures. Like the editor, a texture is looked up by its file name,
+// and then with a DDS extension. Names are compared without case.
+//
+typedef map<string, fs::path> FileMap;
+
+static void ScanDirectory(const fs::path& dir, FileMap& files)
+{
+	for (fs::recursive_directory_iterator i(dir), end; i != end; ++i)
+	{
+		if (i->is_regular_file())
+		{
+			files.insert(make_pair(ToUpper(i->path().filename().string()), i->path()));
+		}
+	}
+}
+
+static bool FindTexture(const FileMap& files, string name, fs::path& path)
+{
+	size_t pos = name.find_last_of("\\/");
+	if (pos != string::npos)
+	{
+		name = name.substr(pos + 1);
+	}
+
+	FileMap::const_iterator p = files.find(name);
+	if (p == files.end() && (pos = name.rfind('.')) != string::npos)
+	{
+		p = files.find(name.substr(0, pos) + ".DDS");
+	}
+	if (p == files.end())
+	{
+		return false;
+	}
+	path = p->second;
+	return true;
+}
+
+//
+// Packing. Textures are placed on shelves, tallest first. Particle textures
+// are mostly power-of-two squares, for which this wastes little.
+//
+struct Atlas
+{
+	unsigned int width, height;		// Used extent
+	unsigned int shelfY, shelfX, shelfHeight;
+	size_t       usedPixels;
+	unsigned int nTextures;
+};
+
+static unsigned int NextPowerOfTwo(unsigned int x)
+{
+	unsigned int p = 1;
+	while (p < x) p *= 2;
+	return p;
+}
+
+// Returns 0 for 0
+static unsigned int PreviousPowerOfTwo(unsigned int x)
+{
+	unsigned int p = 1;
+	while (p <= x / 2) p *= 2;
+	return (x > 0) ? p : 0;
+}
+
+static void Pack(vector<Texture*>& textures, vector<Atlas>& atlases, const Options& options)
+{
+	sort(textures.begin(), textures.end(), [](const Texture* t1, const Texture* t2) {
+		return t1->image.height != t2->image.height ? t1->image.height > t2->image.height : t1->image.width > t2->image.width;
+	});
+
+	for (size_t i = 0; i < textures.size(); i++)
+	{
+		Texture&     texture = *textures[i];
+		unsigned int w = texture.image.width  + 2 * options.padding;
+		unsigned int h = texture.image.height + 2 * options.padding;
+
+		// Try the current shelf of each atlas, then a new shelf, then a new atlas
+		size_t a;
+		for (a = 0; a < atlases.size(); a++)
+		{
+			Atlas& atlas = atlases[a];
+			if (atlas.shelfX + w <= options.maxSize && h <= atlas.shelfHeight)
+			{
+				break;
+			}
+			if (atlas.shelfY + atlas.shelfHeight + h <= options.maxSize)
+			{
+				atlas.shelfY     += atlas.shelfHeight;
+				atlas.shelfX      = 0;
+				atlas.shelfHeight = h;
+				break;
+			}
+		}
+		if (a == atlases.size())
+		{
+			Atlas atlas = {0, 0, 0, 0, h, 0, 0};
+			atlases.push_back(atlas);
+		}
+
+		Atlas& atlas = atlases[a];
+		texture.atlas = (unsigned int)a;
+		texture.x     = atlas.shelfX + options.padding;
+		texture.y     = atlas.shelfY + options.padding;
+		atlas.shelfX += w;
+		atlas.width   = max(atlas.width,  atlas.shelfX);
+		atlas.height  = max(atlas.height, atlas.shelfY + h);
+		atlas.usedPixels += (size_t)texture.image.width * texture.image.height;
+		atlas.nTextures++;
+	}
+
+	// Textures need not be a power of two in size, but atlases should be.
+	// The maximum size is one, so rounding up stays within it.
+	for (size_t a = 0; a < atlases.size(); a++)
+	{
+		atlases[a].width  = NextPowerOfTwo(atlases[a].width);
+		atlases[a].height = NextPowerOfTwo(atlases[a].height);
+	}
+}
+
+// Copies a texture into an atlas, and extends its edges into the padding
+static void Blit(Image& atlas, const Texture& texture, unsigned int padding)
+{
+	const Image& image = texture.image;
+	for (int y = -(int)padding; y < (int)(image.height + padding); y++)
+	{
+		for (int x = -(int)padding; x < (int)(image.width + padding); x++)
+		{
+			unsigned int sx = (unsigned int)min(max(x, 0), (int)image.width  - 1);
+			unsigned int sy = (unsigned int)min(max(y, 0), (int)image.height - 1);
+			atlas(texture.x + x, texture.y + y) = image(sx, sy);
+		}
+	}
+}
+
+static void Usage()
+{
+	cerr << "Usage: AtlasPacker [-t texturedir]... [-o outdir] [-n name] [-s maxsize] [-p padding] <file.alo or dir>..." << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	Options          options;
+	vector<fs::path> inputs;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc)
+		{
+			const char* value = argv[++i];
+			switch (arg[1])
+			{
+				case 't': options.textureDirs.push_back(value); break;
+				case 'o': options.outputDir = value; break;
+				case 'n': options.name      = value; break;
+				case 's': options.maxSize   = PreviousPowerOfTwo((unsigned int)max(atoi(value), 0)); break;
+				case 'p': options.padding   = (unsigned int)atoi(value); break;
+				default:  Usage(); return 1;
+			}
+		}
+		else
+		{
+			inputs.push_back(arg);
+		}
+	}
+
+	if (inputs.empty() || options.textureDirs.empty() || options.maxSize == 0)
+	{
+		Usage();
+		return 1;
+	}
+
+	try
+	{
+		// Collect the textures of all particle systems
+		set<string> names;
+		size_t      nSystems = 0;
+		for (size_t i = 0; i < inputs.size(); i++)
+		{
+			vector<fs::path> files;
+			if (fs::is_directory(inputs[i]))
+			{
+				for (fs::recursive_directory_iterator p(inputs[i]), end; p != end; ++p)
+				{
+					if (p->is_regular_file() && ToUpper(p->path().extension().string()) == ".ALO")
+					{
+						files.push_back(p->path());
+					}
+				}
+			}
+			else
+			{
+				files.push_back(inputs[i]);
+			}
+
+			for (size_t j = 0; j < files.size(); j++)
+			{
+				try
+				{
+					ReadParticleSystem(files[j], names);
+					nSystems++;
+				}
+				catch (exception& e)
+				{
+					cerr << files[j].string() << ": " << e.what() << endl;
+				}
+			}
+		}
+
+		FileMap files;
+		for (size_t i = 0; i < options.textureDirs.size(); i++)
+		{
+			ScanDirectory(options.textureDirs[i], files);
+		}
+
+		// Load them
+		vector<Texture>  textures;
+		vector<Texture*> packed;
+		for (set<string>::const_iterator p = names.begin(); p != names.end(); ++p)
+		{
+			Texture texture;
+			texture.name = *p;
+			if (!FindTexture(files, texture.name, texture.path))
+			{
+				cerr << "skipped " << texture.name << ": not found" << endl;
+				continue;
+			}
+
+			try
+			{
+				texture.image.Load(texture.path.string());
+			}
+			catch (exception& e)
+			{
+				cerr << "skipped " << texture.name << ": " << e.what() << endl;
+				continue;
+			}
+
+			if (texture.image.width + 2 * options.padding > options.maxSize || texture.image.height + 2 * options.padding > options.maxSize)
+			{
+				cerr << "skipped " << texture.name << ": larger than an atlas" << endl;
+				continue;
+			}
+			textures.push_back(texture);
+		}
+
+		for (size_t i = 0; i < textures.size(); i++)
+		{
+			packed.push_back(&textures[i]);
+		}
+
+		vector<Atlas> atlases;
+		Pack(packed, atlases, options);
+
+		// Write the atlases and the remap table
+		fs::create_directories(options.outputDir);
+		ofstream table(options.outputDir / (options.name + ".txt"));
+		size_t totalArea = 0, totalUsed = 0;
+		for (size_t a = 0; a < atlases.size(); a++)
+		{
+			const Atlas& atlas = atlases[a];
+			string filename = options.name + to_string(a) + ".tga";
+
+			Image image;
+			image.Resize(atlas.width, atlas.height);
+			for (size_t i = 0; i < textures.size(); i++)
+			{
+				if (textures[i].atlas == a)
+				{
+					Blit(image, textures[i], options.padding);
+				}
+			}
+			image.SaveTGA((options.outputDir / filename).string());
+			table << "atlas " << quoted(filename) << " " << atlas.width << " " << atlas.height << "\n";
+
+			size_t area = (size_t)atlas.width * atlas.height;
+			totalArea += area;
+			totalUsed += atlas.usedPixels;
+			printf("%s  %4u x %-4u  %3u textures  %5.1f%% occupied\n", filename.c_str(), atlas.width, atlas.height, atlas.nTextures, 100.0 * atlas.usedPixels / area);
+		}
+
+		for (size_t i = 0; i < textures.size(); i++)
+		{
+			const Texture& t = textures[i];
+			table << "texture " << quoted(t.name) << " " << t.atlas << " " << t.x << " " << t.y << " " << t.image.width << " " << t.image.height << "\n";
+		}
+
+		if (!table.good())
+		{
+			throw runtime_error("unable to write the remap table");
+		}
+
+		printf("%u particle systems, %u textures referenced, %u packed into %u atlases, %.1f%% occupied\n",
+			(unsigned int)nSystems, (unsigned int)names.size(), (unsigned int)textures.size(), (unsigned int)atlases.size(),
+			totalArea > 0 ? 100.0 * totalUsed / totalArea : 0.0);
+	}
+	catch (exception& e)
+	{
+		cerr << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
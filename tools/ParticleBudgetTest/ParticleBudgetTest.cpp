@@ -0,0 +1,103 @@
+//
+// ParticleBudgetTest: fits instances into particle budgets the way
+// Engine::ApplyParticleBudget does (see src/ParticleBudget.h), and checks
+// that the least important ones are throttled and culled first.
+//
+// Usage: ParticleBudgetTest
+//
+// Returns 0 when all checks pass.
+//
+#include "../../src/ParticleBudget.h"
+#include <cmath>
+#include <cstdio>
+using namespace std;
+
+// Blend modes, as far as the budget cares
+static const int NUM_BLEND_MODES = 3;
+static const int ADDITIVE        = 1;
+static const int TRANSPARENT     = 2;
+
+static int Failures = 0;
+
+static void Check(const char* what, float actual, float expected)
+{
+	if (fabs(actual - expected) > 1e-4f)
+	{
+		printf("FAILED: %s is %g, expected %g\n", what, actual, expected);
+		Failures++;
+	}
+}
+
+// Claims 'count' particles of one blend mode
+static size_t Claim(ParticleBudget& budget, float priority, int blendMode, int count)
+{
+	int counts[NUM_BLEND_MODES] = {0};
+	counts[blendMode] = count;
+	return budget.AddClaim(priority, counts);
+}
+
+int main()
+{
+	ParticleBudget budget(NUM_BLEND_MODES);
+
+	// Without budgets, everything spawns
+	budget.Clear();
+	size_t a = Claim(budget, 1.0f, ADDITIVE, 5000);
+	budget.Fit();
+	Check("unlimited scale",    budget.GetScales(a)[ADDITIVE], 1.0f);
+	Check("unlimited pressure", budget.GetPressure(), 0.0f);
+	Check("unlimited throttled", (float)budget.GetNumThrottled(), 0.0f);
+
+	// Over the global budget, the least important are cut first, whatever the
+	// order in which they're claimed
+	budget.SetBudget(1000);
+	budget.Clear();
+	size_t culled    = Claim(budget, 0.1f,  ADDITIVE,    200);
+	size_t throttled = Claim(budget, 0.5f,  TRANSPARENT, 300);
+	size_t high      = Claim(budget, 10.0f, ADDITIVE,    500);
+	size_t mid       = Claim(budget, 1.0f,  TRANSPARENT, 400);
+	budget.Fit();
+	Check("pressure",               budget.GetPressure(), 1400 / 1000.0f);
+	Check("most important's scale", budget.GetScales(high)[ADDITIVE],         1.0f);
+	Check("next's scale",           budget.GetScales(mid)[TRANSPARENT],       1.0f);
+	Check("throttled scale",        budget.GetScales(throttled)[TRANSPARENT], 100 / 300.0f);
+	Check("culled scale",           budget.GetScales(culled)[ADDITIVE],       0.0f);
+	Check("culled's other scales",  budget.GetScales(culled)[TRANSPARENT],    0.0f);
+	Check("throttled count",        (float)budget.GetNumThrottled(), 1.0f);
+	Check("culled count",           (float)budget.GetNumCulled(),    1.0f);
+
+	// Under budget, nothing is cut
+	budget.SetBudget(2000);
+	budget.Fit();
+	Check("scale under budget",     budget.GetScales(culled)[ADDITIVE], 1.0f);
+	Check("culled under budget",    (float)budget.GetNumCulled(),       0.0f);
+
+	// A blend mode's budget only cuts that blend mode, and only its least
+	// important claims
+	budget.SetBudget(0);
+	budget.SetBudget(ADDITIVE, 600);
+	budget.Fit();
+	Check("additive pressure",         budget.GetPressure(ADDITIVE),        700 / 600.0f);
+	Check("transparent pressure",      budget.GetPressure(TRANSPARENT),     0.0f);
+	Check("important additive",        budget.GetScales(high)[ADDITIVE],    1.0f);
+	Check("unimportant additive",      budget.GetScales(culled)[ADDITIVE],  100 / 200.0f);
+	Check("unimportant transparent",   budget.GetScales(throttled)[TRANSPARENT], 1.0f);
+	Check("throttled by blend budget", (float)budget.GetNumThrottled(),     1.0f);
+
+	// Instances without particles spawn while there's room
+	budget.SetBudget(ADDITIVE, 0);
+	budget.SetBudget(500);
+	budget.Clear();
+	size_t empty = Claim(budget, 1.0f, ADDITIVE, 0);
+	size_t full  = Claim(budget, 2.0f, ADDITIVE, 500);
+	budget.Fit();
+	Check("scale of the full budget's claim", budget.GetScales(full)[ADDITIVE],  1.0f);
+	Check("scale with nothing left",          budget.GetScales(empty)[ADDITIVE], 0.0f);
+	Check("empty claims culled",              (float)budget.GetNumCulled(),      1.0f);
+
+	if (Failures == 0)
+	{
+		printf("All checks passed\n");
+	}
+	return (Failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,298 @@
+//
+// RasterBench: measures the software rasterizer, and renders a test image.
+//
+// Usage: RasterBench [options]
+//
+//   -w <width>      Image width (default: 1280)
+//   -h <height>     Image height (default: 720)
+//   -n <particles>  Particles per blend mode, up to 16384 (default: 5000)
+//   -f <frames>     Frames to render (default: 10)
+//   -j <threads>    Threads; 0 is one per hardware thread (default: 0)
+//   -o <file.tga>   Writes the last frame
+//
+// Each frame draws a ground plane, then camera-facing particles with every
+// blend mode, then heat particles into a distortion target, and composites
+// the two like the editor. Particles are placed with a fixed seed, so the
+// image is the same for any number of threads.
+//
+// The particles are made up here, so the rasterizer can be measured without
+// Direct3D. To measure it with a real particle system, as the editor expands
+// its emitters, use ParticleEditor -rasterbench.
+//
+#include "../common/Rasterizer.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+using namespace std;
+
+struct Options
+{
+	unsigned int width, height;
+	unsigned int particles;
+	unsigned int frames;
+	unsigned int threads;
+	string       output;
+
+	Options() : width(1280), height(720), particles(5000), frames(10), threads(0) {}
+};
+
+// A row-major 4x4 matrix, transforming row vectors like D3DX
+struct Matrix
+{
+	float m[4][4];
+};
+
+static Matrix Multiply(const Matrix& a, const Matrix& b)
+{
+	Matrix r;
+	for (int i = 0; i < 4; i++)
+	for (int j = 0; j < 4; j++)
+	{
+		r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+	}
+	return r;
+}
+
+// The editor's camera: right-handed, Z up, with an infinite far plane
+static Matrix ViewProjection(float aspect)
+{
+	const float eye[3] = {0, -250, 125};
+	float f[3] = {-eye[0], -eye[1], -eye[2]};
+	float len  = sqrt(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+	f[0] /= len; f[1] /= len; f[2] /= len;
+	float s[3] = {f[1], -f[0], 0};				// f x up
+	len = sqrt(s[0] * s[0] + s[1] * s[1]);
+	s[0] /= len; s[1] /= len;
+	float u[3] = {s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2], s[0] * f[1] - s[1] * f[0]};
+
+	Matrix view = {{
+		{s[0], u[0], -f[0], 0},
+		{s[1], u[1], -f[1], 0},
+		{s[2], u[2], -f[2], 0},
+		{-(s[0] * eye[0] + s[1] * eye[1] + s[2] * eye[2]), -(u[0] * eye[0] + u[1] * eye[1] + u[2] * eye[2]), f[0] * eye[0] + f[1] * eye[1] + f[2] * eye[2], 1},
+	}};
+
+	const float n = 1.0f, yScale = 1 / tan(3.14159265f / 8);
+	Matrix projection = {{
+		{yScale / aspect, 0,      0,      0},
+		{0,               yScale, 0,      0},
+		{0,               0,      -1,    -1},
+		{0,               0,      -2 * n, 0},
+	}};
+	return Multiply(view, projection);
+}
+
+static Rasterizer::Vertex Transform(const Matrix& m, float x, float y, float z, float u, float v, const float color[4])
+{
+	Rasterizer::Vertex r;
+	r.x = x * m.m[0][0] + y * m.m[1][0] + z * m.m[2][0] + m.m[3][0];
+	r.y = x * m.m[0][1] + y * m.m[1][1] + z * m.m[2][1] + m.m[3][1];
+	r.z = x * m.m[0][2] + y * m.m[1][2] + z * m.m[2][2] + m.m[3][2];
+	r.w = x * m.m[0][3] + y * m.m[1][3] + z * m.m[2][3] + m.m[3][3];
+	r.u = u;
+	r.v = v;
+	r.r = color[0]; r.g = color[1]; r.b = color[2]; r.a = color[3];
+	return r;
+}
+
+// A soft round particle, or a bump for heat
+static Image MakeTexture(bool heat)
+{
+	Image image;
+	image.Resize(64, 64);
+	for (unsigned int y = 0; y < 64; y++)
+	for (unsigned int x = 0; x < 64; x++)
+	{
+		float dx = (x + 0.5f) / 32 - 1, dy = (y + 0.5f) / 32 - 1;
+		float d  = max(0.0f, 1 - sqrt(dx * dx + dy * dy));
+		Image::Pixel& p = image(x, y);
+		if (heat)
+		{
+			p.r = (uint8_t)(128 + dx * d * 127);
+			p.g = (uint8_t)(128 + dy * d * 127);
+			p.b = 255;
+		}
+		else
+		{
+			p.r = p.g = p.b = 255;
+		}
+		p.a = (uint8_t)(d * d * 255);
+	}
+	return image;
+}
+
+// Builds camera-facing quads at random positions. The right and up vectors
+// are those of the camera, so the quads face it.
+static void MakeParticles(const Matrix& viewProjection, unsigned int count, mt19937& random, const float tint[4],
+	vector<Rasterizer::Vertex>& vertices, vector<uint16_t>& indices)
+{
+	uniform_real_distribution<float> position(-100, 100), height(0, 150), size(3, 15), shade(0.3f, 1.0f);
+	const float right[3] = {1, 0, 0}, up[3] = {0, 0.447f, 0.894f};
+
+	vertices.clear();
+	indices.clear();
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (vertices.size() + 4 > 0x10000)
+		{
+			break;
+		}
+		float x = position(random), y = position(random), z = height(random), s = size(random), c = shade(random);
+		float color[4] = {tint[0] * c, tint[1] * c, tint[2] * c, tint[3]};
+		uint16_t base = (uint16_t)vertices.size();
+		for (int j = 0; j < 4; j++)
+		{
+			float su = (j & 1) ? 1.0f : -1.0f, sv = (j & 2) ? 1.0f : -1.0f;
+			vertices.push_back(Transform(viewProjection,
+				x + s * (su * right[0] + sv * up[0]),
+				y + s * (su * right[1] + sv * up[1]),
+				z + s * (su * right[2] + sv * up[2]),
+				(su + 1) / 2, (1 - sv) / 2, color));
+		}
+		const uint16_t quad[6] = {0, 1, 2, 2, 1, 3};
+		for (int j = 0; j < 6; j++)
+		{
+			indices.push_back(base + quad[j]);
+		}
+	}
+}
+
+static void Usage()
+{
+	cerr << "Usage: RasterBench [-w width] [-h height] [-n particles] [-f frames] [-j threads] [-o file.tga]" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg.size() != 2 || arg[0] != '-' || i + 1 >= argc)
+		{
+			Usage();
+			return 1;
+		}
+
+		// Counts must be positive, save for the threads
+		const char* value = argv[++i];
+		const int   n     = atoi(value);
+		if (arg[1] != 'o' && (n < 0 || (n == 0 && arg[1] != 'j')))
+		{
+			Usage();
+			return 1;
+		}
+
+		switch (arg[1])
+		{
+			case 'w': options.width     = (unsigned int)n; break;
+			case 'h': options.height    = (unsigned int)n; break;
+			case 'n': options.particles = (unsigned int)n; break;
+			case 'f': options.frames    = (unsigned int)n; break;
+			case 'j': options.threads   = (unsigned int)n; break;
+			case 'o': options.output    = value; break;
+			default:  Usage(); return 1;
+		}
+	}
+
+	// A batch's quads are indexed with 16 bits
+	if (options.particles > 0x10000 / 4)
+	{
+		Usage();
+		return 1;
+	}
+
+	try
+	{
+		const Matrix viewProjection = ViewProjection((float)options.width / options.height);
+		const Image  particle = MakeTexture(false);
+		const Image  bump     = MakeTexture(true);
+
+		// One batch per blend mode, drawn in this order
+		struct Batch
+		{
+			Rasterizer::Blend blend;
+			float             tint[4];
+			bool              heat;
+		};
+		static const Batch Batches[] = {
+			{Rasterizer::BLEND_OPAQUE,   {0.5f, 0.5f, 0.5f, 1.0f}, false},
+			{Rasterizer::BLEND_DARKEN,   {1.0f, 1.0f, 1.0f, 0.5f}, false},
+			{Rasterizer::BLEND_MODULATE, {0.6f, 0.8f, 1.0f, 1.0f}, false},
+			{Rasterizer::BLEND_ALPHA,    {0.8f, 0.7f, 0.6f, 0.6f}, false},
+			{Rasterizer::BLEND_ADDITIVE, {0.4f, 0.2f, 0.1f, 1.0f}, false},
+			{Rasterizer::BLEND_ALPHA,    {1.0f, 1.0f, 1.0f, 0.1f}, true},
+		};
+		static const int NUM_BATCHES = sizeof Batches / sizeof Batches[0];
+
+		vector<Rasterizer::Vertex> vertices[NUM_BATCHES];
+		vector<uint16_t>           indices[NUM_BATCHES];
+		mt19937 random(1);
+		for (int i = 0; i < NUM_BATCHES; i++)
+		{
+			MakeParticles(viewProjection, options.particles, random, Batches[i].tint, vertices[i], indices[i]);
+		}
+
+		const float groundColor[4] = {0.25f, 0.3f, 0.2f, 1.0f};
+		const Rasterizer::Vertex ground[4] = {
+			Transform(viewProjection, -800, -800, 0, 0, 0, groundColor),
+			Transform(viewProjection,  800, -800, 0, 1, 0, groundColor),
+			Transform(viewProjection, -800,  800, 0, 0, 1, groundColor),
+			Transform(viewProjection,  800,  800, 0, 1, 1, groundColor),
+		};
+		const uint16_t groundIndices[6] = {0, 1, 2, 2, 1, 3};
+
+		Rasterizer scene(options.threads), heat(options.threads);
+		scene.Resize(options.width, options.height);
+		heat .Resize(options.width, options.height);
+
+		Image sceneImage, heatImage, result;
+		size_t   numTriangles = 0;
+		uint64_t numPixels    = 0;
+		auto start = chrono::steady_clock::now();
+		for (unsigned int frame = 0; frame < options.frames; frame++)
+		{
+			const Rasterizer::Color background = {0.08f, 0.03f, 0.2f, 1.0f}, neutral = {129 / 255.0f, 128 / 255.0f, 1.0f, 1.0f};
+			scene.Clear(true, true, background, 1.0f);
+			heat .Clear(true, true, neutral, 1.0f);
+
+			Rasterizer::State groundState = {NULL, Rasterizer::BLEND_OPAQUE, true, true};
+			scene.DrawTriangles(groundState, ground, groundIndices, 2);
+			numTriangles += 2;
+
+			for (int i = 0; i < NUM_BATCHES; i++)
+			{
+				bool opaque = (Batches[i].blend == Rasterizer::BLEND_OPAQUE);
+				Rasterizer::State state = {Batches[i].heat ? &bump : &particle, Batches[i].blend, true, opaque};
+				(Batches[i].heat ? heat : scene).DrawTriangles(state, &vertices[i][0], &indices[i][0], indices[i].size() / 3);
+				numTriangles += indices[i].size() / 3;
+			}
+
+			heat .Resolve(heatImage);
+			scene.Resolve(sceneImage);
+			scene.Distort(sceneImage, heatImage, 0.5f);
+			scene.Resolve(result);
+			numPixels += scene.GetNumShadedPixels() + heat.GetNumShadedPixels();
+		}
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		printf("%u frames of %ux%u in %.3f s: %.2f ms/frame, %.2f Mtriangles/s, %.1f Mpixels/s shaded\n",
+			options.frames, options.width, options.height, seconds, 1000 * seconds / options.frames,
+			numTriangles / seconds / 1e6, numPixels / seconds / 1e6);
+
+		if (!options.output.empty())
+		{
+			result.SaveTGA(options.output);
+		}
+	}
+	catch (exception& e)
+	{
+		cerr << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,186 @@
+//
+// RenderDeviceTest: submits a frame the way Engine::RenderFrame does, through
+// the editor's render devices (see src/RenderDevice.h), and checks what they
+// count and filter. The chain is the engine's, with the Direct3D device
+// replaced by a NullRenderDevice:
+//
+//   StateCacheRenderDevice -> RecordingRenderDevice -> NullRenderDevice
+//
+// Usage: RenderDeviceTest
+//
+// Returns 0 when all checks pass.
+//
+#include "../../src/RenderDevice.h"
+#include <cstdio>
+#include <vector>
+using namespace std;
+
+// Like EmitterInstance::Vertex
+#pragma pack(1)
+struct Vertex
+{
+	float    position[3];
+	float    normal[3];
+	float    texCoord0[2];
+	float    texCoord1[2];
+	uint32_t color;
+};
+#pragma pack()
+
+// The device only compares resources, so any distinct addresses do
+static char Resources[8];
+static RenderTexture* const GROUND  = (RenderTexture*)&Resources[0];
+static RenderTexture* const SMOKE   = (RenderTexture*)&Resources[1];
+static RenderTexture* const SPARK   = (RenderTexture*)&Resources[2];
+static RenderTexture* const NORMALS = (RenderTexture*)&Resources[3];
+static RenderSurface* const SCREEN  = (RenderSurface*)&Resources[4];
+static RenderSurface* const DEPTH   = (RenderSurface*)&Resources[5];
+static Effect*        const Shaders[] = {(Effect*)&Resources[6], (Effect*)&Resources[7]};
+static const unsigned int NUM_SHADERS = sizeof Shaders / sizeof Shaders[0];
+
+static const unsigned int MATRIX_SIZE = 16 * sizeof(float);
+static const unsigned int VECTOR_SIZE =  4 * sizeof(float);
+
+struct Emitter
+{
+	RenderTexture* texture;
+	bool           depthTest;
+	unsigned int   numParticles;
+};
+
+// Three emitters; the first two share their state
+static const Emitter Emitters[] = {
+	{SMOKE, true,  100},
+	{SMOKE, true,  50},
+	{SPARK, false, 10},
+};
+static const unsigned int NUM_EMITTERS = sizeof Emitters / sizeof Emitters[0];
+
+static vector<Vertex>   Vertices(4 * 100);
+static vector<uint16_t> Indices(6 * 100);
+
+// The scene pass draws the ground and the emitters onto the screen; there is
+// no heat, so the composite is collapsed into it
+static void SubmitFrame(IRenderDevice* device)
+{
+	static const float Identity[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1};
+	static const float Eye[4]       = {0,0,10,1};
+
+	device->BeginScene();
+	for (unsigned int i = 0; i < NUM_SHADERS; i++)
+	{
+		device->SetMatrix(Shaders[i], "View",           Identity);
+		device->SetMatrix(Shaders[i], "ViewProjection", Identity);
+		device->SetFloat(Shaders[i],  "Time",           1.0f);
+	}
+	device->SetTransform(IRenderDevice::TRANSFORM_VIEW,       Identity);
+	device->SetTransform(IRenderDevice::TRANSFORM_PROJECTION, Identity);
+
+	device->SetRenderTarget(0, SCREEN);
+	device->SetDepthStencilSurface(DEPTH);
+	device->Clear(IRenderDevice::CLEAR_TARGET | IRenderDevice::CLEAR_DEPTH, 0xFF140834, 1.0f);
+
+	device->SetTexture(0, GROUND);
+	device->SetTransform(IRenderDevice::TRANSFORM_TEXTURE0, Identity);
+	device->SetTexture(1, NULL);
+	device->SetState(IRenderDevice::STATE_DEPTH_TEST,  true);
+	device->SetState(IRenderDevice::STATE_DEPTH_WRITE, true);
+	device->SetState(IRenderDevice::STATE_BLEND,       false);
+	device->DrawPrimitiveUP(IRenderDevice::TRIANGLE_STRIP, 2, &Vertices[0], sizeof(Vertex));
+
+	for (unsigned int i = 0; i < NUM_EMITTERS; i++)
+	{
+		const Emitter& emitter = Emitters[i];
+		device->SetTexture(0, emitter.texture);
+		device->SetTexture(1, NORMALS);
+		device->SetState(IRenderDevice::STATE_DEPTH_TEST, emitter.depthTest);
+		device->SetVector(Shaders[0], "EyeObjPosition", Eye);
+
+		unsigned int nPasses = device->BeginEffect(Shaders[0]);
+		for (unsigned int pass = 0; pass < nPasses; pass++)
+		{
+			device->BeginPass(Shaders[0], pass);
+			device->DrawIndexedPrimitiveUP(IRenderDevice::TRIANGLE_LIST, 4 * emitter.numParticles, 2 * emitter.numParticles, &Indices[0], &Vertices[0], sizeof(Vertex));
+			device->EndPass(Shaders[0]);
+		}
+		device->EndEffect(Shaders[0]);
+	}
+	device->EndScene();
+	device->Present(NULL);
+}
+
+static int Failures = 0;
+
+static void Check(const char* what, unsigned long actual, unsigned long expected)
+{
+	if (actual != expected)
+	{
+		printf("FAILED: %s is %lu, expected %lu\n", what, actual, expected);
+		Failures++;
+	}
+}
+
+int main()
+{
+	unsigned long numParticles = 0;
+	for (unsigned int i = 0; i < NUM_EMITTERS; i++)
+	{
+		numParticles += Emitters[i].numParticles;
+	}
+
+	// Without the cache, everything is counted
+	NullRenderDevice      null;
+	RecordingRenderDevice recorder(&null);
+	SubmitFrame(&recorder);
+
+	const RenderStats& stats = recorder.GetStats();
+	Check("scenes",             stats.scenes,           1);
+	Check("draws",              stats.draws,            1 + NUM_EMITTERS);
+	Check("primitives",         stats.primitives,       2 + 2 * numParticles);
+	Check("vertices",           stats.vertices,         4 + 4 * numParticles);
+	Check("state changes",      stats.stateChanges,     3 + 3 + NUM_EMITTERS);
+	Check("texture changes",    stats.textureChanges,   2 + 2 * NUM_EMITTERS);
+	Check("target changes",     stats.targetChanges,    2);
+	Check("clears",             stats.clears,           1);
+	Check("effect parameters",  stats.effectParameters, 3 * NUM_SHADERS + NUM_EMITTERS);
+	Check("effect passes",      stats.effectPasses,     NUM_EMITTERS);
+	Check("bytes",              stats.bytes,
+		(4 + 4 * numParticles) * sizeof(Vertex) + 6 * numParticles * sizeof(uint16_t) +
+		3 * MATRIX_SIZE + NUM_SHADERS * (2 * MATRIX_SIZE + sizeof(float)) + NUM_EMITTERS * VECTOR_SIZE);
+	const RenderStats uncached = stats;
+
+	// Through the cache, the second emitter's textures and depth test are
+	// dropped, as are the third's normal map and the first's depth test,
+	// which the ground set
+	StateCacheRenderDevice cache(&recorder);
+	recorder.ResetStats();
+	SubmitFrame(&cache);
+	Check("filtered calls",          cache.GetNumFiltered(),  5);
+	Check("cached state changes",    stats.stateChanges,      uncached.stateChanges - 2);
+	Check("cached texture changes",  stats.textureChanges,    uncached.textureChanges - 3);
+	Check("cached draws",            stats.draws,             uncached.draws);
+	Check("cached bytes",            stats.bytes,             uncached.bytes);
+
+	// The next frame starts with the state the last one left, so the ground's
+	// depth write and blending are dropped too
+	cache.ResetNumFiltered();
+	recorder.ResetStats();
+	SubmitFrame(&cache);
+	Check("next frame's filtered calls",  cache.GetNumFiltered(), 5 + 2);
+	Check("next frame's state changes",   stats.stateChanges,     uncached.stateChanges - 4);
+	Check("next frame's texture changes", stats.textureChanges,   uncached.textureChanges - 3);
+
+	// Until the device is reset
+	cache.Invalidate();
+	cache.ResetNumFiltered();
+	recorder.ResetStats();
+	SubmitFrame(&cache);
+	Check("filtered calls after a reset", cache.GetNumFiltered(), 5);
+	Check("texture changes after a reset", stats.textureChanges, uncached.textureChanges - 3);
+
+	if (Failures == 0)
+	{
+		printf("All checks passed\n");
+	}
+	return (Failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+//
+// SortBench: compares the back-to-front particle sort (see common/DepthSort.h)
+// with the comparison sorts it could be replaced by.
+//
+// Usage: SortBench [options]
+//
+//   -n <particles>  Largest number of particles; runs 256, 1024, ... up to it
+//                   (default: 65536, the most SortBackToFront can take)
+//   -f <frames>     Frames to sort per run (default: 200)
+//
+// The particles drift a little between frames, like a live emitter seen by a
+// still camera, so the previous frame's order is nearly right. Each frame is
+// sorted by:
+//
+//   radix      SortBackToFront: 16-bit depth keys, two 8-bit passes
+//   stable     std::stable_sort of the indices by depth
+//   insertion  An insertion sort starting from the previous frame's order
+//
+// and the radix order is checked against the exact one: no pair may be out of
+// order by more than the 16-bit quantization step.
+//
+#include "../common/DepthSort.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+using namespace std;
+
+struct Options
+{
+	unsigned int particles;
+	unsigned int frames;
+
+	Options() : particles(65536), frames(200) {}
+};
+
+static void StableSort(const vector<float>& depths, vector<uint32_t>& order)
+{
+	order.resize(depths.size());
+	iota(order.begin(), order.end(), 0);
+	stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return depths[a] > depths[b]; });
+}
+
+// The order is the previous frame's, and is sorted in place
+static void InsertionSort(const vector<float>& depths, vector<uint32_t>& order)
+{
+	for (size_t i = 1; i < order.size(); i++)
+	{
+		uint32_t item = order[i];
+		size_t   j    = i;
+		for (; j > 0 && depths[order[j - 1]] < depths[item]; j--)
+		{
+			order[j] = order[j - 1];
+		}
+		order[j] = item;
+	}
+}
+
+// Returns whether the order is back to front, give or take the quantization step
+static bool IsBackToFront(const vector<float>& depths, const vector<uint32_t>& order)
+{
+	float minDepth = *min_element(depths.begin(), depths.end());
+	float maxDepth = *max_element(depths.begin(), depths.end());
+	float step     = (maxDepth - minDepth) / 65535;
+	for (size_t i = 1; i < order.size(); i++)
+	{
+		if (depths[order[i]] > depths[order[i - 1]] + step)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static void Usage()
+{
+	cerr << "Usage: SortBench [-n particles] [-f frames]" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg.size() != 2 || arg[0] != '-' || i + 1 >= argc)
+		{
+			Usage();
+			return 1;
+		}
+
+		int value = atoi(argv[++i]);
+		if (value <= 0)
+		{
+			Usage();
+			return 1;
+		}
+
+		switch (arg[1])
+		{
+			case 'n': options.particles = (unsigned int)value; break;
+			case 'f': options.frames    = (unsigned int)value; break;
+			default:  Usage(); return 1;
+		}
+	}
+
+	if (options.particles > 65536)
+	{
+		cerr << "SortBackToFront takes at most 65536 particles" << endl;
+		return 1;
+	}
+
+	printf("Nanoseconds per particle and frame:\n");
+	printf("%9s %12s %12s %12s\n", "particles", "radix", "stable", "insertion");
+	bool valid = true;
+	for (unsigned int n = min(256u, options.particles); ; n = min(n * 4, options.particles))
+	{
+		mt19937 random(1);
+		uniform_real_distribution<float> position(-200, 200), drift(-0.5f, 0.5f);
+
+		vector<float> depths(n);
+		for (size_t i = 0; i < n; i++)
+		{
+			depths[i] = position(random);
+		}
+
+		vector<uint32_t> radix, stable, insertion, keys, scratch;
+		StableSort(depths, insertion);
+
+		double seconds[3] = {0, 0, 0};
+		for (unsigned int frame = 0; frame < options.frames; frame++)
+		{
+			for (size_t i = 0; i < n; i++)
+			{
+				depths[i] += drift(random);
+			}
+
+			auto t0 = chrono::steady_clock::now();
+			SortBackToFront(depths, radix, keys, scratch);
+			auto t1 = chrono::steady_clock::now();
+			StableSort(depths, stable);
+			auto t2 = chrono::steady_clock::now();
+			InsertionSort(depths, insertion);
+			auto t3 = chrono::steady_clock::now();
+
+			seconds[0] += chrono::duration<double>(t1 - t0).count();
+			seconds[1] += chrono::duration<double>(t2 - t1).count();
+			seconds[2] += chrono::duration<double>(t3 - t2).count();
+		}
+
+		if (!IsBackToFront(depths, radix))
+		{
+			fprintf(stderr, "%u particles: the radix order is not back to front\n", n);
+			valid = false;
+		}
+
+		const double scale = 1e9 / ((double)n * options.frames);
+		printf("%9u %12.2f %12.2f %12.2f\n", n, seconds[0] * scale, seconds[1] * scale, seconds[2] * scale);
+		if (n == options.particles)
+		{
+			break;
+		}
+	}
+	return valid ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+#include "DepthSort.h"
+#include <algorithm>
+#include <float.h>
+using namespace std;
+
+void SortBackToFront(const vector<float>& depths, vector<uint32_t>& order, vector<uint32_t>& keys, vector<uint32_t>& scratch)
+{
+	size_t n = depths.size();
+	order.resize(n);
+	if (n == 0)
+	{
+		return;
+	}
+
+	// Key = quantized depth in the high 16 bits, index in the low 16 bits
+	keys.resize(n);
+	scratch.resize(n);
+	float minDepth =  FLT_MAX;
+	float maxDepth = -FLT_MAX;
+	for (size_t i = 0; i < n; i++)
+	{
+		minDepth = min(minDepth, depths[i]);
+		maxDepth = max(maxDepth, depths[i]);
+	}
+
+	float scale = (maxDepth > minDepth) ? 65535.0f / (maxDepth - minDepth) : 0.0f;
+	for (size_t i = 0; i < n; i++)
+	{
+		// Furthest first
+		uint32_t key = 65535 - (uint32_t)((depths[i] - minDepth) * scale);
+		keys[i]      = (key << 16) | (uint32_t)i;
+	}
+
+	uint32_t* src = &keys[0];
+	uint32_t* dst = &scratch[0];
+	for (int shift = 16; shift < 32; shift += 8)
+	{
+		size_t counts[257] = {0};
+		for (size_t i = 0; i < n; i++)
+		{
+			counts[((src[i] >> shift) & 0xFF) + 1]++;
+		}
+		for (int j = 1; j < 257; j++)
+		{
+			counts[j] += counts[j - 1];
+		}
+		for (size_t i = 0; i < n; i++)
+		{
+			dst[counts[(src[i] >> shift) & 0xFF]++] = src[i];
+		}
+		swap(src, dst);
+	}
+
+	for (size_t i = 0; i < n; i++)
+	{
+		order[i] = src[i] & 0xFFFF;
+	}
+}
@@ -0,0 +1,19 @@
+#ifndef DEPTHSORT_H
+#define DEPTHSORT_H
+
+#include <stdint.h>
+#include <vector>
+
+//
+// Orders items back to front by their depths along the view direction. The
+// depths are quantized to 16 bits over their range and radix sorted in two
+// 8-bit passes, so the cost is linear in the number of items. Items of equal
+// depth keep their order.
+//
+// There must be no more than 65536 items; the index shares the key with the
+// depth. The keys and scratch are work space, kept by the caller so they
+// needn't be allocated on every call.
+//
+void SortBackToFront(const std::vector<float>& depths, std::vector<uint32_t>& order, std::vector<uint32_t>& keys, std::vector<uint32_t>& scratch);
+
+#endif
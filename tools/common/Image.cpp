@@ -0,0 +1,299 @@
+#include "Image.h"
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string.h>
+using namespace std;
+
+static uint16_t ReadShort(const uint8_t* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static uint32_t ReadLong (const uint8_t* p) { return (uint32_t)(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24)); }
+
+static void Verify(bool condition, const string& filename, const char* reason)
+{
+	if (!condition)
+	{
+		throw runtime_error(filename + ": " + reason);
+	}
+}
+
+void Image::Resize(unsigned int w, unsigned int h)
+{
+	Pixel black = {0, 0, 0, 0};
+	width  = w;
+	height = h;
+	pixels.assign((size_t)w * h, black);
+}
+
+//
+// TGA
+//
+static void LoadTGA(Image& image, const vector<uint8_t>& data, const string& filename)
+{
+	Verify(data.size() >= 18, filename, "truncated header");
+	const uint8_t* hdr  = &data[0];
+	int  type   = hdr[2];
+	int  width  = ReadShort(hdr + 12);
+	int  height = ReadShort(hdr + 14);
+	int  bpp    = hdr[16];
+	bool topDown = (hdr[17] & 0x20) != 0;
+	Verify(type == 2 || type == 3 || type == 10 || type == 11, filename, "unsupported TGA type");
+	Verify(hdr[1] == 0, filename, "color-mapped TGAs are not supported");
+	Verify(bpp == 8 || bpp == 24 || bpp == 32, filename, "unsupported TGA pixel depth");
+
+	image.Resize(width, height);
+	size_t pos   = 18 + hdr[0];
+	size_t bytes = bpp / 8;
+	size_t count = (size_t)width * height;
+	bool   rle   = (type >= 9);
+	for (size_t i = 0; i < count; )
+	{
+		// Uncompressed data is read as one raw packet
+		size_t run = count - i;
+		bool   repeat = false;
+		if (rle)
+		{
+			Verify(pos < data.size(), filename, "truncated data");
+			repeat = (data[pos] & 0x80) != 0;
+			run    = min(run, (size_t)(data[pos] & 0x7F) + 1);
+			pos++;
+		}
+
+		for (size_t j = 0; j < run; j++, i++)
+		{
+			size_t src = repeat ? pos : pos + j * bytes;
+			Verify(src + bytes <= data.size(), filename, "truncated data");
+			Image::Pixel p;
+			if (bytes == 1)
+			{
+				p.r = p.g = p.b = data[src];
+				p.a = 255;
+			}
+			else
+			{
+				p.b = data[src + 0];
+				p.g = data[src + 1];
+				p.r = data[src + 2];
+				p.a = (bytes == 4) ? data[src + 3] : 255;
+			}
+			unsigned int x = (unsigned int)(i % width), y = (unsigned int)(i / width);
+			image(x, topDown ? y : height - 1 - y) = p;
+		}
+		pos += repeat ? bytes : run * bytes;
+	}
+}
+
+void Image::SaveTGA(const string& filename) const
+{
+	uint8_t hdr[18] = {0};
+	hdr[2]  = 2;
+	hdr[12] = (uint8_t)width;  hdr[13] = (uint8_t)(width  >> 8);
+	hdr[14] = (uint8_t)height; hdr[15] = (uint8_t)(height >> 8);
+	hdr[16] = 32;
+	hdr[17] = 0x28;		// Top-down, 8 alpha bits
+
+	vector<uint8_t> data(hdr, hdr + sizeof hdr);
+	data.reserve(data.size() + pixels.size() * 4);
+	for (size_t i = 0; i < pixels.size(); i++)
+	{
+		const Pixel& p = pixels[i];
+		data.push_back(p.b);
+		data.push_back(p.g);
+		data.push_back(p.r);
+		data.push_back(p.a);
+	}
+
+	ofstream file(filename.c_str(), ios::binary);
+	file.write((const char*)&data[0], data.size());
+	Verify(file.good(), filename, "unable to write file");
+}
+
+//
+// DDS
+//
+static Image::Pixel Unpack565(uint16_t c)
+{
+	Image::Pixel p;
+	p.r = (uint8_t)(((c >> 11) & 0x1F) * 255 / 31);
+	p.g = (uint8_t)(((c >>  5) & 0x3F) * 255 / 63);
+	p.b = (uint8_t)(((c >>  0) & 0x1F) * 255 / 31);
+	p.a = 255;
+	return p;
+}
+
+// Decodes the color part of a DXT block into 16 pixels
+static void DecodeColorBlock(const uint8_t* block, Image::Pixel out[16], bool dxt1)
+{
+	uint16_t c0 = ReadShort(block), c1 = ReadShort(block + 2);
+	Image::Pixel colors[4] = {Unpack565(c0), Unpack565(c1)};
+	if (c0 > c1 || !dxt1)
+	{
+		colors[2].r = (uint8_t)((2 * colors[0].r + colors[1].r) / 3); colors[3].r = (uint8_t)((colors[0].r + 2 * colors[1].r) / 3);
+		colors[2].g = (uint8_t)((2 * colors[0].g + colors[1].g) / 3); colors[3].g = (uint8_t)((colors[0].g + 2 * colors[1].g) / 3);
+		colors[2].b = (uint8_t)((2 * colors[0].b + colors[1].b) / 3); colors[3].b = (uint8_t)((colors[0].b + 2 * colors[1].b) / 3);
+		colors[2].a = colors[3].a = 255;
+	}
+	else
+	{
+		// Three colors and transparent black
+		colors[2].r = (uint8_t)((colors[0].r + colors[1].r) / 2);
+		colors[2].g = (uint8_t)((colors[0].g + colors[1].g) / 2);
+		colors[2].b = (uint8_t)((colors[0].b + colors[1].b) / 2);
+		colors[2].a = 255;
+		colors[3].r = colors[3].g = colors[3].b = colors[3].a = 0;
+	}
+
+	uint32_t indices = ReadLong(block + 4);
+	for (int i = 0; i < 16; i++, indices >>= 2)
+	{
+		out[i] = colors[indices & 3];
+	}
+}
+
+static void DecodeAlphaBlock(const uint8_t* block, Image::Pixel out[16])
+{
+	int a0 = block[0], a1 = block[1];
+	uint8_t alphas[8] = {(uint8_t)a0, (uint8_t)a1};
+	if (a0 > a1)
+	{
+		for (int i = 1; i < 7; i++) alphas[i + 1] = (uint8_t)(((7 - i) * a0 + i * a1) / 7);
+	}
+	else
+	{
+		for (int i = 1; i < 5; i++) alphas[i + 1] = (uint8_t)(((5 - i) * a0 + i * a1) / 5);
+		alphas[6] = 0;
+		alphas[7] = 255;
+	}
+
+	uint64_t indices = 0;
+	for (int i = 0; i < 6; i++)
+	{
+		indices |= (uint64_t)block[2 + i] << (8 * i);
+	}
+	for (int i = 0; i < 16; i++, indices >>= 3)
+	{
+		out[i].a = alphas[indices & 7];
+	}
+}
+
+// Extracts a channel with a bit mask and scales it to 8 bits
+static uint8_t ExtractChannel(uint32_t value, uint32_t mask, uint8_t missing)
+{
+	if (mask == 0)
+	{
+		return missing;
+	}
+	int shift = 0;
+	while (((mask >> shift) & 1) == 0) shift++;
+	uint32_t max = mask >> shift;
+	return (uint8_t)(((value & mask) >> shift) * 255 / max);
+}
+
+static void LoadDDS(Image& image, const vector<uint8_t>& data, const string& filename)
+{
+	Verify(data.size() >= 128 && memcmp(&data[0], "DDS ", 4) == 0, filename, "not a DDS file");
+	const uint8_t* hdr = &data[4];
+	unsigned int height = ReadLong(hdr + 8);
+	unsigned int width  = ReadLong(hdr + 12);
+	uint32_t     flags  = ReadLong(hdr + 76);
+	uint32_t     fourCC = ReadLong(hdr + 80);
+	uint32_t     bits   = ReadLong(hdr + 84);
+	uint32_t     masks[4] = {ReadLong(hdr + 88), ReadLong(hdr + 92), ReadLong(hdr + 96), ReadLong(hdr + 100)};
+
+	static const uint32_t DDPF_ALPHAPIXELS = 0x1;
+	static const uint32_t DDPF_FOURCC      = 0x4;
+
+	image.Resize(width, height);
+	const uint8_t* src = &data[128];
+	size_t         size = data.size() - 128;
+	if (flags & DDPF_FOURCC)
+	{
+		Verify(Image::GetDXTBlockSize(fourCC) != 0, filename, "unsupported DDS compression");
+		Verify(size >= Image::GetDXTSize(fourCC, width, height), filename, "truncated data");
+		image.DecodeDXT(fourCC, src, width, height);
+	}
+	else
+	{
+		Verify(bits == 16 || bits == 24 || bits == 32, filename, "unsupported DDS pixel format");
+		size_t bytes = bits / 8;
+		Verify(size >= (size_t)width * height * bytes, filename, "truncated data");
+		uint32_t alphaMask = (flags & DDPF_ALPHAPIXELS) ? masks[3] : 0;
+		for (size_t i = 0; i < (size_t)width * height; i++, src += bytes)
+		{
+			uint32_t value = 0;
+			for (size_t j = 0; j < bytes; j++)
+			{
+				value |= (uint32_t)src[j] << (8 * j);
+			}
+			Image::Pixel& p = image.pixels[i];
+			p.r = ExtractChannel(value, masks[0], 0);
+			p.g = ExtractChannel(value, masks[1], 0);
+			p.b = ExtractChannel(value, masks[2], 0);
+			p.a = ExtractChannel(value, alphaMask, 255);
+		}
+	}
+}
+
+size_t Image::GetDXTBlockSize(uint32_t fourCC)
+{
+	if (fourCC == ReadLong((const uint8_t*)"DXT1")) return 8;
+	if (fourCC == ReadLong((const uint8_t*)"DXT3")) return 16;
+	if (fourCC == ReadLong((const uint8_t*)"DXT5")) return 16;
+	return 0;
+}
+
+size_t Image::GetDXTSize(uint32_t fourCC, unsigned int width, unsigned int height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * GetDXTBlockSize(fourCC);
+}
+
+void Image::DecodeDXT(uint32_t fourCC, const uint8_t* src, unsigned int w, unsigned int h)
+{
+	bool   dxt1 = (fourCC == ReadLong((const uint8_t*)"DXT1"));
+	bool   dxt3 = (fourCC == ReadLong((const uint8_t*)"DXT3"));
+	size_t blockSize = GetDXTBlockSize(fourCC);
+	size_t bw = (w + 3) / 4, bh = (h + 3) / 4;
+
+	Resize(w, h);
+	for (size_t by = 0; by < bh; by++)
+	for (size_t bx = 0; bx < bw; bx++, src += blockSize)
+	{
+		Pixel block[16];
+		DecodeColorBlock(src + blockSize - 8, block, dxt1);
+		if (dxt3)
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				block[i].a = (uint8_t)(((src[i / 2] >> (4 * (i % 2))) & 0xF) * 17);
+			}
+		}
+		else if (!dxt1)
+		{
+			DecodeAlphaBlock(src, block);
+		}
+
+		for (size_t i = 0; i < 16; i++)
+		{
+			unsigned int x = (unsigned int)(bx * 4 + i % 4), y = (unsigned int)(by * 4 + i / 4);
+			if (x < w && y < h)
+			{
+				(*this)(x, y) = block[i];
+			}
+		}
+	}
+}
+
+void Image::Load(const string& filename)
+{
+	ifstream file(filename.c_str(), ios::binary);
+	Verify(file.is_open(), filename, "unable to open file");
+	vector<uint8_t> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+	if (data.size() >= 4 && memcmp(&data[0], "DDS ", 4) == 0)
+	{
+		LoadDDS(*this, data, filename);
+	}
+	else
+	{
+		LoadTGA(*this, data, filename);
+	}
+}
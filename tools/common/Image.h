@@ -0,0 +1,44 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//
+// An 8-bit RGBA image, top row first.
+// The command line tools use this instead of D3DX, so they can run without Direct3D.
+//
+struct Image
+{
+	struct Pixel
+	{
+		uint8_t r, g, b, a;
+	};
+
+	unsigned int       width;
+	unsigned int       height;
+	std::vector<Pixel> pixels;
+
+	      Pixel& operator()(unsigned int x, unsigned int y)       { return pixels[y * width + x]; }
+	const Pixel& operator()(unsigned int x, unsigned int y) const { return pixels[y * width + x]; }
+
+	void Resize(unsigned int w, unsigned int h);
+
+	// Loads a TGA (uncompressed or RLE, 8/24/32 bits) or DDS (DXT1/3/5, or
+	// uncompressed 16/24/32 bits) file; only the top mip level is read.
+	// Throws std::runtime_error on failure.
+	void Load(const std::string& filename);
+
+	// Decodes DXT1, DXT3 or DXT5 blocks, as given by their FourCC, into the image
+	static size_t GetDXTBlockSize(uint32_t fourCC);		// 0 if not supported
+	static size_t GetDXTSize(uint32_t fourCC, unsigned int width, unsigned int height);
+	void DecodeDXT(uint32_t fourCC, const uint8_t* blocks, unsigned int width, unsigned int height);
+
+	// Writes an uncompressed 32-bit TGA file
+	void SaveTGA(const std::string& filename) const;
+
+	Image() : width(0), height(0) {}
+};
+
+#endif
@@ -0,0 +1,444 @@
+#include "Rasterizer.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+using namespace std;
+
+// Calls f(i) for i in [0, count) on several threads
+template <typename F>
+static void ParallelFor(unsigned int numThreads, unsigned int count, const F& f)
+{
+	atomic<unsigned int> next(0);
+	auto work = [&]() {
+		for (unsigned int i; (i = next++) < count; )
+		{
+			f(i);
+		}
+	};
+
+	vector<thread> threads;
+	for (unsigned int i = 1; i < min(numThreads, count); i++)
+	{
+		threads.push_back(thread(work));
+	}
+	work();
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+}
+
+//
+// Sampling
+//
+// Wraps or clamps a texel coordinate
+static int Address(int x, int size, bool wrap)
+{
+	if (wrap)
+	{
+		x %= size;
+		return (x < 0) ? x + size : x;
+	}
+	return min(max(x, 0), size - 1);
+}
+
+static Rasterizer::Color Sample(const Image& image, float u, float v, bool wrap)
+{
+	float x  = u * image.width  - 0.5f;
+	float y  = v * image.height - 0.5f;
+	float fx = floor(x), fy = floor(y);
+	int   ix = (int)fx,  iy = (int)fy;
+	fx = x - fx;
+	fy = y - fy;
+
+	int x0 = Address(ix, image.width,  wrap), x1 = Address(ix + 1, image.width,  wrap);
+	int y0 = Address(iy, image.height, wrap), y1 = Address(iy + 1, image.height, wrap);
+	const Image::Pixel& c00 = image(x0, y0);
+	const Image::Pixel& c10 = image(x1, y0);
+	const Image::Pixel& c01 = image(x0, y1);
+	const Image::Pixel& c11 = image(x1, y1);
+
+	const float scale = 1 / 255.0f;
+	float w00 = (1 - fx) * (1 - fy) * scale, w10 = fx * (1 - fy) * scale, w01 = (1 - fx) * fy * scale, w11 = fx * fy * scale;
+	Rasterizer::Color c = {
+		c00.r * w00 + c10.r * w10 + c01.r * w01 + c11.r * w11,
+		c00.g * w00 + c10.g * w10 + c01.g * w01 + c11.g * w11,
+		c00.b * w00 + c10.b * w10 + c01.b * w01 + c11.b * w11,
+		c00.a * w00 + c10.a * w10 + c01.a * w01 + c11.a * w11,
+	};
+	return c;
+}
+
+static void BlendPixel(Rasterizer::Color& dst, const Rasterizer::Color& src, Rasterizer::Blend blend)
+{
+	switch (blend)
+	{
+		case Rasterizer::BLEND_OPAQUE:
+			dst = src;
+			break;
+
+		case Rasterizer::BLEND_ALPHA:
+			dst.r = src.r * src.a + dst.r * (1 - src.a);
+			dst.g = src.g * src.a + dst.g * (1 - src.a);
+			dst.b = src.b * src.a + dst.b * (1 - src.a);
+			dst.a = src.a * src.a + dst.a * (1 - src.a);
+			break;
+
+		case Rasterizer::BLEND_ADDITIVE:
+			dst.r += src.r;
+			dst.g += src.g;
+			dst.b += src.b;
+			dst.a += src.a;
+			break;
+
+		case Rasterizer::BLEND_MODULATE:
+			dst.r *= src.r;
+			dst.g *= src.g;
+			dst.b *= src.b;
+			dst.a *= src.a;
+			break;
+
+		case Rasterizer::BLEND_DARKEN:
+			dst.r *= 1 - src.a;
+			dst.g *= 1 - src.a;
+			dst.b *= 1 - src.a;
+			break;
+	}
+}
+
+//
+// Rasterizer
+//
+void Rasterizer::Resize(unsigned int width, unsigned int height)
+{
+	Flush();
+	Color black = {0, 0, 0, 0};
+	m_width  = width;
+	m_height = height;
+	m_tilesX = (width  + TILE_SIZE - 1) / TILE_SIZE;
+	m_tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	m_color.assign((size_t)width * height, black);
+	m_depth.assign((size_t)width * height, 1.0f);
+}
+
+void Rasterizer::Clear(bool color, bool depth, const Color& value, float z)
+{
+	ClearCommand clear = {color, depth, value, z, (uint32_t)m_triangles.size()};
+	m_clears.push_back(clear);
+}
+
+void Rasterizer::DrawTriangles(const State& state, const Vertex* vertices, const uint16_t* indices, size_t numTriangles)
+{
+	const State* last = m_states.empty() ? NULL : &m_states.back();
+	if (last == NULL || last->texture != state.texture || last->blend != state.blend || last->depthTest != state.depthTest || last->depthWrite != state.depthWrite)
+	{
+		m_states.push_back(state);
+	}
+
+	uint32_t index = (uint32_t)m_states.size() - 1;
+	for (size_t i = 0; i < numTriangles; i++, indices += 3)
+	{
+		ClipAndSetup(index, &vertices[indices[0]], &vertices[indices[1]], &vertices[indices[2]]);
+	}
+}
+
+// Clips a triangle against the near plane, z = 0. The rest of the view
+// volume is handled by the bounding boxes and the depth range.
+void Rasterizer::ClipAndSetup(uint32_t state, const Vertex* v0, const Vertex* v1, const Vertex* v2)
+{
+	const Vertex* in[3] = {v0, v1, v2};
+	int nInside = (v0->z >= 0) + (v1->z >= 0) + (v2->z >= 0);
+	if (nInside == 3)
+	{
+		Setup(state, *v0, *v1, *v2);
+		return;
+	}
+	if (nInside == 0)
+	{
+		return;
+	}
+
+	Vertex out[4];
+	int    nOut = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		const Vertex& a = *in[i];
+		const Vertex& b = *in[(i + 1) % 3];
+		if (a.z >= 0)
+		{
+			out[nOut++] = a;
+		}
+		if ((a.z >= 0) != (b.z >= 0))
+		{
+			float t = a.z / (a.z - b.z);
+			const float* pa = &a.x;
+			const float* pb = &b.x;
+			float*       po = &out[nOut++].x;
+			for (size_t j = 0; j < sizeof(Vertex) / sizeof(float); j++)
+			{
+				po[j] = pa[j] + (pb[j] - pa[j]) * t;
+			}
+		}
+	}
+
+	for (int i = 2; i < nOut; i++)
+	{
+		Setup(state, out[0], out[i - 1], out[i]);
+	}
+}
+
+void Rasterizer::Setup(uint32_t state, const Vertex& v0, const Vertex& v1, const Vertex& v2)
+{
+	const Vertex* v[3] = {&v0, &v1, &v2};
+	Triangle t;
+	t.state = state;
+	for (int i = 0; i < 3; i++)
+	{
+		if (v[i]->w <= 0)
+		{
+			return;
+		}
+		float invW = 1 / v[i]->w;
+		t.x[i]    = (v[i]->x * invW * 0.5f + 0.5f) * m_width;
+		t.y[i]    = (0.5f - v[i]->y * invW * 0.5f) * m_height;
+		t.z[i]    = v[i]->z * invW;
+		t.invW[i] = invW;
+		const float* attr = &v[i]->u;
+		for (int j = 0; j < 6; j++)
+		{
+			t.attr[i][j] = attr[j] * invW;
+		}
+	}
+
+	float area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (t.x[2] - t.x[0]) * (t.y[1] - t.y[0]);
+	if (area == 0 || std::isnan(area))
+	{
+		return;
+	}
+	if (area < 0)
+	{
+		// Make the edge functions positive inside
+		swap(t.x[1], t.x[2]); swap(t.y[1], t.y[2]); swap(t.z[1], t.z[2]); swap(t.invW[1], t.invW[2]);
+		for (int j = 0; j < 6; j++) swap(t.attr[1][j], t.attr[2][j]);
+	}
+
+	t.minX = max((int)floor(min(min(t.x[0], t.x[1]), t.x[2])), 0);
+	t.minY = max((int)floor(min(min(t.y[0], t.y[1]), t.y[2])), 0);
+	t.maxX = min((int)ceil (max(max(t.x[0], t.x[1]), t.x[2])), (int)m_width  - 1);
+	t.maxY = min((int)ceil (max(max(t.y[0], t.y[1]), t.y[2])), (int)m_height - 1);
+	if (t.minX <= t.maxX && t.minY <= t.maxY)
+	{
+		m_triangles.push_back(t);
+	}
+}
+
+void Rasterizer::Flush()
+{
+	if (m_triangles.empty() && m_clears.empty())
+	{
+		return;
+	}
+
+	// Bin the triangles by tile
+	m_bins.resize(m_tilesX * m_tilesY);
+	for (size_t i = 0; i < m_bins.size(); i++)
+	{
+		m_bins[i].clear();
+	}
+	for (size_t i = 0; i < m_triangles.size(); i++)
+	{
+		const Triangle& t = m_triangles[i];
+		for (int ty = t.minY / (int)TILE_SIZE; ty <= t.maxY / (int)TILE_SIZE; ty++)
+		for (int tx = t.minX / (int)TILE_SIZE; tx <= t.maxX / (int)TILE_SIZE; tx++)
+		{
+			m_bins[ty * m_tilesX + tx].push_back((uint32_t)i);
+		}
+	}
+
+	atomic<uint64_t> numPixels(0);
+	ParallelFor(m_numThreads, m_tilesX * m_tilesY, [&](unsigned int tile) {
+		uint64_t n = 0;
+		RenderTile(tile, n);
+		numPixels += n;
+	});
+	m_numShadedPixels += numPixels;
+
+	m_triangles.clear();
+	m_states.clear();
+	m_clears.clear();
+}
+
+void Rasterizer::RenderTile(unsigned int tile, uint64_t& numPixels)
+{
+	const vector<uint32_t>& bin = m_bins[tile];
+	int x0 = (tile % m_tilesX) * TILE_SIZE, x1 = min(x0 + (int)TILE_SIZE, (int)m_width)  - 1;
+	int y0 = (tile / m_tilesX) * TILE_SIZE, y1 = min(y0 + (int)TILE_SIZE, (int)m_height) - 1;
+
+	size_t clear = 0;
+	for (size_t i = 0; i <= bin.size(); i++)
+	{
+		uint32_t triangle = (i < bin.size()) ? bin[i] : (uint32_t)m_triangles.size();
+		for (; clear < m_clears.size() && m_clears[clear].triangle <= triangle; clear++)
+		{
+			ClearTile(m_clears[clear], x0, y0, x1, y1);
+		}
+		if (i < bin.size())
+		{
+			RenderTriangle(m_triangles[triangle], x0, y0, x1, y1, numPixels);
+		}
+	}
+}
+
+void Rasterizer::ClearTile(const ClearCommand& clear, int x0, int y0, int x1, int y1)
+{
+	for (int y = y0; y <= y1; y++)
+	{
+		size_t row = (size_t)y * m_width;
+		if (clear.color) fill(&m_color[row + x0], &m_color[row + x1] + 1, clear.value);
+		if (clear.depth) fill(&m_depth[row + x0], &m_depth[row + x1] + 1, clear.z);
+	}
+}
+
+// Pixels on an edge belong to the triangle if the edge is a top or left one,
+// so triangles that share an edge don't both draw its pixels
+static bool IsTopLeft(float ax, float ay, float bx, float by)
+{
+	return (by - ay) < 0 || ((by - ay) == 0 && (bx - ax) > 0);
+}
+
+void Rasterizer::RenderTriangle(const Triangle& t, int x0, int y0, int x1, int y1, uint64_t& numPixels)
+{
+	const State& state = m_states[t.state];
+	x0 = max(x0, t.minX); x1 = min(x1, t.maxX);
+	y0 = max(y0, t.minY); y1 = min(y1, t.maxY);
+
+	// Edge i is opposite vertex i. Edges are stepped across the pixels, and
+	// so are the depth and the attributes, as planes: value = dx * x + dy * y + c.
+	float ex[3], ey[3], ec[3];
+	bool  topLeft[3];
+	for (int i = 0; i < 3; i++)
+	{
+		int a = (i + 1) % 3, b = (i + 2) % 3;
+		ex[i] = -(t.y[b] - t.y[a]);
+		ey[i] =   t.x[b] - t.x[a];
+		ec[i] = -(ex[i] * t.x[a] + ey[i] * t.y[a]);
+		topLeft[i] = IsTopLeft(t.x[a], t.y[a], t.x[b], t.y[b]);
+	}
+	float invArea = 1 / (ex[0] * t.x[0] + ey[0] * t.y[0] + ec[0]);
+
+	// z, 1/w, then the attributes over w
+	static const int NUM_PLANES = 8;
+	float values[3][NUM_PLANES];
+	for (int i = 0; i < 3; i++)
+	{
+		values[i][0] = t.z[i];
+		values[i][1] = t.invW[i];
+		copy(t.attr[i], t.attr[i] + 6, &values[i][2]);
+	}
+	float pdx[NUM_PLANES], pdy[NUM_PLANES], pc[NUM_PLANES];
+	for (int j = 0; j < NUM_PLANES; j++)
+	{
+		float w0 = values[0][j] * invArea, w1 = values[1][j] * invArea, w2 = values[2][j] * invArea;
+		pdx[j] = ex[0] * w0 + ex[1] * w1 + ex[2] * w2;
+		pdy[j] = ey[0] * w0 + ey[1] * w1 + ey[2] * w2;
+		pc[j]  = ec[0] * w0 + ec[1] * w1 + ec[2] * w2;
+	}
+
+	for (int y = y0; y <= y1; y++)
+	{
+		float px = x0 + 0.5f, py = y + 0.5f;
+		float e[3], p[NUM_PLANES];
+		for (int i = 0; i < 3; i++)
+		{
+			e[i] = ex[i] * px + ey[i] * py + ec[i];
+		}
+		for (int j = 0; j < NUM_PLANES; j++)
+		{
+			p[j] = pdx[j] * px + pdy[j] * py + pc[j];
+		}
+
+		size_t row = (size_t)y * m_width;
+		for (int x = x0; x <= x1; x++)
+		{
+			bool inside = (e[0] > 0 || (e[0] == 0 && topLeft[0]))
+			           && (e[1] > 0 || (e[1] == 0 && topLeft[1]))
+			           && (e[2] > 0 || (e[2] == 0 && topLeft[2]));
+			float z = p[0];
+			if (inside && z <= 1 && (!state.depthTest || z <= m_depth[row + x]))
+			{
+				float w = 1 / p[1];
+				Color src = {p[4] * w, p[5] * w, p[6] * w, p[7] * w};
+				if (state.texture != NULL)
+				{
+					Color texel = Sample(*state.texture, p[2] * w, p[3] * w, true);
+					src.r *= texel.r;
+					src.g *= texel.g;
+					src.b *= texel.b;
+					src.a *= texel.a;
+				}
+				BlendPixel(m_color[row + x], src, state.blend);
+				if (state.depthWrite)
+				{
+					m_depth[row + x] = z;
+				}
+				numPixels++;
+			}
+
+			for (int i = 0; i < 3; i++)
+			{
+				e[i] += ex[i];
+			}
+			for (int j = 0; j < NUM_PLANES; j++)
+			{
+				p[j] += pdx[j];
+			}
+		}
+	}
+}
+
+void Rasterizer::Resolve(Image& image)
+{
+	Flush();
+	image.Resize(m_width, m_height);
+	for (size_t i = 0; i < m_color.size(); i++)
+	{
+		const Color& c = m_color[i];
+		Image::Pixel& p = image.pixels[i];
+		p.r = (uint8_t)(min(max(c.r, 0.0f), 1.0f) * 255 + 0.5f);
+		p.g = (uint8_t)(min(max(c.g, 0.0f), 1.0f) * 255 + 0.5f);
+		p.b = (uint8_t)(min(max(c.b, 0.0f), 1.0f) * 255 + 0.5f);
+		p.a = (uint8_t)(min(max(c.a, 0.0f), 1.0f) * 255 + 0.5f);
+	}
+}
+
+void Rasterizer::Distort(const Image& scene, const Image& heat, float amount)
+{
+	Flush();
+	ParallelFor(m_numThreads, m_height, [&](unsigned int y) {
+		float v = (y + 0.5f) / m_height;
+		for (unsigned int x = 0; x < m_width; x++)
+		{
+			float u = (x + 0.5f) / m_width;
+			Color h = Sample(heat, u, v, true);
+			m_color[(size_t)y * m_width + x] = Sample(scene, u + (h.r - 0.5f) * amount, v + (h.g - 0.5f) * amount, false);
+		}
+	});
+	m_numShadedPixels += (uint64_t)m_width * m_height;
+}
+
+uint64_t Rasterizer::GetNumShadedPixels()
+{
+	uint64_t n = m_numShadedPixels;
+	m_numShadedPixels = 0;
+	return n;
+}
+
+Rasterizer::Rasterizer(unsigned int numThreads)
+	: m_width(0), m_height(0), m_tilesX(0), m_tilesY(0), m_numThreads(numThreads), m_numShadedPixels(0)
+{
+	if (m_numThreads == 0)
+	{
+		m_numThreads = max(thread::hardware_concurrency(), 1u);
+	}
+}
@@ -0,0 +1,120 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include "Image.h"
+#include <stdint.h>
+#include <vector>
+
+//
+// A software rasterizer for particle triangles, for rendering without a GPU.
+//
+// Triangles are clipped and set up as they are drawn, and rendered by Flush.
+// The target is split into tiles, which threads render independently; each
+// tile draws the triangles that touch it in the order they were drawn, so the
+// result doesn't depend on the number of threads.
+//
+// Colors are kept as floats, and textures are sampled bilinearly with
+// wrapping texture coordinates, like the engine's samplers by default.
+//
+class Rasterizer
+{
+public:
+	enum Blend
+	{
+		BLEND_OPAQUE,		// src
+		BLEND_ALPHA,		// src * src.a + dst * (1 - src.a)
+		BLEND_ADDITIVE,		// src + dst
+		BLEND_MODULATE,		// src * dst
+		BLEND_DARKEN,		// dst * (1 - src.a)
+	};
+
+	struct Vertex
+	{
+		float x, y, z, w;	// Clip space, as D3D: 0 <= z <= w is visible
+		float u, v;
+		float r, g, b, a;
+	};
+
+	struct State
+	{
+		const Image* texture;	// NULL is white
+		Blend        blend;
+		bool         depthTest;
+		bool         depthWrite;
+	};
+
+	struct Color
+	{
+		float r, g, b, a;
+	};
+
+	unsigned int GetWidth()  const { return m_width;  }
+	unsigned int GetHeight() const { return m_height; }
+
+	// Resizing loses the contents
+	void Resize(unsigned int width, unsigned int height);
+
+	// Clears the target before whatever is drawn after it
+	void Clear(bool color, bool depth, const Color& value, float z);
+
+	// Draws indexed triangles; the state and texture must stay valid until Flush
+	void DrawTriangles(const State& state, const Vertex* vertices, const uint16_t* indices, size_t numTriangles);
+
+	// Renders everything that was drawn
+	void Flush();
+
+	// Flushes and converts the target to 8 bits per channel
+	void Resolve(Image& image);
+
+	// Replaces the target with 'scene', offset per pixel by the red and green
+	// of 'heat' around one half, times 'amount' (see SceneHeat.fx)
+	void Distort(const Image& scene, const Image& heat, float amount);
+
+	// Returns the number of pixels shaded since the last call
+	uint64_t GetNumShadedPixels();
+
+	// 0 threads uses one per hardware thread
+	Rasterizer(unsigned int numThreads = 0);
+
+private:
+	static const unsigned int TILE_SIZE = 64;
+
+	// A triangle in screen space, with attributes divided by w
+	struct Triangle
+	{
+		float    x[3], y[3], z[3];
+		float    invW[3];
+		float    attr[3][6];		// u, v, r, g, b, a over w
+		uint32_t state;
+		int      minX, minY, maxX, maxY;
+	};
+
+	// Clears are applied by each tile between the triangles drawn before
+	// and after them
+	struct ClearCommand
+	{
+		bool     color, depth;
+		Color    value;
+		float    z;
+		uint32_t triangle;		// First triangle drawn after the clear
+	};
+
+	void ClipAndSetup(uint32_t state, const Vertex* v0, const Vertex* v1, const Vertex* v2);
+	void Setup(uint32_t state, const Vertex& v0, const Vertex& v1, const Vertex& v2);
+	void RenderTile(unsigned int tile, uint64_t& numPixels);
+	void RenderTriangle(const Triangle& triangle, int x0, int y0, int x1, int y1, uint64_t& numPixels);
+	void ClearTile(const ClearCommand& clear, int x0, int y0, int x1, int y1);
+
+	unsigned int                        m_width, m_height;
+	unsigned int                        m_tilesX, m_tilesY;
+	unsigned int                        m_numThreads;
+	std::vector<Color>                  m_color;
+	std::vector<float>                  m_depth;
+	std::vector<State>                  m_states;
+	std::vector<Triangle>               m_triangles;
+	std::vector<ClearCommand>           m_clears;
+	std::vector<std::vector<uint32_t> > m_bins;		// Triangles per tile
+	uint64_t                            m_numShadedPixels;
+};
+
+#endif